@@ -23,9 +23,23 @@
 #include <time.h>
 #include <sys/stat.h>
 #include "config.h"
+#include <stdint.h>
+#include <stddef.h>
 #include "babl-internal.h"
 #include "git-version.h"
 
+#ifdef _WIN32
+#include <process.h>
+#define getpid _getpid
+#else
+#include <unistd.h>
+#endif
+#ifdef HAVE_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <dirent.h>
+#endif
+
 #ifdef _WIN32
 #ifndef S_IRWXU
   #define S_IRWXU 0000700
@@ -40,9 +54,9 @@
 #endif
 
 #ifdef _WIN32
-#define FALLBACK_CACHE_PATH  "C:/babl-fishes.txt"
+#define FALLBACK_CACHE_PATH  "C:/babl-fish-cache.bin"
 #else
-#define FALLBACK_CACHE_PATH  "/tmp/babl-fishes.txt"
+#define FALLBACK_CACHE_PATH  "/tmp/babl-fish-cache"
 #endif
 
 static int
@@ -106,9 +120,9 @@ fish_cache_path (void)
   buf[sizeof (buf) - 1] = '\0';
 
   if (getenv ("XDG_CACHE_HOME"))
-    snprintf (buf, sizeof (buf), "%s/babl/babl-fishes", getenv("XDG_CACHE_HOME"));
+    snprintf (buf, sizeof (buf), "%s/babl/babl-fish-cache", getenv("XDG_CACHE_HOME"));
   else if (getenv ("HOME"))
-    snprintf (buf, sizeof (buf), "%s/.cache/babl/babl-fishes", getenv("HOME"));
+    snprintf (buf, sizeof (buf), "%s/.cache/babl/babl-fish-cache", getenv("HOME"));
 
   path = babl_strdup (buf);
 
@@ -123,7 +137,7 @@ fish_cache_path (void)
 
       if (appdata && appdata[0])
         {
-          const char *fmt = "%s\\%s\\babl-fishes.txt";
+          const char *fmt = "%s\\%s\\babl-fish-cache.bin";
           size_t sz = add_check_overflow (3, strlen (fmt), strlen (appdata), strlen (BABL_LIBRARY));
 
           if (sz > 0 && (path = babl_malloc (sz)) != NULL)
@@ -139,7 +153,7 @@ fish_cache_path (void)
   else if (getenv("TEMP"))
 #endif
     {
-      snprintf (buf, sizeof (buf), "%s\\babl-fishes.txt", env);
+      snprintf (buf, sizeof (buf), "%s\\babl-fish-cache.bin", env);
       path = babl_strdup (buf);
       free (env);
     }
@@ -164,153 +178,785 @@ fish_cache_path (void)
   return path;
 }
 
-static char *
-babl_fish_serialize (Babl *fish, char *dest, int n)
+static const char *
+cache_header (void)
 {
-  char *d = dest;
-  if (fish->class_type != BABL_FISH &&
-      fish->class_type != BABL_FISH_PATH)
-  {
+  static char buf[2048];
+  if (strchr (BABL_GIT_VERSION, ' ')) // we must be building from tarball
+    snprintf (buf, sizeof (buf),
+             "#%i.%i.%i BABL_PATH_LENGTH=%d BABL_TOLERANCE=%f",
+             BABL_MAJOR_VERSION, BABL_MINOR_VERSION, BABL_MICRO_VERSION,
+             _babl_max_path_len (), _babl_legal_error ());
+  else
+    snprintf (buf, sizeof (buf), "#%s BABL_PATH_LENGTH=%d BABL_TOLERANCE=%f",
+             BABL_GIT_VERSION, _babl_max_path_len (), _babl_legal_error ());
+  return buf;
+}
+
+/* The fish cache is a binary file made up of a BablCacheHeader followed by
+ * one record per cached fish. Fishes are appended to the file as they are
+ * created, and when a pair of formats occurs more than once the last record
+ * wins; the fishes of babl_fast_fish () are kept alongside those of
+ * babl_fish (), told apart by their tolerance. The file is mapped read-only
+ * at startup and indexed by format pair and tolerance, records are only
+ * checksummed and turned into fishes the first time the pair is asked for,
+ * and the file is only rewritten - into a temporary file that is atomically
+ * renamed into place - once enough of its records have been superseded to
+ * make compacting it worthwhile.
+ */
+
+#define BABL_CACHE_MAGIC           "babl-fc\n"
+#define BABL_CACHE_VERSION         2
+#define BABL_CACHE_BYTE_ORDER      0x01020304
+#define BABL_CACHE_BUILD_LEN       120
+
+#define BABL_CACHE_MAX_RECORD      8192
+#define BABL_CACHE_MAX_CONVERSIONS 16
+
+/* no usable path exists, the reference fish is used for this pair */
+#define BABL_CACHE_REFERENCE       (1 << 0)
+/* not a fish but the LUT timings of a CPU, see babl_lut_timings_load () */
+#define BABL_CACHE_LUT_TIMINGS     (1 << 1)
+
+#define BABL_CACHE_LUT_TIMINGS_NAME "babl-lut-timings"
+
+typedef struct BablCacheHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  char     build[BABL_CACHE_BUILD_LEN]; /* cache_header () of the writer */
+} BablCacheHeader;
+
+typedef struct BablCacheRecord
+{
+  uint32_t size;          /* including this struct, a multiple of 8 */
+  uint32_t checksum;      /* of the bytes following this member */
+  uint32_t hash;          /* of the source and destination names and the
+                           * tolerance */
+  uint16_t flags;
+  uint16_t n_conversions;
+  double   cost;
+  double   error;
+  double   tolerance;     /* of a babl_fast_fish (), 0.0 for babl_fish () */
+  /* followed by the nul terminated names of the source and destination
+   * formats, and those of the n_conversions conversions of the path */
+} BablCacheRecord;
+
+typedef struct BablCacheMap
+{
+  const char *data;
+  long        length;
+  int         mapped;
+} BablCacheMap;
+
+/* open addressing table of record offsets keyed by the pair hash, since
+ * the header comes first no record starts at offset 0 */
+typedef struct BablCacheIndex
+{
+  uint32_t *offsets;
+  int       size;
+  int       n_records;
+  int       n_unique;
+  int       truncated; /* the file has trailing garbage */
+} BablCacheIndex;
+
+/* the cache as found at startup */
+static BablCacheMap   cache_map;
+static BablCacheIndex cache_index;
+static int            cache_compact = 0;
+
+static uint32_t
+cache_hash (const char *data,
+            long        length,
+            uint32_t    hash)
+{
+  long i;
+
+  /* FNV-1a */
+  for (i = 0; i < length; i++)
+    {
+      hash ^= (unsigned char) data[i];
+      hash *= 16777619u;
+    }
+  return hash;
+}
+
+static uint32_t
+cache_pair_hash (const char *source,
+                 const char *destination,
+                 double      tolerance)
+{
+  uint32_t hash = 2166136261u;
+
+  hash = cache_hash (source, strlen (source) + 1, hash);
+  hash = cache_hash (destination, strlen (destination) + 1, hash);
+  hash = cache_hash ((const char *) &tolerance, sizeof (tolerance), hash);
+  return hash;
+}
+
+static void
+cache_header_init (BablCacheHeader *header)
+{
+  const char *build = cache_header ();
+  size_t      len   = strlen (build);
+
+  if (len > BABL_CACHE_BUILD_LEN - 1)
+    len = BABL_CACHE_BUILD_LEN - 1;
+
+  memset (header, 0, sizeof (BablCacheHeader));
+  memcpy (header->magic, BABL_CACHE_MAGIC, sizeof (header->magic));
+  header->version    = BABL_CACHE_VERSION;
+  header->byte_order = BABL_CACHE_BYTE_ORDER;
+  memcpy (header->build, build, len);
+}
+
+static const BablCacheRecord *
+cache_record_at (const BablCacheMap *map,
+                 long                offset)
+{
+  const BablCacheRecord *record;
+
+  if (offset + (long) sizeof (BablCacheRecord) > map->length)
     return NULL;
-  }
 
-  snprintf (d, n, "%s\n%s\n",
-  babl_get_name (fish->fish.source),
-  babl_get_name (fish->fish.destination));
-  n -= strlen (d);d += strlen (d);
+  record = (const BablCacheRecord *) (map->data + offset);
+  if (record->size < sizeof (BablCacheRecord) + 4 ||
+      record->size > BABL_CACHE_MAX_RECORD ||
+      record->size % 8 ||
+      offset + (long) record->size > map->length)
+    return NULL;
 
-  snprintf (d, n, "\tpixels=%li", fish->fish.pixels);
-  n -= strlen (d);d += strlen (d);
+  return record;
+}
 
-  if (fish->class_type == BABL_FISH_PATH)
-  {
-    snprintf (d, n, " cost=%d", (int)fish->fish_path.cost);
-    n -= strlen (d);d += strlen (d);
-  }
+/* splits the names out of a record, returns the number of names found or
+ * 0 if the record is corrupt; with verify set the checksum is checked too.
+ */
+static int
+cache_record_names (const BablCacheRecord *record,
+                    const char           **names,
+                    int                    max_names,
+                    int                    verify)
+{
+  const char *p   = (const char *) (record + 1);
+  const char *end = ((const char *) record) + record->size;
+  int         n_names = record->n_conversions + 2;
+  int         i;
+
+  if (n_names > max_names)
+    return 0;
 
-  snprintf (d, n, " error=%.10f", fish->fish.error);
-  n -= strlen (d);d += strlen (d);
+  if (verify &&
+      cache_hash ((const char *) &record->hash,
+                  record->size - offsetof (BablCacheRecord, hash),
+                  2166136261u) != record->checksum)
+    return 0;
 
-  if (fish->class_type == BABL_FISH)
+  for (i = 0; i < n_names; i++)
+    {
+      const char *nul = memchr (p, 0, end - p);
+      if (!nul)
+        return 0;
+      names[i] = p;
+      p = nul + 1;
+    }
+  return n_names;
+}
+
+static void
+cache_map_close (BablCacheMap *map)
+{
+#ifdef HAVE_MMAP
+  if (map->mapped)
+    munmap ((void *) map->data, map->length);
+  else
+#endif
+  if (map->data)
+    free ((void *) map->data);
+  memset (map, 0, sizeof (BablCacheMap));
+}
+
+static int
+cache_map_open (BablCacheMap *map,
+                const char   *path)
+{
+  BablCacheHeader header;
+  char           *contents = NULL;
+
+  memset (map, 0, sizeof (BablCacheMap));
+
+#ifdef HAVE_MMAP
   {
-    snprintf (d, n, " [reference]");
-    n -= strlen (d);d += strlen (d);
+    int         fd = open (path, O_RDONLY);
+    struct stat st;
+
+    if (fd < 0)
+      return -1;
+
+    if (fstat (fd, &st) == 0 && st.st_size >= (off_t) sizeof (BablCacheHeader))
+      {
+        void *data = mmap (NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        if (data != MAP_FAILED)
+          {
+            map->data   = data;
+            map->length = st.st_size;
+            map->mapped = 1;
+          }
+      }
+    close (fd);
   }
+#endif
 
-  snprintf (d, n, "\n");
-  n -= strlen (d);d += strlen (d);
+  if (!map->data)
+    {
+      long length = -1;
 
-  if (fish->class_type == BABL_FISH_PATH)
-  {
-    for (int i = 0; i < fish->fish_path.conversion_list->count; i++)
+      _babl_file_get_contents (path, &contents, &length, NULL);
+      if (!contents)
+        return -1;
+      map->data   = contents;
+      map->length = length;
+    }
+
+  cache_header_init (&header);
+  if (map->length < (long) sizeof (BablCacheHeader) ||
+      memcmp (map->data, &header, sizeof (BablCacheHeader)))
     {
-      snprintf (d, n, "\t%s\n",
-        babl_get_name(fish->fish_path.conversion_list->items[i]  ));
-      n -= strlen (d);d += strlen (d);
+      /* another version of babl, a different configuration or not a
+       * cache file at all */
+      cache_map_close (map);
+      return -1;
     }
-  }
+  return 0;
+}
 
-  return dest;
+/* the names of the source and destination formats of a record */
+static int
+cache_record_pair (const BablCacheRecord *record,
+                   const char           **source,
+                   const char           **destination)
+{
+  const char *p   = (const char *) (record + 1);
+  const char *end = ((const char *) record) + record->size;
+  const char *nul = memchr (p, 0, end - p);
+
+  if (!nul)
+    return 0;
+  *source = p;
+  p = nul + 1;
+  if (!memchr (p, 0, end - p))
+    return 0;
+  *destination = p;
+  return 1;
 }
 
-static int 
-compare_fish_pixels (const void *a, const void *b)
+/* returns the slot holding the record for the pair and tolerance, or the
+ * empty slot where it would go */
+static int
+cache_index_find (const BablCacheIndex *index,
+                  const BablCacheMap   *map,
+                  uint32_t              hash,
+                  const char           *source,
+                  const char           *destination,
+                  double                tolerance)
 {
-  const Babl **fa = (void*)a;
-  const Babl **fb = (void*)b;
-  return ((*fb)->fish.pixels - (*fa)->fish.pixels);
+  int slot;
+
+  for (slot = hash & (index->size - 1);
+       index->offsets[slot];
+       slot = (slot + 1) & (index->size - 1))
+    {
+      const BablCacheRecord *record = (const BablCacheRecord *)
+                                      (map->data + index->offsets[slot]);
+      const char            *record_source;
+      const char            *record_destination;
+
+      if (record->hash == hash &&
+          record->tolerance == tolerance &&
+          cache_record_pair (record, &record_source, &record_destination) &&
+          !strcmp (source, record_source) &&
+          !strcmp (destination, record_destination))
+        break;
+    }
+  return slot;
 }
 
-static const char *
-cache_header (void)
+static void
+cache_index_build (BablCacheIndex     *index,
+                   const BablCacheMap *map)
 {
-  static char buf[2048];
-  if (strchr (BABL_GIT_VERSION, ' ')) // we must be building from tarball
-    snprintf (buf, sizeof (buf),
-             "#%i.%i.%i BABL_PATH_LENGTH=%d BABL_TOLERANCE=%f",
-             BABL_MAJOR_VERSION, BABL_MINOR_VERSION, BABL_MICRO_VERSION,
-             _babl_max_path_len (), _babl_legal_error ());
-  else
-    snprintf (buf, sizeof (buf), "#%s BABL_PATH_LENGTH=%d BABL_TOLERANCE=%f",
-             BABL_GIT_VERSION, _babl_max_path_len (), _babl_legal_error ());
-  return buf;
+  long offset;
+  int  n_records = 0;
+
+  memset (index, 0, sizeof (BablCacheIndex));
+
+  offset = sizeof (BablCacheHeader);
+  while (cache_record_at (map, offset))
+    {
+      offset += cache_record_at (map, offset)->size;
+      n_records++;
+    }
+  index->truncated = (offset != map->length);
+
+  for (index->size = 16; index->size < n_records * 2; index->size *= 2);
+  index->offsets = babl_calloc (index->size, sizeof (uint32_t));
+
+  offset = sizeof (BablCacheHeader);
+  while (offset < map->length)
+    {
+      const BablCacheRecord *record = cache_record_at (map, offset);
+      const char            *source;
+      const char            *destination;
+
+      if (!record)
+        break;
+
+      if (cache_record_pair (record, &source, &destination))
+        {
+          int slot = cache_index_find (index, map, record->hash,
+                                       source, destination,
+                                       record->tolerance);
+
+          if (!index->offsets[slot])
+            index->n_unique++;
+          /* later records supersede earlier ones */
+          index->offsets[slot] = offset;
+          index->n_records++;
+        }
+      offset += record->size;
+    }
 }
 
-void
-babl_store_db (void)
+static void
+cache_index_free (BablCacheIndex *index)
 {
-  BablDb *db = babl_fish_db ();
-  char *cache_path = fish_cache_path ();
-  char *tmpp = calloc(8000,1);
-  FILE *dbfile = NULL;
-  int i;
+  babl_free (index->offsets);
+  index->offsets = NULL;
+}
 
-  if (!cache_path || !tmpp)
-    goto cleanup;
+static int
+cache_record_serialize (Babl *fish,
+                        char *dest,
+                        int   n)
+{
+  BablCacheRecord *record = (BablCacheRecord *) dest;
+  const char      *names[2 + BABL_CACHE_MAX_CONVERSIONS];
+  int              n_names = 2;
+  int              size = sizeof (BablCacheRecord);
+  int              i;
 
-  snprintf (tmpp, 8000, "%s~", cache_path);
-  dbfile  = _babl_fopen (tmpp, "w");
-  if (!dbfile)
-    goto cleanup;
+  if (fish->class_type != BABL_FISH &&
+      fish->class_type != BABL_FISH_PATH)
+  {
+    return 0;
+  }
 
-  fprintf (dbfile, "%s\n", cache_header ());
+  memset (record, 0, sizeof (BablCacheRecord));
+  names[0] = babl_get_name (fish->fish.source);
+  names[1] = babl_get_name (fish->fish.destination);
 
-  /* sort the list of fishes by usage, making next run more efficient -
-   * and the data easier to approach as data for targeted optimization
-   */
-  qsort (db->babl_list->items, db->babl_list->count,
-         sizeof (Babl*), compare_fish_pixels);
+  if (fish->class_type == BABL_FISH_PATH)
+  {
+    if (fish->fish_path.conversion_list->count > BABL_CACHE_MAX_CONVERSIONS)
+      return 0;
+    for (i = 0; i < fish->fish_path.conversion_list->count; i++)
+      names[n_names++] = babl_get_name (fish->fish_path.conversion_list->items[i]);
+    record->cost      = fish->fish_path.cost;
+    record->tolerance = fish->fish_path.tolerance;
+  }
+  else
+  {
+    record->flags |= BABL_CACHE_REFERENCE;
+  }
 
-  for (i = 0; i< db->babl_list->count; i++)
+  for (i = 0; i < n_names; i++)
   {
-    Babl *fish = db->babl_list->items[i];
-    char tmp[8192];
-    if (babl_fish_serialize (fish, tmp, 4096))
-      fprintf (dbfile, "%s----\n", tmp);
+    int len = strlen (names[i]) + 1;
+    if (size + len + 8 > n || size + len + 8 > BABL_CACHE_MAX_RECORD)
+      return 0;
+    memcpy (dest + size, names[i], len);
+    size += len;
   }
+  /* pad to keep the records that follow aligned */
+  while (size % 8)
+    dest[size++] = 0;
+
+  record->size          = size;
+  record->hash          = cache_pair_hash (names[0], names[1],
+                                           record->tolerance);
+  record->n_conversions = n_names - 2;
+  record->error         = fish->fish.error;
+  record->checksum      = cache_hash ((const char *) &record->hash,
+                                      size - offsetof (BablCacheRecord, hash),
+                                      2166136261u);
+  return size;
+}
 
-  fclose (dbfile);
-  dbfile = NULL;
+/* replaces the cache with a new file holding a header and the given
+ * records; the file is written under a temporary name and renamed into
+ * place, so concurrent readers see either the old or the new cache.
+ */
+static int
+cache_write_file (const char *cache_path,
+                  const char *records,
+                  long        length)
+{
+  BablCacheHeader header;
+  char            tmpp[4096];
+  FILE           *dbfile;
+  int             ok;
 
+  snprintf (tmpp, sizeof (tmpp), "%s~%i", cache_path, (int) getpid ());
+  dbfile = _babl_fopen (tmpp, "wb");
+  if (!dbfile)
+    return -1;
+
+  cache_header_init (&header);
+  ok = fwrite (&header, sizeof (header), 1, dbfile) == 1;
+  if (ok && length)
+    ok = fwrite (records, length, 1, dbfile) == 1;
+  ok = (fclose (dbfile) == 0) && ok;
+
+  if (ok)
+    {
 #ifdef _WIN32
-  _babl_remove (cache_path);
+      _babl_remove (cache_path);
 #endif
-  _babl_rename (tmpp, cache_path);
+      ok = _babl_rename (tmpp, cache_path) == 0;
+    }
+  if (!ok)
+    _babl_remove (tmpp);
+  return ok ? 0 : -1;
+}
 
-cleanup:
+/* appends a record to the cache, starting a new cache if there is none or
+ * it was written by another version of babl */
+static void
+cache_append (const char *record,
+              int         size)
+{
+  char           *cache_path = fish_cache_path ();
+  BablCacheHeader header;
+  BablCacheHeader file_header;
+  FILE           *dbfile;
+
+  if (!cache_path)
+    return;
+
+  cache_header_init (&header);
+  dbfile = _babl_fopen (cache_path, "rb");
+  if (!dbfile ||
+      fread (&file_header, sizeof (file_header), 1, dbfile) != 1 ||
+      memcmp (&header, &file_header, sizeof (header)))
+    {
+      if (dbfile)
+        fclose (dbfile);
+      cache_write_file (cache_path, record, size);
+      babl_free (cache_path);
+      return;
+    }
+  fclose (dbfile);
+
+  /* a single write in append mode, records appended concurrently by other
+   * processes do not interleave */
+  dbfile = _babl_fopen (cache_path, "ab");
   if (dbfile)
-    fclose (dbfile);
+    {
+      fwrite (record, size, 1, dbfile);
+      fclose (dbfile);
+    }
+  babl_free (cache_path);
+}
 
+void
+babl_fish_cache_add (Babl *fish)
+{
+  char record[BABL_CACHE_MAX_RECORD];
+  int  size;
+
+  size = cache_record_serialize (fish, record, sizeof (record));
+  if (size)
+    cache_append (record, size);
+}
+
+/* The LUT timings are kept in the cache as a record for a pseudo pair of
+ * BABL_CACHE_LUT_TIMINGS_NAME and the key of the CPU they were measured on,
+ * holding the timings after the padded names.
+ */
+int
+babl_lut_timings_load (const char *key,
+                       float      *timings,
+                       int         n_timings)
+{
+  const BablCacheRecord *record;
+  const char            *names[2];
+  uint32_t               hash;
+  long                   offset;
+  int                    slot;
+
+  if (!cache_index.offsets)
+    return 0;
+
+  hash = cache_pair_hash (BABL_CACHE_LUT_TIMINGS_NAME, key, 0.0);
+  slot = cache_index_find (&cache_index, &cache_map, hash,
+                           BABL_CACHE_LUT_TIMINGS_NAME, key, 0.0);
+  if (!cache_index.offsets[slot])
+    return 0;
+
+  record = (const BablCacheRecord *) (cache_map.data + cache_index.offsets[slot]);
+  if (!(record->flags & BABL_CACHE_LUT_TIMINGS) ||
+      cache_record_names (record, names, 2, 1) != 2)
+    return 0;
+
+  offset = (names[1] + strlen (names[1]) + 1) - (const char *) record;
+  offset = (offset + 7) & ~7;
+  if (((offset + n_timings * (long) sizeof (float) + 7) & ~7) != record->size)
+    return 0;
+
+  memcpy (timings, ((const char *) record) + offset,
+          n_timings * sizeof (float));
+  return 1;
+}
+
+void
+babl_lut_timings_save (const char  *key,
+                       const float *timings,
+                       int          n_timings)
+{
+  char             record[BABL_CACHE_MAX_RECORD];
+  BablCacheRecord *header = (BablCacheRecord *) record;
+  const char      *names[2] = {BABL_CACHE_LUT_TIMINGS_NAME, key};
+  int              size = sizeof (BablCacheRecord);
+  int              i;
+
+  memset (header, 0, sizeof (BablCacheRecord));
+  for (i = 0; i < 2; i++)
+    {
+      int len = strlen (names[i]) + 1;
+      if (size + len + 8 + n_timings * (int) sizeof (float) > BABL_CACHE_MAX_RECORD)
+        return;
+      memcpy (record + size, names[i], len);
+      size += len;
+    }
+  while (size % 8)
+    record[size++] = 0;
+  memcpy (record + size, timings, n_timings * sizeof (float));
+  size += n_timings * sizeof (float);
+  while (size % 8)
+    record[size++] = 0;
+
+  header->size     = size;
+  header->hash     = cache_pair_hash (names[0], names[1], 0.0);
+  header->flags    = BABL_CACHE_LUT_TIMINGS;
+  header->checksum = cache_hash ((const char *) &header->hash,
+                                 size - offsetof (BablCacheRecord, hash),
+                                 2166136261u);
+  cache_append (record, size);
+}
+
+static int
+compare_offsets (const void *a,
+                 const void *b)
+{
+  const uint32_t *oa = a;
+  const uint32_t *ob = b;
+  return (*oa > *ob) - (*oa < *ob);
+}
+
+void
+babl_store_db (void)
+{
+  char          *cache_path = NULL;
+  char          *records    = NULL;
+  long           length     = 0;
+  BablCacheMap   map;
+  BablCacheIndex index;
+  int            i, n;
+
+  if (cache_index.offsets)
+    cache_index_free (&cache_index);
+  cache_map_close (&cache_map);
+
+  /* new fishes are already on disk, only rewrite the cache if it has
+   * accumulated superseded or corrupt records */
+  if (!cache_compact)
+    return;
+  cache_compact = 0;
+
+  cache_path = fish_cache_path ();
+  if (!cache_path || cache_map_open (&map, cache_path))
+    goto cleanup;
+
+  cache_index_build (&index, &map);
+
+  /* keep the surviving records in the order they were added */
+  for (i = 0, n = 0; i < index.size; i++)
+    if (index.offsets[i])
+      index.offsets[n++] = index.offsets[i];
+  qsort (index.offsets, n, sizeof (uint32_t), compare_offsets);
+
+  records = malloc (map.length);
+  if (records)
+    {
+      for (i = 0; i < n; i++)
+        {
+          const BablCacheRecord *record = (const BablCacheRecord *)
+                                          (map.data + index.offsets[i]);
+          memcpy (records + length, record, record->size);
+          length += record->size;
+        }
+      cache_write_file (cache_path, records, length);
+      free (records);
+    }
+
+  cache_index_free (&index);
+  cache_map_close (&map);
+
+cleanup:
   if (cache_path)
     babl_free (cache_path);
-
-  if (tmpp)
-    free (tmpp);
 }
 
 int
 _babl_fish_path_destroy (void *data);
 
 char *
-_babl_fish_create_name (char       *buf,
-                        const Babl *source,
+_babl_fish_path_create_name (char       *buf,
+                             const Babl *source,
+                             const Babl *destination,
+                             double      tolerance);
+
+static Babl *
+cache_record_to_fish (const BablCacheRecord *record,
+                      const Babl            *from_format,
+                      const Babl            *to_format)
+{
+  const char *names[2 + BABL_CACHE_MAX_CONVERSIONS];
+  Babl       *babl = NULL;
+  char        name[4096];
+  int         n_names;
+  int         i;
+
+  if (record->flags & BABL_CACHE_LUT_TIMINGS)
+    return NULL;
+
+  n_names = cache_record_names (record, names,
+                                2 + BABL_CACHE_MAX_CONVERSIONS, 1);
+  if (!n_names)
+    return NULL;
+
+  _babl_fish_path_create_name (name, from_format, to_format,
+                               record->tolerance);
+  if (babl_db_exist_by_name (babl_fish_db (), name))
+    return NULL;
+
+  if (record->flags & BABL_CACHE_REFERENCE)
+  {
+    /* there isn't a suitable path for requested formats,
+     * let's create a dummy BABL_FISH instance and insert
+     * it into the fish database to indicate that such path
+     * does not exist.
+     */
+    const char *name = "X"; /* name does not matter */
+    babl = babl_calloc (1, sizeof (BablFish) + strlen (name) + 1);
+
+    babl->class_type       = BABL_FISH;
+    babl->instance.id      = babl_fish_get_id (from_format,
+                                               to_format);
+    babl->instance.name    = ((char *) babl) + sizeof (BablFish);
+#ifndef _UCRT
+    strcpy (babl->instance.name, name);
+#else
+    strcpy_s (babl->instance.name, strlen(name) + 1, name);
+#endif
+    babl->fish.source      = from_format;
+    babl->fish.destination = to_format;
+    babl->fish.error       = record->error;
+    babl->fish.data        = (void*) 1; /* signals babl_fish() to
+                                         * show a "missing fash path"
+                                         * warning upon the first
+                                         * lookup
+                                         */
+    return babl;
+  }
+
+  babl = babl_calloc (1, sizeof (BablFishPath) +
+                      strlen (name) + 1);
+  babl_set_destructor (babl, _babl_fish_path_destroy);
+
+  babl->class_type     = BABL_FISH_PATH;
+  babl->instance.id    = babl_fish_get_id (from_format, to_format);
+  babl->instance.name  = ((char *) babl) + sizeof (BablFishPath);
+#ifndef _UCRT
+  strcpy (babl->instance.name, name);
+#else
+  strcpy_s (babl->instance.name, strlen(name) + 1, name);
+#endif
+  babl->fish.source               = from_format;
+  babl->fish.destination          = to_format;
+  babl->fish.error                = record->error;
+  babl->fish_path.cost            = record->cost;
+  babl->fish_path.tolerance       = record->tolerance;
+  babl->fish_path.conversion_list = babl_list_init_with_size (10);
+  _babl_fish_rig_dispatch (babl);
+
+  for (i = 2; i < n_names; i++)
+  {
+    Babl *conv = (void*)babl_db_find(babl_conversion_db(), names[i]);
+    if (!conv)
+    {
+      /* provided by an extension that is not loaded, or not
+       * registered yet for the space of the formats */
+      babl_free (babl);
+      return NULL;
+    }
+    babl_list_insert_last (babl->fish_path.conversion_list, conv);
+  }
+
+  _babl_fish_prepare_bpp (babl);
+  return babl;
+}
+
+Babl *
+babl_fish_cache_lookup (const Babl *source,
                         const Babl *destination,
-                        int         is_reference);
+                        double      tolerance)
+{
+  const BablCacheRecord *record;
+  const char            *source_name;
+  const char            *destination_name;
+  uint32_t               hash;
+  int                    slot;
+  Babl                  *babl;
+
+  if (!cache_index.offsets)
+    return NULL;
+
+  source_name      = babl_get_name (source);
+  destination_name = babl_get_name (destination);
+  hash = cache_pair_hash (source_name, destination_name, tolerance);
+
+  slot = cache_index_find (&cache_index, &cache_map, hash,
+                           source_name, destination_name, tolerance);
+  if (!cache_index.offsets[slot])
+    return NULL;
+
+  record = (const BablCacheRecord *) (cache_map.data + cache_index.offsets[slot]);
+  babl = cache_record_to_fish (record, source, destination);
+  if (babl)
+    babl_db_insert (babl_fish_db (), babl);
+  return babl;
+}
+
+static void lut_store_prune (void);
 
 void 
 babl_init_db (void)
 {
-  char *path = fish_cache_path ();
-  long  length = -1;
-  char  seps[] = "\n\r";
-  Babl *babl   = NULL;
-  char *contents = NULL;
-  char *token;
-  char *tokp;
-  const Babl  *from_format = NULL;
-  const Babl  *to_format   = NULL;
-  time_t       tim         = time (NULL);
-  char        *env         = NULL;
+  char          *path = fish_cache_path ();
+  char          *env  = NULL;
 
 #ifndef _UCRT
   env = getenv ("BABL_DEBUG_CONVERSIONS");
@@ -318,158 +964,397 @@ babl_init_db (void)
   _dupenv_s (&env, NULL, "BABL_DEBUG_CONVERSIONS");
 #endif
 
-  if (env)
-    goto cleanup;
+  lut_store_prune ();
 
-  _babl_file_get_contents (path, &contents, &length, NULL);
-  if (!contents)
+  if (env || !path || cache_map_open (&cache_map, path))
     goto cleanup;
 
-  token = strtok_r (contents, seps, &tokp);
-  while( token != NULL )
+  /* the fishes are only created once they are asked for, by
+   * babl_fish_cache_lookup () */
+  cache_index_build (&cache_index, &cache_map);
+
+  if (cache_index.truncated ||
+      cache_index.n_records > cache_index.n_unique + cache_index.n_unique / 4 + 16)
+    cache_compact = 1;
+
+cleanup:
+#ifdef _UCRT
+  free (env);
+#endif
+  if (path)
+    babl_free (path);
+}
+
+/* The LUT store keeps the LUTs built for fish paths, one file per table in
+ * a babl-luts directory next to the fish cache. A file is a header holding
+ * the key - the build, the formats and the conversions of the path - padded
+ * to a page, followed by the table. Files are written under a temporary
+ * name and renamed into place, and mapped read-only and shared, so that
+ * processes converting the same pairs share a single copy of each table
+ * through the page cache.
+ */
+
+#define BABL_LUT_STORE_MAGIC   "babl-lt\n"
+#define BABL_LUT_STORE_VERSION 1
+#define BABL_LUT_STORE_HEADER  4096
+
+/* a full 8bit LUT takes 64MB, this keeps sixteen of them */
+#define BABL_LUT_STORE_MAX_SIZE (1024 * 1024 * 1024)
+/* seconds after which a temporary file is taken to be left behind */
+#define BABL_LUT_STORE_TMP_AGE  (60 * 60)
+
+typedef struct BablLutStoreHeader
+{
+  char     magic[8];
+  uint32_t version;
+  uint32_t byte_order;
+  uint32_t kind;
+  uint32_t key_length;
+  uint64_t size;
+  /* followed by the nul terminated key */
+} BablLutStoreHeader;
+
+#define BABL_LUT_STORE_MAX_KEY (BABL_LUT_STORE_HEADER - \
+                                (int) sizeof (BablLutStoreHeader))
+
+static int
+lut_store_enabled (void)
+{
+  static int enabled = -1;
+
+  if (enabled < 0)
     {
-      switch (token[0])
-      {
-        case '-': /* finalize */
-          if (babl)
-          {
-            if ((babl->fish.pixels) == (tim % 100))
-            {
-              /* 1% chance of individual cached conversions being dropped -
-               * making sure mis-measured conversions do not
-                 stick around for a long time*/
-              babl_free (babl);
-            }
-            else
-              babl_db_insert (babl_fish_db(), babl);
-          }
-          from_format = NULL;
-          to_format = NULL;
-          babl=NULL;
-          break;
-        case '#':
-          /* if babl has changed in git .. drop whole cache */
-          {
-            if (strcmp ( token, cache_header ()))
-              goto cleanup;
-          }
-          break;
-        case '\t':
-          if (to_format && strchr (token, '='))
-          {
-            char seps2[] = " ";
-            char *tokp2;
-            char *token2;
-            char name[4096];
-
-            _babl_fish_create_name (name, from_format, to_format, 1);
-            babl = babl_db_exist_by_name (babl_fish_db (), name);
-            if (babl)
-            {
-              fprintf (stderr, "%s:%i: loading of cache failed\n",
-                              __FUNCTION__, __LINE__);
-              goto cleanup;
-            }
-
-            if (strstr (token, "[reference]"))
-            {
-              /* there isn't a suitable path for requested formats,
-               * let's create a dummy BABL_FISH instance and insert
-               * it into the fish database to indicate that such path
-               * does not exist.
-               */
-              const char *name = "X"; /* name does not matter */
-              babl = babl_calloc (1, sizeof (BablFish) + strlen (name) + 1);
-
-              babl->class_type       = BABL_FISH;
-              babl->instance.id      = babl_fish_get_id (from_format,
-                                                         to_format);
-              babl->instance.name    = ((char *) babl) + sizeof (BablFish);
+      char *env = NULL;
+
 #ifndef _UCRT
-              strcpy (babl->instance.name, name);
+      env = getenv ("BABL_LUT_STORE");
 #else
-              strcpy_s (babl->instance.name, strlen(name) + 1, name);
+      _dupenv_s (&env, NULL, "BABL_LUT_STORE");
 #endif
-              babl->fish.source      = from_format;
-              babl->fish.destination = to_format;
-              babl->fish.data        = (void*) 1; /* signals babl_fish() to
-                                                   * show a "missing fash path"
-                                                   * warning upon the first
-                                                   * lookup
-                                                   */
-            }
-            else
-            {
-              babl = babl_calloc (1, sizeof (BablFishPath) +
-                                  strlen (name) + 1);
-              babl_set_destructor (babl, _babl_fish_path_destroy);
-
-              babl->class_type     = BABL_FISH_PATH;
-              babl->instance.id    = babl_fish_get_id (from_format, to_format);
-              babl->instance.name  = ((char *) babl) + sizeof (BablFishPath);
-#ifndef _UCRT
-              strcpy (babl->instance.name, name);
-#else
-              strcpy_s (babl->instance.name, strlen(name) + 1, name);
+      enabled = env && env[0] != '\0' && strcmp (env, "0");
+#ifdef _UCRT
+      free (env);
 #endif
-              babl->fish.source               = from_format;
-              babl->fish.destination          = to_format;
-              babl->fish_path.conversion_list = babl_list_init_with_size (10);
-              _babl_fish_rig_dispatch (babl);
-            }
-
-            token2 = strtok_r (&token[1], seps2, &tokp2);
-            while( token2 != NULL )
-            {
-              if (!strncmp (token2, "error=", 6))
-              {
-                babl->fish.error = babl_parse_double (token2 + 6);
-              }
-              else if (!strncmp (token2, "cost=", 5))
-              {
-                if (babl->class_type == BABL_FISH_PATH)
-                {
-                  babl->fish_path.cost = babl_parse_double (token2 + 5);
-                  _babl_fish_prepare_bpp (babl);
-                }
-              }
-              else if (!strncmp (token2, "pixels=", 7))
-              {
-                babl->fish.pixels = strtol (token2 + 7, NULL, 10);
-              }
-              token2 = strtok_r (NULL, seps2, &tokp2);
-            }
-          }
-          else if (to_format && babl && babl->class_type == BABL_FISH_PATH)
-          {
-            Babl *conv = (void*)babl_db_find(babl_conversion_db(), &token[1]);
-            if (!conv)
-            {
-              babl_free (babl);
-              babl = NULL;
-            }
-            else
-              babl_list_insert_last (babl->fish_path.conversion_list, conv);
-          }
-          break;
-        default:
-          if (!from_format)
-          {
-            from_format = (void*)babl_db_find(babl_format_db(), token);
-          }
-          else
-          {
-            to_format = (void*)babl_db_find(babl_format_db(), token);
-          }
-          break;
-      }
-      token = strtok_r (NULL, seps, &tokp);
     }
+  return enabled;
+}
 
-cleanup:
-  if (contents)
-    free (contents);
+static int
+lut_store_header_init (BablLutStoreHeader *header,
+                       char               *key,
+                       const Babl         *fish,
+                       int                 kind,
+                       long                size)
+{
+  int length;
+  int i;
 
-  if (path)
-    babl_free (path);
+  memset (header, 0, sizeof (BablLutStoreHeader));
+  memcpy (header->magic, BABL_LUT_STORE_MAGIC, sizeof (header->magic));
+  header->version    = BABL_LUT_STORE_VERSION;
+  header->byte_order = BABL_CACHE_BYTE_ORDER;
+  header->kind       = kind;
+  header->size       = size;
+
+  length = snprintf (key, BABL_LUT_STORE_MAX_KEY, "%s\n%s\n%s",
+                     cache_header (),
+                     babl_get_name (fish->fish.source),
+                     babl_get_name (fish->fish.destination));
+  for (i = 0; i < fish->fish_path.conversion_list->count &&
+              length < BABL_LUT_STORE_MAX_KEY; i++)
+    length += snprintf (key + length, BABL_LUT_STORE_MAX_KEY - length, "\n%s",
+                        babl_get_name (fish->fish_path.conversion_list->items[i]));
+  if (length >= BABL_LUT_STORE_MAX_KEY)
+    return 0;
+
+  header->key_length = length;
+  return 1;
+}
+
+static char *
+lut_store_dir (void)
+{
+  char    *cache_path = fish_cache_path ();
+  char    *slash;
+  char     buf[4096];
+  BablStat stat_buf;
+
+  if (!cache_path)
+    return NULL;
+
+  slash = strrchr (cache_path, '/');
+#ifdef _WIN32
+  if (!slash || strrchr (cache_path, '\\') > slash)
+    slash = strrchr (cache_path, '\\');
+#endif
+  if (slash)
+    slash[1] = '\0';
+  else
+    cache_path[0] = '\0';
+
+  snprintf (buf, sizeof (buf), "%sbabl-luts", cache_path);
+  babl_free (cache_path);
+  if (!(_babl_stat (buf, &stat_buf) == 0 && S_ISDIR (stat_buf.st_mode)) &&
+      _babl_mkdir (buf, S_IRWXU) != 0)
+    return NULL;
+  return babl_strdup (buf);
+}
+
+static char *
+lut_store_path (const char *key)
+{
+  char *dir = lut_store_dir ();
+  char  buf[4096];
+
+  if (!dir)
+    return NULL;
+
+  /* two differently seeded hashes of the key; the key is compared in full
+   * when loading */
+  snprintf (buf, sizeof (buf), "%s/%08x%08x", dir,
+            cache_hash (key, strlen (key), 2166136261u),
+            cache_hash (key, strlen (key), 0x9747b28cu));
+  babl_free (dir);
+  return babl_strdup (buf);
+}
+
+#ifdef HAVE_MMAP
+typedef struct BablLutStoreFile
+{
+  char   name[32];
+  off_t  size;
+  time_t mtime;
+} BablLutStoreFile;
+
+static int
+lut_store_file_cmp (const void *a,
+                    const void *b)
+{
+  const BablLutStoreFile *fa = a;
+  const BablLutStoreFile *fb = b;
+
+  return (fa->mtime > fb->mtime) - (fa->mtime < fb->mtime);
+}
+
+/* whether the file at path was written by this build, with the same
+ * settings - like the fish cache, which is discarded when its build
+ * differs
+ */
+static int
+lut_store_file_current (const char  *path,
+                        const char  *build,
+                        struct stat *st)
+{
+  char                buf[sizeof (BablLutStoreHeader) + 2048 + 1];
+  BablLutStoreHeader *header = (BablLutStoreHeader *) buf;
+  int                 build_length = strlen (build);
+  int                 length = sizeof (BablLutStoreHeader) + build_length + 1;
+  int                 fd;
+  int                 ok;
+
+  if (length > (int) sizeof (buf))
+    return 0;
+  fd = open (path, O_RDONLY);
+  if (fd < 0)
+    return 0;
+  ok = read (fd, buf, length) == length;
+  close (fd);
+
+  return ok &&
+         !memcmp (header->magic, BABL_LUT_STORE_MAGIC, sizeof (header->magic)) &&
+         header->version == BABL_LUT_STORE_VERSION &&
+         header->byte_order == BABL_CACHE_BYTE_ORDER &&
+         st->st_size == (off_t) (BABL_LUT_STORE_HEADER + header->size) &&
+         !memcmp (buf + sizeof (BablLutStoreHeader), build, build_length) &&
+         buf[sizeof (BablLutStoreHeader) + build_length] == '\n';
+}
+#endif
+
+/* Nothing replaces the files of a store in place, once babl or its settings
+ * change the files written before are no longer used. Removes those, and
+ * temporary files left behind by processes that died while writing one,
+ * and then the least recently written files until the store fits in
+ * BABL_LUT_STORE_MAX_SIZE. Runs once, when babl is initialized.
+ */
+static void
+lut_store_prune (void)
+{
+#ifdef HAVE_MMAP
+  BablLutStoreFile *files = NULL;
+  int               n_files = 0;
+  int               n_allocated = 0;
+  const char       *build;
+  char             *dir;
+  char              path[4096];
+  DIR              *d;
+  struct dirent    *entry;
+  struct stat       st;
+  time_t            now = time (NULL);
+  uint64_t          total = 0;
+  int               i;
+
+  if (!lut_store_enabled () || !(dir = lut_store_dir ()))
+    return;
+  d = opendir (dir);
+  if (!d)
+    {
+      babl_free (dir);
+      return;
+    }
+
+  build = cache_header ();
+  while ((entry = readdir (d)))
+    {
+      if (entry->d_name[0] == '.')
+        continue;
+      snprintf (path, sizeof (path), "%s/%s", dir, entry->d_name);
+      if (stat (path, &st) != 0 || !S_ISREG (st.st_mode))
+        continue;
+
+      if (strchr (entry->d_name, '~'))
+        {
+          /* possibly still being written by another process */
+          if (now - st.st_mtime > BABL_LUT_STORE_TMP_AGE)
+            _babl_remove (path);
+          continue;
+        }
+
+      if (strlen (entry->d_name) >= sizeof (files[0].name) ||
+          !lut_store_file_current (path, build, &st))
+        {
+          _babl_remove (path);
+          continue;
+        }
+
+      if (n_files == n_allocated)
+        {
+          n_allocated = n_allocated ? n_allocated * 2 : 16;
+          files = babl_realloc (files, n_allocated * sizeof (BablLutStoreFile));
+        }
+      strcpy (files[n_files].name, entry->d_name);
+      files[n_files].size  = st.st_size;
+      files[n_files].mtime = st.st_mtime;
+      total += st.st_size;
+      n_files++;
+    }
+  closedir (d);
+
+  if (total > BABL_LUT_STORE_MAX_SIZE)
+    {
+      qsort (files, n_files, sizeof (BablLutStoreFile), lut_store_file_cmp);
+      for (i = 0; i < n_files && total > BABL_LUT_STORE_MAX_SIZE; i++)
+        {
+          snprintf (path, sizeof (path), "%s/%s", dir, files[i].name);
+          if (_babl_remove (path) == 0)
+            total -= files[i].size;
+        }
+    }
+
+  if (files)
+    babl_free (files);
+  babl_free (dir);
+#endif
+}
+
+void *
+babl_lut_store_load (const Babl *fish,
+                     int         kind,
+                     long        size)
+{
+#ifdef HAVE_MMAP
+  BablLutStoreHeader header;
+  char               key[BABL_LUT_STORE_MAX_KEY];
+  char              *path;
+  const char        *data;
+  struct stat        st;
+  int                fd;
+
+  if (!lut_store_enabled () ||
+      !lut_store_header_init (&header, key, fish, kind, size))
+    return NULL;
+
+  path = lut_store_path (key);
+  if (!path)
+    return NULL;
+  fd = open (path, O_RDONLY);
+  babl_free (path);
+  if (fd < 0)
+    return NULL;
+
+  if (fstat (fd, &st) != 0 ||
+      st.st_size != (off_t) (BABL_LUT_STORE_HEADER + size))
+    {
+      close (fd);
+      return NULL;
+    }
+  data = mmap (NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+  close (fd);
+  if (data == MAP_FAILED)
+    return NULL;
+
+  if (memcmp (data, &header, sizeof (header)) ||
+      memcmp (data + sizeof (header), key, header.key_length + 1))
+    {
+      /* a collision of the file names, or a damaged file */
+      munmap ((void *) data, st.st_size);
+      return NULL;
+    }
+  return (void *) (data + BABL_LUT_STORE_HEADER);
+#else
+  return NULL;
+#endif
+}
+
+void
+babl_lut_store_unmap (void *lut,
+                      long  size)
+{
+#ifdef HAVE_MMAP
+  munmap ((char *) lut - BABL_LUT_STORE_HEADER, BABL_LUT_STORE_HEADER + size);
+#endif
+}
+
+int
+babl_lut_store_save (const Babl *fish,
+                     int         kind,
+                     const void *lut,
+                     long        size)
+{
+#ifdef HAVE_MMAP
+  BablLutStoreHeader header;
+  char               page[BABL_LUT_STORE_HEADER] = {0,};
+  char               tmpp[4096];
+  char              *path;
+  FILE              *file;
+  int                ok;
+
+  if (!lut_store_enabled () ||
+      !lut_store_header_init (&header, page + sizeof (header),
+                              fish, kind, size))
+    return 0;
+  memcpy (page, &header, sizeof (header));
+
+  path = lut_store_path (page + sizeof (header));
+  if (!path)
+    return 0;
+
+  snprintf (tmpp, sizeof (tmpp), "%s~%i", path, (int) getpid ());
+  file = _babl_fopen (tmpp, "wb");
+  ok = file != NULL;
+  if (ok)
+    {
+      ok = fwrite (page, sizeof (page), 1, file) == 1 &&
+           fwrite (lut, size, 1, file) == 1;
+      ok = (fclose (file) == 0) && ok;
+    }
+  if (ok)
+    ok = _babl_rename (tmpp, path) == 0;
+  if (!ok)
+    _babl_remove (tmpp);
+
+  babl_free (path);
+  return ok;
+#else
+  return 0;
+#endif
 }
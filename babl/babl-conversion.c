@@ -26,6 +26,26 @@
 #include "babl-db.h"
 #include "babl-ref-pixels.h"
 
+/* bound for the runs per batch when measuring the cost of a conversion,
+ * and the number of runs the costs are scaled to */
+#define BABL_CONVERSION_TIMING_ITER   1024
+
+typedef struct ConversionTiming
+{
+  const Babl *fish;
+  const void *source;
+  void       *destination;
+  long        n;
+} ConversionTiming;
+
+static void
+conversion_timing_run (void *data)
+{
+  ConversionTiming *timing = data;
+
+  babl_process (timing->fish, timing->source, timing->destination, timing->n);
+}
+
 static void
 babl_conversion_plane_process (BablConversion *conversion,
                                const void     *source,
@@ -444,8 +464,7 @@ babl_conversion_error (BablConversion *conversion)
   const Babl *fmt_rgba_double = babl_format_with_space ("RGBA double",
                                                  conversion->destination->format.space);
   double  error       = 0.0;
-  long    ticks_start = 0;
-  long    ticks_end   = 0;
+  double  cost_ns;
 
   const int test_pixels = babl_get_num_conversion_test_pixels ();
   const double *test = babl_get_conversion_test_pixels ();
@@ -504,16 +523,18 @@ babl_conversion_error (BablConversion *conversion)
 
   if (BABL(conversion)->class_type == BABL_CONVERSION_LINEAR)
   {
-    ticks_start = babl_ticks ();
-    babl_process (babl_fish_simple (conversion),
-                  source, destination, test_pixels);
-    ticks_end = babl_ticks ();
+    const Babl      *fish   = babl_fish_simple (conversion);
+    ConversionTiming timing = {fish, source, destination, test_pixels};
+
+    /* the costs are used as estimates for ranking conversion paths */
+    cost_ns = babl_measure_ns (conversion_timing_run, &timing,
+                               BABL_CONVERSION_TIMING_ITER);
   }
   else
   {
     /* we could still measure it, but for the paths we only really consider
      * the linear ones anyways */
-    ticks_end = 1000;
+    cost_ns = 1000000.0;
   }
 
   babl_process (fish_reference,
@@ -539,7 +560,8 @@ babl_conversion_error (BablConversion *conversion)
   babl_free (ref_destination_rgba_double);
 
   conversion->error = error;
-  conversion->cost  = ticks_end - ticks_start;
+  /* scaled to BABL_CONVERSION_TIMING_ITER runs over the test pixels */
+  conversion->cost  = cost_ns * BABL_CONVERSION_TIMING_ITER / 1000.0;
 
   return error;
 }
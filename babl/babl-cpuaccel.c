@@ -27,6 +27,7 @@
  */
 
 #include "config.h"
+#include <stdlib.h>
 #include <string.h>
 #include <signal.h>
 #include <setjmp.h>
@@ -131,7 +132,7 @@ enum
   ARCH_X86_INTEL_FEATURE_AVX2     = 1 << 5,
   ARCH_X86_INTEL_FEATURE_BMI2     = 1 << 8,
 
-  ARCH_X86_INTEL_FEATURE_AVX512F  = 1 << 15,
+  ARCH_X86_INTEL_FEATURE_AVX512F  = 1 << 16,
   ARCH_X86_INTEL_FEATURE_AVX512DQ = 1 << 17,
   ARCH_X86_INTEL_FEATURE_AVX512CD = 1 << 28,
   ARCH_X86_INTEL_FEATURE_AVX512BW = 1 << 30,
@@ -163,6 +164,18 @@ enum
            : "0" (op), "2" (0))
 #endif
 
+/* the state components enabled by the OS, only valid with OSXSAVE */
+#define xgetbv(eax,edx)            \
+  __asm__ ("xgetbv"                \
+           : "=a" (eax),           \
+             "=d" (edx)            \
+           : "c" (0))
+
+/* XCR0 bits for the SSE, AVX and AVX-512 (opmask, ZMM0-15 upper halves
+ * and ZMM16-31) register state
+ */
+#define ARCH_X86_XCR0_AVX512 0xe6
+
 
 static X86Vendor
 arch_get_vendor (void)
@@ -247,6 +260,7 @@ arch_accel_intel (void)
 #ifdef USE_MMX
   {
     guint32 eax, ebx, ecx, edx;
+    int     os_avx512 = 0;
 
     cpuid (1, eax, ebx, ecx, edx);
 
@@ -284,8 +298,16 @@ arch_accel_intel (void)
       caps |= BABL_CPU_ACCEL_X86_XSAVE;
 
     if (ecx & ARCH_X86_INTEL_FEATURE_OSXSAVE)
+    {
+      guint32 xcr0_lo, xcr0_hi;
+
       caps |= BABL_CPU_ACCEL_X86_OSXSAVE;
 
+      xgetbv (xcr0_lo, xcr0_hi);
+      (void) xcr0_hi;
+      os_avx512 = (xcr0_lo & ARCH_X86_XCR0_AVX512) == ARCH_X86_XCR0_AVX512;
+    }
+
     if (ecx & ARCH_X86_INTEL_FEATURE_FMA)
       caps |= BABL_CPU_ACCEL_X86_FMA;
 
@@ -306,16 +328,20 @@ arch_accel_intel (void)
       if (ebx & ARCH_X86_INTEL_FEATURE_BMI2)
         caps |= BABL_CPU_ACCEL_X86_BMI2;
 
-      if (ebx & ARCH_X86_INTEL_FEATURE_AVX512F)
-        caps |= BABL_CPU_ACCEL_X86_AVX512F;
-      if (ebx & ARCH_X86_INTEL_FEATURE_AVX512DQ)
-        caps |= BABL_CPU_ACCEL_X86_AVX512DQ;
-      if (ebx & ARCH_X86_INTEL_FEATURE_AVX512CD)
-        caps |= BABL_CPU_ACCEL_X86_AVX512CD;
-      if (ebx & ARCH_X86_INTEL_FEATURE_AVX512BW)
-        caps |= BABL_CPU_ACCEL_X86_AVX512BW;
-      if (ebx & ARCH_X86_INTEL_FEATURE_AVX512VL)
-        caps |= BABL_CPU_ACCEL_X86_AVX512VL;
+      /* AVX-512 code faults unless the OS saves the ZMM state */
+      if (os_avx512)
+      {
+        if (ebx & ARCH_X86_INTEL_FEATURE_AVX512F)
+          caps |= BABL_CPU_ACCEL_X86_AVX512F;
+        if (ebx & ARCH_X86_INTEL_FEATURE_AVX512DQ)
+          caps |= BABL_CPU_ACCEL_X86_AVX512DQ;
+        if (ebx & ARCH_X86_INTEL_FEATURE_AVX512CD)
+          caps |= BABL_CPU_ACCEL_X86_AVX512CD;
+        if (ebx & ARCH_X86_INTEL_FEATURE_AVX512BW)
+          caps |= BABL_CPU_ACCEL_X86_AVX512BW;
+        if (ebx & ARCH_X86_INTEL_FEATURE_AVX512VL)
+          caps |= BABL_CPU_ACCEL_X86_AVX512VL;
+      }
     }
 #endif /* USE_SSE */
 
@@ -527,6 +553,38 @@ arch_accel (void)
   return caps;
 }
 
+#define HAVE_ARCH_MODEL 1
+
+static void
+arch_model (char *model)
+{
+  guint32 eax, ebx, ecx, edx;
+  guint32 brand[12];
+  int     i;
+
+  if (arch_get_vendor () == ARCH_X86_VENDOR_NONE)
+    return;
+
+  cpuid (0x80000000, eax, ebx, ecx, edx);
+  if (eax < 0x80000004)
+    return;
+
+  for (i = 0; i < 3; i++)
+    {
+      cpuid (0x80000002 + i, eax, ebx, ecx, edx);
+      brand[i * 4 + 0] = eax;
+      brand[i * 4 + 1] = ebx;
+      brand[i * 4 + 2] = ecx;
+      brand[i * 4 + 3] = edx;
+    }
+  memcpy (model, brand, 48);
+  model[48] = '\0';
+
+  /* the brand string is padded with leading spaces on some CPUs */
+  for (i = 0; model[i] == ' '; i++);
+  memmove (model, model + i, strlen (model + i) + 1);
+}
+
 #endif /* ARCH_X86 && USE_MMX && __GNUC__ */
 
 
@@ -636,6 +694,31 @@ arch_accel (void)
 
 #endif /* ARCH_ARM  */
 
+#if defined(ARCH_X86_64)
+/* on CPUs where running 512bit instructions lowers the clock of the core
+ * for everything else too, BABL_INHIBIT_AVX512=1 makes babl and its
+ * extensions use the x86-64-v3 code instead, babl-benchmark --simd tells
+ * which of the two is faster.
+ */
+static gboolean
+avx512_inhibited (void)
+{
+  char     *env = NULL;
+  gboolean  inhibited;
+
+#ifndef _UCRT
+  env = getenv ("BABL_INHIBIT_AVX512");
+#else
+  _dupenv_s (&env, NULL, "BABL_INHIBIT_AVX512");
+#endif
+  inhibited = env && env[0] && strcmp (env, "0");
+#ifdef _UCRT
+  free (env);
+#endif
+  return inhibited;
+}
+#endif
+
 static BablCpuAccelFlags
 cpu_accel (void)
 {
@@ -649,6 +732,11 @@ cpu_accel (void)
 
 #if defined(ARCH_X86_64)
   accel |= BABL_CPU_ACCEL_X86_64;
+
+  if (avx512_inhibited ())
+    accel &= ~(BABL_CPU_ACCEL_X86_AVX512F  | BABL_CPU_ACCEL_X86_AVX512DQ |
+               BABL_CPU_ACCEL_X86_AVX512CD | BABL_CPU_ACCEL_X86_AVX512BW |
+               BABL_CPU_ACCEL_X86_AVX512VL);
 #endif
 
   return (BablCpuAccelFlags) accel;
@@ -657,3 +745,28 @@ cpu_accel (void)
   return BABL_CPU_ACCEL_NONE;
 #endif
 }
+
+/**
+ * babl_cpu_model:
+ *
+ * Query for a description of the CPU, the brand string where the CPU
+ * provides one.
+ *
+ * Return value: a string identifying the CPU model.
+ */
+const char *
+babl_cpu_model (void)
+{
+  static char model[49] = "";
+
+  if (!model[0])
+    {
+      char buf[49] = "unknown";
+
+#ifdef HAVE_ARCH_MODEL
+      arch_model (buf);
+#endif
+      memcpy (model, buf, sizeof (model));
+    }
+  return model;
+}
@@ -88,6 +88,7 @@ typedef enum
 
 BablCpuAccelFlags  babl_cpu_accel_get_support (void);
 void               babl_cpu_accel_set_use     (unsigned int use);
+const char        *babl_cpu_model             (void);
 
 
 #endif  /* _BABL_CPU_ACCEL_H */
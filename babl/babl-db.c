@@ -43,7 +43,7 @@ _babl_hash_by_str (BablHashTable *htab,
   hash ^= (hash >> 11);
   hash += (hash << 15);
 
-  return (hash & htab->mask);
+  return hash;
 }
 
 int
@@ -58,17 +58,17 @@ static int
 _babl_hash_by_int (BablHashTable *htab,
                    int           id)
 {
-  int   hash = 0;
-  hash +=  id & 0xFF;
-  hash += (hash << 10);
-  hash ^= (hash >> 6);
-  id >>= 8;
-  hash +=  id & 0xFF;
-  hash += (hash << 3);
-  hash ^= (hash >> 11);
-  hash += (hash << 15);
+  /* murmur3 finalizer, every bit of the id affects every bit of the
+   * hash */
+  unsigned int hash = id;
+
+  hash ^= hash >> 16;
+  hash *= 0x85ebca6bu;
+  hash ^= hash >> 13;
+  hash *= 0xc2b2ae35u;
+  hash ^= hash >> 16;
 
-  return (hash & htab->mask);
+  return hash;
 }
 
 int
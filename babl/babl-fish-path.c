@@ -29,7 +29,11 @@
 #define BABL_HARD_MAX_PATH_LENGTH  8
 #define BABL_MAX_NAME_LEN          1024
 
+/* path costs are the time of BABL_TEST_ITER runs over the test pixels, in
+ * microseconds; measured with at most BABL_TEST_MAX_BATCH runs per batch
+ */
 #define BABL_TEST_ITER             16
+#define BABL_TEST_MAX_BATCH        256
 
 #ifndef MIN
 #define MIN(a, b) (((a) > (b)) ? (b) : (a))
@@ -54,20 +58,25 @@ static int lut_info_level = 0;
 #define LUT_INFO(...) _LUT_LOG(2, __VA_ARGS__)
 #define LUT_DETAIL(...) _LUT_LOG(3, __VA_ARGS__)
 
+static void babl_lut_release (Babl *babl);
+static void babl_lut_sweep (void);
+static void babl_fish_usage_fold (Babl *babl);
+
 static int gc_fishes (Babl *babl, void *userdata)
 {
   GcContext *context = userdata;
   if (babl->class_type == BABL_FISH_PATH)
   {
-    if (babl->fish_path.u8_lut)
+    babl_fish_usage_fold (babl);
+    if (babl->fish_path.u8_lut || babl->fish_path.u8_clut)
     {
       if (context->time - babl->fish_path.last_lut_use >
           1000 * 1000 * 60 * lut_unused_minutes_limit)
       {
-        void *lut =babl->fish_path.u8_lut;
-        BABL(babl)->fish_path.u8_lut = NULL;
-        free (lut);
-        BABL(babl)->fish.pixels = 0;
+        babl_mutex_lock (babl_lut_mutex);
+        babl_lut_release (babl);
+        babl_lut_sweep ();
+        babl_mutex_unlock (babl_lut_mutex);
         LUT_LOG("freeing LUT %s to %s unused for >%.1f minutes\n",
                 babl_get_name (babl->conversion.source),
                 babl_get_name (babl->conversion.destination),
@@ -113,14 +122,46 @@ babl_gc_fishes (void)
   babl_fish_class_for_each (gc_fishes, &context);
 }
 
-static long babl_conv_counter = 0;
+/* pixels converted since the last gc, threads add to it in batches of
+ * BABL_CONV_COUNT_BATCH pixels counted in babl_conv_pending */
+static long BABL_FISH_ATOMIC babl_conv_counter = 0;
+
+#define BABL_CONV_COUNT_BATCH  (1000 * 1000)
+
+#ifdef HAVE_TLS
+static __thread long babl_conv_pending = 0;
+#endif
+
+static inline void
+babl_conv_count (long n)
+{
+#ifdef HAVE_TLS
+  babl_conv_pending += n;
+  if (babl_conv_pending < BABL_CONV_COUNT_BATCH)
+    return;
+  n = babl_conv_pending;
+  babl_conv_pending = 0;
+#endif
+#ifdef HAVE_STDATOMIC_H
+  atomic_fetch_add_explicit (&babl_conv_counter, n, memory_order_relaxed);
+#else
+  babl_conv_counter += n;
+#endif
+}
 
 void
 babl_gc (void)
 {
   if (babl_conv_counter > 1000 * 1000 * 10) // run gc every 10 megapixels
   {
+#ifdef HAVE_STDATOMIC_H
+    /* only one of the threads getting here collects */
+    if (atomic_exchange_explicit (&babl_conv_counter, 0, memory_order_relaxed) <=
+        1000 * 1000 * 10)
+      return;
+#else
     babl_conv_counter = 0;
+#endif
     babl_gc_fishes ();
     //malloc_trim (0); 
     //  is responsibility of higher layers
@@ -137,250 +178,1286 @@ babl_gc (void)
 
 static float timings[256] = {0,};
 
-#define BPP_4ASSOCIATED   14
+/* LUTs are built on the background thread and published with a single
+ * pointer store, lut_pending makes sure only one build is queued per fish.
+ * Readers announce themselves in their shard of lut_users before loading
+ * the pointer, so that a LUT that gets unpublished is only freed once
+ * nobody can be using it - this needs sequentially consistent ordering on
+ * both sides.
+ */
+#ifdef HAVE_STDATOMIC_H
+#define LUT_LOAD(ptr)         atomic_load_explicit (&(ptr), memory_order_seq_cst)
+#define LUT_STORE(ptr, value) atomic_store_explicit (&(ptr), value, memory_order_seq_cst)
+#define LUT_CLAIM(flag)       (atomic_exchange_explicit (&(flag), 1, memory_order_acq_rel) == 0)
+#define LUT_ENTER(users)      atomic_fetch_add_explicit (&(users), 1, memory_order_seq_cst)
+#define LUT_LEAVE(users)      atomic_fetch_sub_explicit (&(users), 1, memory_order_release)
+#else
+#define LUT_LOAD(ptr)         (ptr)
+#define LUT_STORE(ptr, value) ((ptr) = (value))
+#define LUT_CLAIM(flag)       ((flag) ? 0 : ((flag) = 1))
+#define LUT_ENTER(users)      ((users)++)
+#define LUT_LEAVE(users)      ((users)--)
+#endif
 
-static inline int _do_lut (uint32_t *lut,
-                           int   source_bpp,
-                           int   dest_bpp,
-                           const void *__restrict__ source,
-                           void *__restrict__ destination,
-                           long n)
+/* path fishes count the pixels they convert in per thread shards, so that
+ * threads sharing a fish do not contend for the cache line of a single
+ * counter; the shards are folded into fish.pixels by the gc.
+ */
+#ifdef HAVE_STDATOMIC_H
+#define USAGE_ADD(counter, n)  (atomic_fetch_add_explicit (&(counter), n, memory_order_relaxed) + (n))
+#define USAGE_LOAD(counter)    atomic_load_explicit (&(counter), memory_order_relaxed)
+#define USAGE_TAKE(counter)    atomic_exchange_explicit (&(counter), 0, memory_order_relaxed)
+#else
+#define USAGE_ADD(counter, n)  ((counter) += (n))
+#define USAGE_LOAD(counter)    (counter)
+#define USAGE_TAKE(counter)    babl_usage_take (&(counter))
+
+static inline long
+babl_usage_take (volatile long *counter)
 {
-        if (source_bpp == BPP_4ASSOCIATED  && dest_bpp == 4)
-        {
-          uint32_t *src = (uint32_t*)source;
-          uint32_t *dst = (uint32_t*)destination;
-          while (n--)
-          {
-             uint32_t col = *src++;
-             uint8_t *rgba=(uint8_t*)&col;
-             uint8_t oalpha = rgba[3];
-             if (oalpha==0)
-             {
-               *dst++ = 0;
-             }
-             else
-             {
-               uint32_t col_opaque = col;
-               uint8_t *rgbaB=(uint8_t*)&col_opaque;
-               uint32_t ralpha = 0;
-               ralpha = (256*255)/oalpha;
-               rgbaB[0] = (rgba[0]*ralpha)>>8;
-               rgbaB[1] = (rgba[1]*ralpha)>>8;
-               rgbaB[2] = (rgba[2]*ralpha)>>8;
-               rgbaB[3] = 0;
-               *dst++ = lut[col_opaque] | (oalpha<<24);
-             }
-          }
-        }
-        else if (source_bpp == 4 && dest_bpp == 16)
-        {
-          uint32_t *src = (uint32_t*)source;
-          uint32_t *dst = (uint32_t*)destination;
-          while (n--)
-          {
-             uint32_t col = *src++;
-             uint32_t lut_offset = col & 0xffffff;
-             float alpha = (col>>24)/255.0f;
-
-             *dst++ = lut[lut_offset*4+0];
-             *dst++ = lut[lut_offset*4+1];
-             *dst++ = lut[lut_offset*4+2];
-             ((float*)(dst))[0] = alpha;
-             dst++;
-          }
-        }
-        else if (source_bpp == 4 && dest_bpp == 8)
-        {
-          uint32_t *src = (uint32_t*)source;
-          uint16_t *dst = (uint16_t*)destination;
-          uint16_t *lut16 = (uint16_t*)lut;
-          while (n--)
-          {
-             uint32_t col = *src++;
-             uint32_t lut_offset = col & 0xffffff;
-             uint16_t alpha = (col>>24) << 8; 
-
-             dst[0] = lut16[lut_offset*2+0];
-             dst[1] = lut16[lut_offset*2+1];
-             dst[2] = lut16[lut_offset*2+2];
-             dst[3] = alpha;
-             dst+=4;
-          }
-        }
-        else if (source_bpp == 2 && dest_bpp == 16)
-        {
-          uint16_t *src = (uint16_t*)source;
-          uint32_t *dst = (uint32_t*)destination;
-          while (n--)
-          {
-             uint32_t col = *src++;
-             *dst++ = lut[col*4+0];
-             *dst++ = lut[col*4+1];
-             *dst++ = lut[col*4+2];
-             *dst++ = lut[col*4+3];
-          }
-        }
-        else if (source_bpp == 4 && dest_bpp == 4)
-        {
-          uint32_t *src = (uint32_t*)source;
-          uint32_t *dst = (uint32_t*)destination;
-          while (n--)
-          {
-             uint32_t col = *src++;
-             *dst = (col & 0xff000000) | lut[col & 0xffffff];
-             dst++;
-          }
-        }
-        else if (source_bpp == 2 && dest_bpp == 4)
+  long value = *counter;
+  *counter = 0;
+  return value;
+}
+#endif
+
+static int
+babl_usage_shard (void)
+{
+#ifdef HAVE_TLS
+  static int BABL_FISH_ATOMIC next_shard = 0;
+  static __thread int         shard      = -1;
+
+  if (BABL_UNLIKELY (shard < 0))
+#ifdef HAVE_STDATOMIC_H
+    shard = atomic_fetch_add_explicit (&next_shard, 1, memory_order_relaxed) %
+            BABL_FISH_USAGE_SHARDS;
+#else
+    shard = next_shard++ % BABL_FISH_USAGE_SHARDS;
+#endif
+  return shard;
+#else
+  return 0;
+#endif
+}
+
+/* counts n pixels converted by the calling thread, returns the count of
+ * its shard */
+static inline long
+babl_fish_usage_add (Babl *babl,
+                     long  n)
+{
+  return USAGE_ADD (babl->fish_path.usage[babl_usage_shard ()].pixels, n);
+}
+
+/* the pixels converted by a fish, including those not folded yet */
+static long
+babl_fish_usage_pixels (const Babl *babl)
+{
+  long pixels = babl->fish.pixels;
+
+  for (int i = 0; i < BABL_FISH_USAGE_SHARDS; i++)
+    pixels += USAGE_LOAD (babl->fish_path.usage[i].pixels);
+  return pixels;
+}
+
+static void
+babl_fish_usage_fold (Babl *babl)
+{
+  for (int i = 0; i < BABL_FISH_USAGE_SHARDS; i++)
+    babl->fish.pixels += USAGE_TAKE (babl->fish_path.usage[i].pixels);
+}
+
+/* the number of threads reading the LUT of a fish */
+static int
+babl_fish_lut_users (const Babl *babl)
+{
+  int users = 0;
+
+  for (int i = 0; i < BABL_FISH_USAGE_SHARDS; i++)
+    users += LUT_LOAD (babl->fish_path.usage[i].lut_users);
+  return users;
+}
+
+static void
+babl_fish_usage_reset (Babl *babl)
+{
+  for (int i = 0; i < BABL_FISH_USAGE_SHARDS; i++)
+    USAGE_TAKE (babl->fish_path.usage[i].pixels);
+  babl->fish.pixels = 0;
+}
+
+/* failed LUT builds stop doubling the threshold of a fish after this many */
+#define LUT_MAX_FAILURES    10
+
+/* last_lut_use is only updated once it is this many ticks old */
+#define LUT_USE_RESOLUTION  1000
+
+/* all LUTs share a memory budget, when a new LUT does not fit the least
+ * recently used ones are evicted. The fishes holding a LUT are chained
+ * through lut_next, the chain and the accounting are protected by
+ * babl_lut_mutex.
+ */
+typedef struct BablRetiredLut
+{
+  struct BablRetiredLut *next;
+  Babl                  *fish;
+  void                  *lut;
+  long                   size;
+  int                    mapped;
+} BablRetiredLut;
+
+static Babl           *lut_fishes        = NULL;
+static BablRetiredLut *retired_luts      = NULL;
+static long            lut_memory_usage  = 0;
+static long            lut_memory_limit  = -1; /* 0 for no limit */
+
+static long
+babl_lut_memory_limit (void)
+{
+  if (lut_memory_limit < 0)
+    {
+      char *env = NULL;
+
+#ifndef _UCRT
+      env = getenv ("BABL_LUT_MEMORY_LIMIT");
+#else
+      _dupenv_s (&env, NULL, "BABL_LUT_MEMORY_LIMIT");
+#endif
+      lut_memory_limit = 0;
+      if (env && atof (env) > 0)
+        lut_memory_limit = atof (env) * 1024 * 1024;
+#ifdef _UCRT
+      free (env);
+#endif
+    }
+  return lut_memory_limit;
+}
+
+static void
+babl_lut_free (void *lut,
+               long  size,
+               int   mapped)
+{
+  if (mapped)
+    babl_lut_store_unmap (lut, size);
+  else
+    free (lut);
+}
+
+/* frees the unpublished LUTs that are no longer being read */
+static void
+babl_lut_sweep (void)
+{
+  BablRetiredLut **link = &retired_luts;
+
+  while (*link)
+    {
+      BablRetiredLut *retired = *link;
+
+      if (babl_fish_lut_users (retired->fish) == 0)
         {
-          uint16_t *src = (uint16_t*)source;
-          uint32_t *dst = (uint32_t*)destination;
-          while (n--)
-          {
-            *dst = lut[*src++];
-            dst++;
-          }
+          *link = retired->next;
+          babl_lut_free (retired->lut, retired->size, retired->mapped);
+          free (retired);
         }
-        else if (source_bpp == 2 && dest_bpp == 2)
+      else
         {
-          uint16_t *src = (uint16_t*)source;
-          uint16_t *dst = (uint16_t*)destination;
-          uint16_t *lut16 = (uint16_t*)lut;
-          while (n--)
-          {
-             *dst = lut16[*src++];
-             dst++;
-          }
+          link = &retired->next;
         }
-        else if (source_bpp == 1 && dest_bpp == 4)
+    }
+}
+
+static void
+babl_lut_release (Babl *babl)
+{
+  Babl **link = &lut_fishes;
+  void  *lut;
+
+  while (*link && *link != babl)
+    link = &(*link)->fish_path.lut_next;
+  if (!*link)
+    return;
+  *link = babl->fish_path.lut_next;
+  babl->fish_path.lut_next = NULL;
+  /* the fish builds its LUT again once it has been used enough */
+  LUT_STORE (babl->fish_path.lut_pending, 0);
+
+  lut = babl->fish_path.u8_lut ? (void *) babl->fish_path.u8_lut
+                               : (void *) babl->fish_path.u8_clut;
+  LUT_STORE (babl->fish_path.u8_lut, NULL);
+  LUT_STORE (babl->fish_path.u8_clut, NULL);
+  lut_memory_usage -= babl->fish_path.lut_size;
+  babl_fish_usage_reset (babl);
+
+  if (babl_fish_lut_users (babl) == 0)
+    {
+      babl_lut_free (lut, babl->fish_path.lut_size,
+                     babl->fish_path.lut_mapped);
+    }
+  else
+    {
+      BablRetiredLut *retired = malloc (sizeof (BablRetiredLut));
+
+      retired->fish = babl;
+      retired->lut = lut;
+      retired->size = babl->fish_path.lut_size;
+      retired->mapped = babl->fish_path.lut_mapped;
+      retired->next = retired_luts;
+      retired_luts = retired;
+    }
+  babl->fish_path.lut_size = 0;
+  babl->fish_path.lut_mapped = 0;
+}
+
+/* evicts least recently used LUTs until at most target bytes are in use */
+static void
+babl_lut_evict (long target)
+{
+  while (lut_memory_usage > target && lut_fishes)
+    {
+      Babl *lru = lut_fishes;
+
+      for (Babl *fish = lut_fishes; fish; fish = fish->fish_path.lut_next)
+        if (fish->fish_path.last_lut_use < lru->fish_path.last_lut_use)
+          lru = fish;
+
+      LUT_LOG("evicting LUT %s to %s, %li bytes in use\n",
+              babl_get_name (lru->conversion.source),
+              babl_get_name (lru->conversion.destination),
+              lut_memory_usage);
+      babl_lut_release (lru);
+    }
+}
+
+/* whether a LUT of size bytes can be held at all */
+static int
+babl_lut_fits (long size)
+{
+  long limit;
+
+  babl_mutex_lock (babl_lut_mutex);
+  limit = babl_lut_memory_limit ();
+  babl_mutex_unlock (babl_lut_mutex);
+  return limit == 0 || size <= limit;
+}
+
+/* makes lut or clut visible to babl_process (), evicting other LUTs as
+ * needed to stay within the budget; returns 0 if it does not fit. Mapped
+ * tables come from the on-disk LUT store.
+ */
+static int
+babl_lut_publish (Babl     *babl,
+                  uint32_t *lut,
+                  void     *clut,
+                  long      size,
+                  int       mapped)
+{
+  long limit;
+
+  babl_mutex_lock (babl_lut_mutex);
+  babl_lut_sweep ();
+  limit = babl_lut_memory_limit ();
+  if (limit && size > limit)
+    {
+      babl_mutex_unlock (babl_lut_mutex);
+      return 0;
+    }
+  if (limit)
+    babl_lut_evict (limit - size);
+
+  babl->fish_path.lut_size = size;
+  babl->fish_path.lut_mapped = mapped;
+  babl->fish_path.last_lut_use = babl_ticks ();
+  babl->fish_path.lut_next = lut_fishes;
+  lut_fishes = babl;
+  lut_memory_usage += size;
+  if (clut)
+    LUT_STORE (babl->fish_path.u8_clut, clut);
+  else
+    LUT_STORE (babl->fish_path.u8_lut, lut);
+  babl_mutex_unlock (babl_lut_mutex);
+  return 1;
+}
+
+void
+babl_set_lut_memory_limit (long bytes)
+{
+  babl_mutex_lock (babl_lut_mutex);
+  lut_memory_limit = bytes > 0 ? bytes : 0;
+  if (lut_memory_limit)
+    babl_lut_evict (lut_memory_limit);
+  babl_lut_sweep ();
+  babl_mutex_unlock (babl_lut_mutex);
+}
+
+long
+babl_get_lut_memory_limit (void)
+{
+  long limit;
+
+  babl_mutex_lock (babl_lut_mutex);
+  limit = babl_lut_memory_limit ();
+  babl_mutex_unlock (babl_lut_mutex);
+  return limit;
+}
+
+long
+babl_get_lut_memory_usage (void)
+{
+  long usage;
+
+  babl_mutex_lock (babl_lut_mutex);
+  usage = lut_memory_usage;
+  babl_mutex_unlock (babl_lut_mutex);
+  return usage;
+}
+
+void babl_test_lut (uint32_t *lut,
+             int   source_bpp,
+             int   dest_bpp,
+             void *__restrict__ source,
+             void *__restrict__ dest,
+             long count);
+void babl_test_lut (uint32_t *lut,
+             int   source_bpp,
+             int   dest_bpp,
+             void *__restrict__ source,
+             void *__restrict__ dest,
+             long count)
+{
+   babl_lut_apply (lut, source_bpp, dest_bpp, source, dest, count);
+}
+
+static inline float lut_timing_for (int source_bpp, int dest_bpp)
+{
+  return timings[source_bpp * 16 + dest_bpp];
+}
+
+/* the LUT timings are measured on a table as large as a full LUT of 8bit
+ * RGB(A) to 4 byte pixels, 64MB - more than the last level cache of most
+ * CPUs - rather than on a cache resident table, which made LUTs look much
+ * cheaper than they are. The source pixels wander through the whole color
+ * cube in small steps, like the pixels of an image do; independent random
+ * pixels, missing the caches on every lookup, would be as unrepresentative
+ * the other way. 16 and 8 byte destinations, whose full LUTs are larger,
+ * get a quarter and a half of the blue range. Each run converts the next
+ * LUT_TIMING_PIXELS of a LUT_TIMING_SOURCE_PIXELS source, as repeating a
+ * single short run would bring its entries into the caches. The table is
+ * only allocated when the timings are not in the fish cache yet; the results
+ * are scaled to the number of path test pixels, the unit of the path costs.
+ */
+#define LUT_TIMING_BYTES         (256 * 256 * 256 * 4)
+#define LUT_TIMING_PIXELS        4096
+#define LUT_TIMING_SOURCE_PIXELS (256 * LUT_TIMING_PIXELS)
+#define LUT_TIMING_MAX_RUNS      256
+
+typedef struct _LutTiming
+{
+  uint32_t *lut;
+  int       source_bpp;
+  int       dest_bpp;
+  uint8_t  *src;
+  void     *dst;
+  long      offset;
+} LutTiming;
+
+static void lut_timing_run (void *data)
+{
+   LutTiming *timing = data;
+   int        bpp = timing->source_bpp == BPP_4ASSOCIATED ? 4 : timing->source_bpp;
+
+   babl_test_lut (timing->lut, timing->source_bpp, timing->dest_bpp,
+                  timing->src + timing->offset * bpp, timing->dst,
+                  LUT_TIMING_PIXELS);
+   timing->offset = (timing->offset + LUT_TIMING_PIXELS) %
+                    LUT_TIMING_SOURCE_PIXELS;
+}
+
+static void lut_timing_source (uint8_t *src, int source_bpp, int dest_bpp)
+{
+   uint32_t seed = 1;
+   int      rgb[3] = {128, 128, 128};
+   int      shift = 0;
+
+   /* the part of the full table the timing table holds */
+   if (dest_bpp > 4)
+     shift = dest_bpp == 8 ? 1 : 2;
+
+   for (int i = 0; i < LUT_TIMING_SOURCE_PIXELS; i++)
+   {
+     uint8_t *pixel = src + i * (source_bpp == BPP_4ASSOCIATED ? 4 : source_bpp);
+     seed = seed * 1103515245 + 12345;
+
+     /* small steps like those between neighbouring pixels of an image,
+      * wandering through the whole color cube */
+     for (int c = 0; c < 3; c++)
+     {
+       rgb[c] += (int) ((seed >> (8 + c * 8)) & 7) - 3;
+       if (rgb[c] < 0)
+         rgb[c] = -rgb[c];
+       if (rgb[c] > 255)
+         rgb[c] = 510 - rgb[c];
+     }
+
+     switch (source_bpp)
+     {
+       case 4:
+       case BPP_4ASSOCIATED:
+         pixel[0] = rgb[0];
+         pixel[1] = rgb[1];
+         pixel[2] = rgb[2] >> shift;
+         pixel[3] = 255;
+         break;
+       case 3:
+         pixel[0] = rgb[0];
+         pixel[1] = rgb[1];
+         pixel[2] = rgb[2];
+         break;
+       case 2:
+         pixel[0] = rgb[0];
+         pixel[1] = rgb[1];
+         break;
+       default:
+         pixel[0] = rgb[0];
+         break;
+     }
+   }
+}
+
+static void measure_timings(void)
+{
+   int pairs[][2]={{4,4},{BPP_4ASSOCIATED,4},{4,8},{3,4},{3,3},{2,4},{2,2},{1,4},{2,16},{4,16}};
+   int n_pairs = sizeof (pairs)/sizeof(pairs[0]);
+   float measured[sizeof (pairs)/sizeof(pairs[0])];
+   char  key[256];
+   char *env = NULL;
+
+#ifndef _UCRT
+   env = getenv ("BABL_LUT_INFO");
+#else
+   _dupenv_s (&env, NULL, "BABL_LUT_INFO");
+#endif
+   if (env)
+   {
+      lut_info_level = atoi (env);
+   }
+
+#ifndef _UCRT
+   env = getenv ("BABL_LUT_UNUSED_LIMIT");
+#else
+   _dupenv_s (&env, NULL, "BABL_LUT_UNUSED_LIMIT");
+#endif
+   if (env)
+   {
+      lut_unused_minutes_limit = atof (env);
+   }
+
+   LUT_LOG("BABL_LUT_UNUSED_LIMIT=%.1f\n", lut_unused_minutes_limit);
+
+   /* the timings depend on the CPU and the LUT code it dispatches to */
+   snprintf (key, sizeof (key), "%s accel=%x",
+             babl_cpu_model (), (unsigned) babl_cpu_accel_get_support ());
+
+   if (babl_lut_timings_load (key, measured, n_pairs))
+   {
+     LUT_LOG("lut timings from cache for %s\n", key);
+   }
+   else
+   {
+     LutTiming timing;
+     double    scale = babl_get_num_path_test_pixels () /
+                       (LUT_TIMING_PIXELS * 1000.0);
+
+     timing.lut = malloc (LUT_TIMING_BYTES);
+     timing.src = malloc (LUT_TIMING_SOURCE_PIXELS * 4);
+     timing.dst = malloc (LUT_TIMING_PIXELS * 16);
+     /* written, untouched pages would all map the same zero page */
+     memset (timing.lut, 11, LUT_TIMING_BYTES);
+
+     LUT_LOG("measuring lut timings for %s\n", key);
+     for (int p = 0; p < n_pairs; p++)
+     {
+       timing.source_bpp = pairs[p][0];
+       timing.dest_bpp = pairs[p][1];
+       timing.offset = 0;
+       lut_timing_source (timing.src, timing.source_bpp, timing.dest_bpp);
+       measured[p] = babl_measure_ns (lut_timing_run, &timing,
+                                      LUT_TIMING_MAX_RUNS) * scale;
+     }
+     free (timing.lut);
+     free (timing.src);
+     free (timing.dst);
+
+     babl_lut_timings_save (key, measured, n_pairs);
+   }
+
+   for (int p = 0; p < n_pairs; p++)
+   {
+     int source_bpp = pairs[p][0];
+     int dest_bpp = pairs[p][1];
+
+     timings[source_bpp * 16 + dest_bpp] = measured[p];
+     LUT_LOG ("   %ibpp to %ibpp: %.2f\n", source_bpp, dest_bpp,
+              timings[source_bpp * 16 + dest_bpp]);
+   }
+#ifdef _UCRT
+   free(env);
+#endif
+}
+
+static inline void
+process_conversion_path (BablList   *path,
+                         const void *source_buffer,
+                         int         source_bpp,
+                         void       *destination_buffer,
+                         int         dest_bpp,
+                         long        n);
+
+/* a compact alternative to the 24bit LUTs for u8 RGB and RGBA sources: the
+ * conversion sampled on a grid³ lattice, with the values in between the
+ * nodes reconstructed by tetrahedral interpolation. The smallest lattice
+ * whose error stays within _babl_legal_error () is used, if none does the
+ * full LUT is built instead.
+ */
+static const int clut_grids[] = {17, 33, 65};
+
+typedef enum
+{
+  BABL_CLUT_U8,
+  BABL_CLUT_U16,
+  BABL_CLUT_FLOAT
+} BablClutType;
+
+typedef struct _BablClut
+{
+  int          grid;
+  int          source_components;
+  int          dest_components;
+  BablClutType dest_type;
+  uint32_t     stride[3];       /* in floats, for r, g and b */
+  uint32_t     offset[3][256];  /* offset of the lower node, per channel */
+  float        frac[256];       /* position between lower and upper node */
+  float        nodes[];         /* grid³ nodes of 4 floats */
+} BablClut;
+
+#if defined(__GNUC__) || defined(__clang__)
+typedef float BablClutVec __attribute__ ((vector_size (16)));
+#endif
+
+static inline void
+babl_clut_interpolate (const BablClut *clut,
+                       int             r,
+                       int             g,
+                       int             b,
+                       float          *out)
+{
+  const float *c0 = clut->nodes + clut->offset[0][r] +
+                                  clut->offset[1][g] +
+                                  clut->offset[2][b];
+  float fr = clut->frac[r];
+  float fg = clut->frac[g];
+  float fb = clut->frac[b];
+  float w1, w2, w3;
+  int   a1, a2;
+
+  /* pick the tetrahedron containing the sample, walking from the lower
+   * node along the axes in order of decreasing fraction
+   */
+  if (fr >= fg)
+    {
+      if (fg >= fb)      { a1 = 0; a2 = 1; w1 = fr; w2 = fg; w3 = fb; }
+      else if (fr >= fb) { a1 = 0; a2 = 2; w1 = fr; w2 = fb; w3 = fg; }
+      else               { a1 = 2; a2 = 0; w1 = fb; w2 = fr; w3 = fg; }
+    }
+  else
+    {
+      if (fr >= fb)      { a1 = 1; a2 = 0; w1 = fg; w2 = fr; w3 = fb; }
+      else if (fg >= fb) { a1 = 1; a2 = 2; w1 = fg; w2 = fb; w3 = fr; }
+      else               { a1 = 2; a2 = 1; w1 = fb; w2 = fg; w3 = fr; }
+    }
+
+  {
+    const float *c1 = c0 + clut->stride[a1];
+    const float *c2 = c1 + clut->stride[a2];
+    const float *c3 = c0 + clut->stride[0] + clut->stride[1] + clut->stride[2];
+#if defined(__GNUC__) || defined(__clang__)
+    BablClutVec v0, v1, v2, v3, res;
+
+    memcpy (&v0, c0, sizeof (v0));
+    memcpy (&v1, c1, sizeof (v1));
+    memcpy (&v2, c2, sizeof (v2));
+    memcpy (&v3, c3, sizeof (v3));
+    res = v0 + (v1 - v0) * w1 + (v2 - v1) * w2 + (v3 - v2) * w3;
+    memcpy (out, &res, sizeof (res));
+#else
+    for (int c = 0; c < 4; c++)
+      out[c] = c0[c] + (c1[c] - c0[c]) * w1 +
+                       (c2[c] - c1[c]) * w2 +
+                       (c3[c] - c2[c]) * w3;
+#endif
+  }
+}
+
+static inline uint8_t
+babl_clut_to_u8 (float value)
+{
+  if (value <= 0.0f)
+    return 0;
+  if (value >= 1.0f)
+    return 255;
+  return value * 255.0f + 0.5f;
+}
+
+static inline uint16_t
+babl_clut_to_u16 (float value)
+{
+  if (value <= 0.0f)
+    return 0;
+  if (value >= 1.0f)
+    return 65535;
+  return value * 65535.0f + 0.5f;
+}
+
+static void
+babl_clut_process (const BablClut *clut,
+                   const uint8_t  *src,
+                   void           *destination,
+                   long            n)
+{
+  int source_components = clut->source_components;
+  int dest_components = clut->dest_components;
+  float value[4];
+
+  switch (clut->dest_type)
+    {
+      case BABL_CLUT_U8:
         {
-          uint8_t *src = (uint8_t*)source;
-          uint32_t *dst = (uint32_t*)destination;
+          uint8_t *dst = destination;
           while (n--)
-          {
-             *dst = lut[*src++];
-             dst++;
-          }
+            {
+              babl_clut_interpolate (clut, src[0], src[1], src[2], value);
+              dst[0] = babl_clut_to_u8 (value[0]);
+              dst[1] = babl_clut_to_u8 (value[1]);
+              dst[2] = babl_clut_to_u8 (value[2]);
+              if (dest_components == 4)
+                dst[3] = source_components == 4 ? src[3] : 255;
+              src += source_components;
+              dst += dest_components;
+            }
         }
-        else if (source_bpp == 3 && dest_bpp == 3)
+        break;
+      case BABL_CLUT_U16:
         {
-          uint8_t *src = (uint8_t*)source;
-          uint8_t *dst = (uint8_t*)destination;
+          uint16_t *dst = destination;
           while (n--)
-          {
-             uint32_t col = src[0]*256*256+src[1]*256+src[2];
-             uint32_t val = lut[col];
-             dst[2]=(val >> 16) & 0xff;
-             dst[1]=(val >> 8) & 0xff;
-             dst[0]=val & 0xff;
-             dst+=3;
-             src+=3;
-          }
+            {
+              babl_clut_interpolate (clut, src[0], src[1], src[2], value);
+              dst[0] = babl_clut_to_u16 (value[0]);
+              dst[1] = babl_clut_to_u16 (value[1]);
+              dst[2] = babl_clut_to_u16 (value[2]);
+              if (dest_components == 4)
+                dst[3] = source_components == 4 ? src[3] * 257 : 65535;
+              src += source_components;
+              dst += dest_components;
+            }
         }
-        else if (source_bpp == 3 && dest_bpp == 4)
+        break;
+      case BABL_CLUT_FLOAT:
         {
-          uint8_t *src = (uint8_t*)source;
-          uint32_t *dst = (uint32_t*)destination;
+          float *dst = destination;
           while (n--)
-          {
-             *dst = lut[src[0]*256*256+src[1]*256+src[2]];
-             dst++;
-             src+=3;
-          }
+            {
+              babl_clut_interpolate (clut, src[0], src[1], src[2], value);
+              dst[0] = value[0];
+              dst[1] = value[1];
+              dst[2] = value[2];
+              if (dest_components == 4)
+                dst[3] = source_components == 4 ? src[3] / 255.0f : 1.0f;
+              src += source_components;
+              dst += dest_components;
+            }
         }
-        else
+        break;
+    }
+}
+
+/* whether the channels are three colors of the plain type given, optionally
+ * followed by a straight alpha.
+ */
+static int
+babl_clut_format_ok (const Babl *format,
+                     const Babl *type)
+{
+  int components;
+
+  if (format->class_type != BABL_FORMAT ||
+      format->format.planar ||
+      format->format.palette ||
+      format->format.model->flags & BABL_MODEL_FLAG_ASSOCIATED)
+    return 0;
+
+  components = format->format.components;
+  if (components != 3 && components != 4)
+    return 0;
+
+  for (int c = 0; c < components; c++)
+    {
+      if (format->format.type[c] != (BablType*) type ||
+          (format->format.component[c]->instance.id == BABL_ALPHA) !=
+          (c == 3))
+        return 0;
+    }
+  return 1;
+}
+
+static int
+babl_clut_dest_type (const Babl   *format,
+                     BablClutType *type)
+{
+  if (babl_clut_format_ok (format, babl_type_from_id (BABL_U8)))
+    *type = BABL_CLUT_U8;
+  else if (babl_clut_format_ok (format, babl_type_from_id (BABL_U16)))
+    *type = BABL_CLUT_U16;
+  else if (babl_clut_format_ok (format, babl_type_from_id (BABL_FLOAT)))
+    *type = BABL_CLUT_FLOAT;
+  else
+    return 0;
+  return 1;
+}
+
+/* the same components as format, stored as float - for sampling the
+ * conversion on the exact node positions.
+ */
+static const Babl *
+babl_clut_float_format (const Babl *format)
+{
+  BablComponent **component = format->format.component;
+
+  return babl_format_new (format->format.space,
+                          format->format.model,
+                          babl_type_from_id (BABL_FLOAT),
+                          component[0],
+                          component[1],
+                          component[2],
+                          format->format.components == 4 ? component[3]
+                                                         : NULL,
+                          NULL);
+}
+
+static long
+babl_clut_size (int grid)
+{
+  return sizeof (BablClut) + (long) grid * grid * grid * 4 * sizeof (float);
+}
+
+static BablClut *
+babl_clut_new (const Babl *babl,
+               int         grid)
+{
+  const Babl   *source      = babl->conversion.source;
+  const Babl   *destination = babl->conversion.destination;
+  long          count       = (long) grid * grid * grid;
+  int           source_components = source->format.components;
+  int           dest_components   = destination->format.components;
+  const Babl   *sampler;
+  BablClut     *clut;
+  float        *samples;
+  float        *converted;
+  float        *p;
+
+  clut = malloc (babl_clut_size (grid));
+  samples = malloc (count * 4 * sizeof (float));
+  /* not converted in place, a multi-step path writes 4 floats per node
+   * over source nodes it has yet to read */
+  converted = malloc (count * 4 * sizeof (float));
+  if (!clut || !samples || !converted)
+    {
+      free (clut);
+      free (samples);
+      free (converted);
+      return NULL;
+    }
+
+  clut->grid = grid;
+  clut->source_components = source_components;
+  clut->dest_components = dest_components;
+  babl_clut_dest_type (destination, &clut->dest_type);
+  clut->stride[0] = grid * grid * 4;
+  clut->stride[1] = grid * 4;
+  clut->stride[2] = 4;
+  for (int v = 0; v < 256; v++)
+    {
+      float pos  = v * (grid - 1) / 255.0f;
+      int   node = pos;
+
+      /* 255 interpolates fully towards the last node of the cell below */
+      if (node > grid - 2)
+        node = grid - 2;
+      for (int c = 0; c < 3; c++)
+        clut->offset[c][v] = node * clut->stride[c];
+      clut->frac[v] = pos - node;
+    }
+
+  p = samples;
+  for (int r = 0; r < grid; r++)
+    for (int g = 0; g < grid; g++)
+      for (int b = 0; b < grid; b++)
         {
-          return 0;
+          *p++ = r / (float) (grid - 1);
+          *p++ = g / (float) (grid - 1);
+          *p++ = b / (float) (grid - 1);
+          if (source_components == 4)
+            *p++ = 1.0f;
         }
-        return 1;
+
+  /* babl_fish () does its own locking; holding babl_format_mutex around it
+   * would take the locks in the opposite order of a path search */
+  sampler = babl_fish (babl_clut_float_format (source),
+                       babl_clut_float_format (destination));
+  babl_process (sampler, samples, converted, count);
+
+  for (long i = 0; i < count; i++)
+    {
+      float *node = clut->nodes + i * 4;
+
+      node[0] = converted[i * dest_components + 0];
+      node[1] = converted[i * dest_components + 1];
+      node[2] = converted[i * dest_components + 2];
+      node[3] = 0.0f;
+    }
+  free (samples);
+  free (converted);
+  return clut;
+}
+
+static int
+babl_clut_supported (const Babl *babl)
+{
+  BablClutType type;
+
+  return babl_clut_format_ok (babl->conversion.source,
+                              babl_type_from_id (BABL_U8)) &&
+         babl_clut_dest_type (babl->conversion.destination, &type);
+}
+
+/* builds CLUTs of increasing size until one is accurate enough, measured
+ * the way conversion paths are: on the path test pixels, in RGBA double.
+ */
+static BablClut *
+babl_fish_clut_build (const Babl *babl)
+{
+  const Babl *source      = babl->conversion.source;
+  const Babl *destination = babl->conversion.destination;
+  int         source_bpp  = babl->fish_path.source_bpp;
+  int         dest_bpp    = babl->fish_path.dest_bpp;
+  long        n           = babl_get_num_path_test_pixels ();
+  const Babl *rgba_double;
+  const Babl *to_rgba;
+  uint8_t    *src;
+  uint8_t    *dst;
+  double     *ref_rgba;
+  double     *rgba;
+  BablClut   *clut = NULL;
+
+  if (!babl_clut_supported (babl))
+    return NULL;
+
+  rgba_double = babl_format_with_space ("RGBA double",
+                                        destination->format.space);
+  to_rgba = babl_fish_reference (destination, rgba_double);
+
+  src = babl_malloc (n * source_bpp);
+  dst = babl_malloc (n * dest_bpp);
+  ref_rgba = babl_malloc (n * 4 * sizeof (double));
+  rgba = babl_malloc (n * 4 * sizeof (double));
+
+  babl_process (babl_fish_reference (babl_format_with_space ("RGBA double",
+                                                             source->format.space),
+                                     source),
+                babl_get_path_test_pixels (), src, n);
+  process_conversion_path (babl->fish_path.conversion_list,
+                           src, source_bpp, dst, dest_bpp, n);
+  babl_process (to_rgba, dst, ref_rgba, n);
+
+  for (size_t i = 0; i < sizeof (clut_grids) / sizeof (clut_grids[0]); i++)
+    {
+      double error;
+
+      clut = babl_clut_new (babl, clut_grids[i]);
+      if (!clut)
+        break;
+      babl_clut_process (clut, src, dst, n);
+      babl_process (to_rgba, dst, rgba, n);
+      error = babl_rel_avg_error (rgba, ref_rgba, n * 4);
+
+      LUT_INFO ("%i³ CLUT for %s to %s error %f\n", clut_grids[i],
+                babl_get_name (source), babl_get_name (destination), error);
+      if (error <= _babl_legal_error ())
+        break;
+      free (clut);
+      clut = NULL;
+    }
+
+  babl_free (src);
+  babl_free (dst);
+  babl_free (ref_rgba);
+  babl_free (rgba);
+  return clut;
+}
+
+static long
+babl_fish_lut_size (const Babl *babl)
+{
+   int source_bpp = babl->fish_path.source_bpp;
+   int dest_bpp = babl->fish_path.dest_bpp;
+
+   if (source_bpp == 4 || source_bpp == 3)
+     return 256 * 256 * 256 * (long) (dest_bpp == 3 ? 4 : dest_bpp);
+   else if (source_bpp == 2)
+     return 256 * 256 * (long) dest_bpp;
+   else if (source_bpp == 1)
+     return 256 * (long) dest_bpp;
+   return 0;
+}
+
+/* converting all possible input values is split into spans, that are
+ * converted concurrently by the thread pool.
+ */
+#define LUT_BUILD_SPAN  (256 * 256)
+
+typedef struct LutConvertJob
+{
+  const Babl *babl;
+  const char *source;
+  int         source_bpp;
+  char       *destination;
+  int         dest_bpp;
+  long        n;
+} LutConvertJob;
+
+static void
+babl_fish_lut_convert_task (int   task,
+                            int   n_tasks,
+                            void *data)
+{
+  LutConvertJob *job   = data;
+  long           start = job->n * task / n_tasks;
+  long           end   = job->n * (task + 1) / n_tasks;
+
+  process_conversion_path (job->babl->fish_path.conversion_list,
+                           job->source + start * job->source_bpp,
+                           job->source_bpp,
+                           job->destination + start * job->dest_bpp,
+                           job->dest_bpp,
+                           end - start);
 }
 
-void babl_test_lut (uint32_t *lut,
-             int   source_bpp,
-             int   dest_bpp,
-             void *__restrict__ source,
-             void *__restrict__ dest,
-             long count);
-void babl_test_lut (uint32_t *lut,
-             int   source_bpp,
-             int   dest_bpp,
-             void *__restrict__ source,
-             void *__restrict__ dest,
-             long count)
-{
-   _do_lut (lut, source_bpp, dest_bpp, source, dest, count);
+static void
+babl_fish_lut_convert (const Babl *babl,
+                       const void *source,
+                       int         source_bpp,
+                       void       *destination,
+                       int         dest_bpp,
+                       long        n)
+{
+  LutConvertJob job;
+  int           n_tasks = n / LUT_BUILD_SPAN;
+
+  /* a few tasks per thread, to even out threads that get interrupted */
+  if (n_tasks > babl_parallel_get_n_threads () * 4)
+    n_tasks = babl_parallel_get_n_threads () * 4;
+  if (n_tasks < 1)
+    n_tasks = 1;
+
+  job.babl        = babl;
+  job.source      = source;
+  job.source_bpp  = source_bpp;
+  job.destination = destination;
+  job.dest_bpp    = dest_bpp;
+  job.n           = n;
+  babl_parallel_distribute (n_tasks, babl_fish_lut_convert_task, &job);
+}
+
+/* builds the LUT for a fish path, by running all possible input values
+ * through the conversion path.
+ */
+static uint32_t *
+babl_fish_lut_build (const Babl *babl)
+{
+   int source_bpp = babl->fish_path.source_bpp;
+   int dest_bpp = babl->fish_path.dest_bpp;
+   uint32_t *lut = NULL;
+
+   if (source_bpp ==4 && dest_bpp == 4)
+   {
+     lut = malloc (256 * 256 * 256 * 4);
+     for (int o = 0; o < 256 * 256 * 256; o++)
+       lut[o] = o | 0xff000000;
+     babl_fish_lut_convert (babl,
+                            lut, 4,
+                            lut, 4,
+                            256*256*256);
+     for (int o = 0; o < 256 * 256 * 256; o++)
+       lut[o] = lut[o] & 0x00ffffff;
+
+   }
+   else if (source_bpp == 4 && dest_bpp == 16)
+   {
+     uint32_t *temp_lut = malloc (256 * 256 * 256 * 4);
+     lut = malloc (256 * 256 * 256 * 16);
+     for (int o = 0; o < 256 * 256 * 256; o++)
+       temp_lut[o] = o | 0xff000000;
+     babl_fish_lut_convert (babl,
+                            temp_lut, 4,
+                            lut, 16,
+                            256*256*256);
+     free (temp_lut);
+   }
+   else if (source_bpp == 4 && dest_bpp == 8)
+   {
+     uint32_t *temp_lut = malloc (256 * 256 * 256 * 4);
+     lut = malloc (256 * 256 * 256 * 8);
+     for (int o = 0; o < 256 * 256 * 256; o++)
+       temp_lut[o] = o | 0xff000000;
+     babl_fish_lut_convert (babl,
+                            temp_lut, 4,
+                            lut, 8,
+                            256*256*256);
+     free (temp_lut);
+   }
+   else if (source_bpp == 3 && dest_bpp == 3)
+   {
+     uint8_t *temp_lut = malloc (256 * 256 * 256 * 3);
+     uint8_t *temp_lut2 = malloc (256 * 256 * 256 * 3);
+     int o = 0;
+     lut = malloc (256 * 256 * 256 * 4);
+     for (int r = 0; r < 256; r++)
+     for (int g = 0; g < 256; g++)
+     for (int b = 0; b < 256; b++, o++)
+     {
+       temp_lut[o*3+0]=r;
+       temp_lut[o*3+1]=g;
+       temp_lut[o*3+2]=b;
+     }
+     babl_fish_lut_convert (babl,
+                            temp_lut, 3,
+                            temp_lut2, 3,
+                            256*256*256);
+     babl_process_rows_parallel (babl_fish (babl_format ("R'G'B' u8"),
+                                            babl_format ("R'G'B'A u8")),
+                                 temp_lut2, 256 * 3, lut, 256 * 4,
+                                 256, 256*256);
+     for (int o = 0; o < 256 * 256 * 256; o++)
+       lut[o] = lut[o] & 0x00ffffff;
+     free (temp_lut);
+     free (temp_lut2);
+   }
+   else if (source_bpp == 3 && dest_bpp == 4)
+   {
+     uint8_t *temp_lut = malloc (256 * 256 * 256 * 3);
+     int o = 0;
+     lut = malloc (256 * 256 * 256 * 4);
+     for (int r = 0; r < 256; r++)
+     for (int g = 0; g < 256; g++)
+     for (int b = 0; b < 256; b++, o++)
+     {
+       temp_lut[o*3+0]=r;
+       temp_lut[o*3+1]=g;
+       temp_lut[o*3+2]=b;
+     }
+     babl_fish_lut_convert (babl,
+                            temp_lut, 3,
+                            lut, 4,
+                            256*256*256);
+     free (temp_lut);
+   }
+   else if (source_bpp == 2 && dest_bpp == 2)
+   {
+     uint16_t *temp_lut = malloc (256 * 256 * 2);
+     lut = malloc (256 * 256 * 4);
+     for (int o = 0; o < 256*256; o++)
+     {
+       temp_lut[o]=o;
+     }
+     babl_fish_lut_convert (babl,
+                            temp_lut, 2,
+                            lut, 2,
+                            256*256);
+     free (temp_lut);
+   }
+   else if (source_bpp == 2 && dest_bpp == 4)
+   {
+     uint16_t *temp_lut = malloc (256 * 256 * 2);
+     lut = malloc (256 * 256 * 4);
+     for (int o = 0; o < 256*256; o++)
+     {
+       temp_lut[o]=o;
+     }
+     babl_fish_lut_convert (babl,
+                            temp_lut, 2,
+                            lut, 4,
+                            256*256);
+     free (temp_lut);
+   }
+   else if (source_bpp == 2 && dest_bpp == 16)
+   {
+     uint16_t *temp_lut = malloc (256 * 256 * 2);
+     lut = malloc (256 * 256 * 16);
+     for (int o = 0; o < 256*256; o++)
+     {
+       temp_lut[o]=o;
+     }
+     babl_fish_lut_convert (babl,
+                            temp_lut, 2,
+                            lut, 16,
+                            256*256);
+     free (temp_lut);
+   }
+   else if (source_bpp == 1 && dest_bpp == 4)
+   {
+     uint8_t *temp_lut = malloc (256);
+     lut = malloc (256 * 4);
+     for (int o = 0; o < 256; o++)
+     {
+       temp_lut[o]=o;
+     }
+     babl_fish_lut_convert (babl,
+                            temp_lut, 1,
+                            lut, 4,
+                            256);
+     free (temp_lut);
+   }
+
+   return lut;
 }
 
-static inline float lut_timing_for (int source_bpp, int dest_bpp)
+/* moves a freshly built table to the on-disk LUT store, where other
+ * processes can share it; returns the mapped copy, or NULL if the table
+ * stays on the heap.
+ */
+static void *
+babl_fish_lut_share (const Babl *babl,
+                     int         kind,
+                     void       *table,
+                     long        size)
 {
-  return timings[source_bpp * 16 + dest_bpp];
+  void *mapped = NULL;
+
+  if (babl_lut_store_save (babl, kind, table, size))
+    mapped = babl_lut_store_load (babl, kind, size);
+  if (mapped)
+    free (table);
+  return mapped;
 }
 
-static void measure_timings(void)
+static void
+babl_fish_lut_build_job (void *data)
 {
-   int num_pixels = babl_get_num_path_test_pixels () * 1000;
-   int pairs[][2]={{4,4},{BPP_4ASSOCIATED,4},{4,8},{3,4},{3,3},{2,4},{2,2},{1,4},{2,16},{4,16}};
-   uint32_t *lut = malloc (256 * 256 * 256 * 16);
-   uint32_t *src = malloc (num_pixels * 16);
-   uint32_t *dst = malloc (num_pixels * 16);
-   char     *env = NULL;
+  Babl     *babl   = data;
+  long      size   = babl_fish_lut_size (babl);
+  uint32_t *lut    = NULL;
+  BablClut *clut   = NULL;
+  int       mapped = 1;
+  int       over_limit = 0;
+
+  /* tables found in the LUT store are used as they are */
+  for (size_t i = 0; !clut && i < sizeof (clut_grids) / sizeof (clut_grids[0]); i++)
+    clut = babl_lut_store_load (babl, BABL_LUT_STORE_CLUT,
+                                babl_clut_size (clut_grids[i]));
+  if (!clut)
+    lut = babl_lut_store_load (babl, BABL_LUT_STORE_LUT, size);
+
+  if (!clut && !lut)
+  {
+    void *shared;
 
-   memset (lut, 11, 256 * 256 * 256 *16);
-   memset (src, 12, num_pixels * 16);
+    mapped = 0;
+    clut = babl_fish_clut_build (babl);
+    if (clut)
+    {
+      LUT_LOG("using %i³ CLUT for %s to %s\n", clut->grid,
+              babl_get_name (babl->conversion.source),
+              babl_get_name (babl->conversion.destination));
+      shared = babl_fish_lut_share (babl, BABL_LUT_STORE_CLUT, clut,
+                                    babl_clut_size (clut->grid));
+      if (shared)
+      {
+        clut = shared;
+        mapped = 1;
+      }
+    }
+    else if (babl_lut_fits (size))
+    {
+      LUT_LOG("generating LUT for %s to %s\n",
+              babl_get_name (babl->conversion.source),
+              babl_get_name (babl->conversion.destination));
+      lut = babl_fish_lut_build (babl);
+      shared = lut ? babl_fish_lut_share (babl, BABL_LUT_STORE_LUT, lut, size)
+                   : NULL;
+      if (shared)
+      {
+        lut = shared;
+        mapped = 1;
+      }
+    }
+    else
+      over_limit = 1;
+  }
+  else
+  {
+    LUT_LOG("mapped stored %s for %s to %s\n", clut ? "CLUT" : "LUT",
+            babl_get_name (babl->conversion.source),
+            babl_get_name (babl->conversion.destination));
+  }
 
-#ifndef _UCRT
-   env = getenv ("BABL_LUT_INFO");
-#else
-   _dupenv_s (&env, NULL, "BABL_LUT_INFO");
-#endif
-   if (env)
-   {
-      lut_info_level = atoi (env);
-   }
+  if (clut)
+    size = babl_clut_size (clut->grid);
 
-#ifndef _UCRT
-   env = getenv ("BABL_LUT_UNUSED_LIMIT");
-#else
-   _dupenv_s (&env, NULL, "BABL_LUT_UNUSED_LIMIT");
-#endif
-   if (env)
-   {
-      lut_unused_minutes_limit = atof (env);
-   }
+  /* the LUT is complete before it becomes visible to other threads */
+  if (lut || clut)
+  {
+    if (babl_lut_publish (babl, lut, clut, size, mapped))
+    {
+      babl->fish_path.lut_failures = 0;
+      LUT_STORE (babl->fish_path.lut_pending, 0);
+      return;
+    }
+    /* publishing only fails for tables larger than the budget */
+    over_limit = 1;
+  }
 
-   LUT_LOG("BABL_LUT_UNUSED_LIMIT=%.1f\n", lut_unused_minutes_limit);
+  if (mapped && (lut || clut))
+    babl_lut_store_unmap (clut ? (void *) clut : (void *) lut, size);
+  else if (!mapped)
+  {
+    free (clut);
+    free (lut);
+  }
 
-   LUT_LOG("measuring lut timings          \n");
-   for (size_t p = 0; p < sizeof (pairs)/sizeof(pairs[0]);p++)
-   {
-     int source_bpp = pairs[p][0];
-     int dest_bpp = pairs[p][1];
-     long start,end;
-     start = babl_ticks ();
-     babl_test_lut (lut, source_bpp, dest_bpp, src, dst, num_pixels);
-
-     end = babl_ticks ();
-     timings[source_bpp * 16 + dest_bpp] = (end-start)/1000.0;
-       LUT_LOG ("   %ibpp to %ibpp: %.2f\n", source_bpp, dest_bpp,
-          timings[source_bpp * 16 + dest_bpp]
-                     );
-   }
-   free (lut);
-   free (src);
-   free (dst);
-#ifdef _UCRT
-   free(env);
-#endif
+  LUT_LOG("LUT for %s to %s %s\n",
+          babl_get_name (babl->conversion.source),
+          babl_get_name (babl->conversion.destination),
+          over_limit ? "exceeds the LUT memory limit" : "could not be built");
+
+  /* the limit can be raised and allocations can succeed later, the fish
+   * gets another try once it has converted twice as many pixels as for
+   * this one */
+  babl_mutex_lock (babl_lut_mutex);
+  if (babl->fish_path.lut_failures < LUT_MAX_FAILURES)
+    babl->fish_path.lut_failures++;
+  babl_fish_usage_reset (babl);
+  babl_mutex_unlock (babl_lut_mutex);
+  LUT_STORE (babl->fish_path.lut_pending, 0);
 }
 
-static inline void
-process_conversion_path (BablList   *path,
-                         const void *source_buffer,
-                         int         source_bpp,
-                         void       *destination_buffer,
-                         int         dest_bpp,
-                         long        n);
+/* the pixels a fish converts before a LUT is built for it; lut_failures
+ * is only written while lut_pending is set, and read once it is clear */
+static inline long
+babl_fish_lut_threshold (const Babl *babl)
+{
+  return (128L * 256) << babl->fish_path.lut_failures;
+}
 
 static inline int babl_fish_lut_process_maybe (const Babl *babl,
                                                const char *source,
@@ -390,193 +1467,82 @@ static inline int babl_fish_lut_process_maybe (const Babl *babl,
 {
      int source_bpp = babl->fish_path.source_bpp;
      int dest_bpp = babl->fish_path.dest_bpp;
-     uint32_t *lut = (uint32_t*)babl->fish_path.u8_lut;
- 
-
-     if (BABL_UNLIKELY(!lut && babl->fish.pixels >= 128 * 256))
+     int shard = babl_usage_shard ();
+     long pixels = babl_fish_usage_add (BABL(babl), n);
+     uint32_t *lut;
+     BablClut *clut;
+     int done = 0;
+
+     /* the total is only summed up once the shard of this thread makes it
+      * possible for it to have crossed the threshold */
+     if (BABL_UNLIKELY(!LUT_LOAD (babl->fish_path.u8_lut) &&
+                       !LUT_LOAD (babl->fish_path.u8_clut) &&
+                       !LUT_LOAD (babl->fish_path.lut_pending) &&
+                       pixels + babl->fish.pixels >=
+                         babl_fish_lut_threshold (babl) / BABL_FISH_USAGE_SHARDS &&
+                       babl_fish_usage_pixels (babl) >= babl_fish_lut_threshold (babl)))
      {
-       LUT_LOG("generating LUT for %s to %s\n",
-               babl_get_name (babl->conversion.source),
-               babl_get_name (babl->conversion.destination));
-       if (source_bpp ==4 && dest_bpp == 4)
-       {
-         lut = malloc (256 * 256 * 256 * 4);
-         for (int o = 0; o < 256 * 256 * 256; o++)
-           lut[o] = o | 0xff000000;
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  lut, 4,
-                                  lut, 4,
-                                  256*256*256);
-         for (int o = 0; o < 256 * 256 * 256; o++)
-           lut[o] = lut[o] & 0x00ffffff;
-
-       }
-       else if (source_bpp == 4 && dest_bpp == 16)
-       {
-         uint32_t *temp_lut = malloc (256 * 256 * 256 * 4);
-         lut = malloc (256 * 256 * 256 * 16);
-         for (int o = 0; o < 256 * 256 * 256; o++)
-           temp_lut[o] = o | 0xff000000;
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  temp_lut, 4,
-                                  lut, 16,
-                                  256*256*256);
-         free (temp_lut);
-       }
-       else if (source_bpp == 4 && dest_bpp == 8)
-       {
-         uint32_t *temp_lut = malloc (256 * 256 * 256 * 4);
-         lut = malloc (256 * 256 * 256 * 8);
-         for (int o = 0; o < 256 * 256 * 256; o++)
-           temp_lut[o] = o | 0xff000000;
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  temp_lut, 4,
-                                  lut, 8,
-                                  256*256*256);
-         free (temp_lut);
-       }
-       else if (source_bpp == 3 && dest_bpp == 3)
-       {
-         uint8_t *temp_lut = malloc (256 * 256 * 256 * 3);
-         uint8_t *temp_lut2 = malloc (256 * 256 * 256 * 3);
-         int o = 0;
-         lut = malloc (256 * 256 * 256 * 4);
-         for (int r = 0; r < 256; r++)
-         for (int g = 0; g < 256; g++)
-         for (int b = 0; b < 256; b++, o++)
-         {
-           temp_lut[o*3+0]=r;
-           temp_lut[o*3+1]=g;
-           temp_lut[o*3+2]=b;
-         }
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  temp_lut, 3,
-                                  temp_lut2, 3,
-                                  256*256*256);
-         babl_process (babl_fish (babl_format ("R'G'B' u8"), babl_format ("R'G'B'A u8")),
-                       temp_lut2, lut, 256*256*256);
-         for (int o = 0; o < 256 * 256 * 256; o++)
-           lut[o] = lut[o] & 0x00ffffff;
-         free (temp_lut);
-         free (temp_lut2);
-       }
-       else if (source_bpp == 3 && dest_bpp == 4)
-       {
-         uint8_t *temp_lut = malloc (256 * 256 * 256 * 3);
-         int o = 0;
-         lut = malloc (256 * 256 * 256 * 4);
-         for (int r = 0; r < 256; r++)
-         for (int g = 0; g < 256; g++)
-         for (int b = 0; b < 256; b++, o++)
-         {
-           temp_lut[o*3+0]=r;
-           temp_lut[o*3+1]=g;
-           temp_lut[o*3+2]=b;
-         }
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  temp_lut, 3,
-                                  lut, 4,
-                                  256*256*256);
-         free (temp_lut);
-       }
-       else if (source_bpp == 2 && dest_bpp == 2)
-       {
-         uint16_t *temp_lut = malloc (256 * 256 * 2);
-         lut = malloc (256 * 256 * 4);
-         for (int o = 0; o < 256*256; o++)
-         {
-           temp_lut[o]=o;
-         }
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  temp_lut, 2,
-                                  lut, 2,
-                                  256*256);
-         free (temp_lut);
-       }
-       else if (source_bpp == 2 && dest_bpp == 4)
-       {
-         uint16_t *temp_lut = malloc (256 * 256 * 2);
-         lut = malloc (256 * 256 * 4);
-         for (int o = 0; o < 256*256; o++)
-         {
-           temp_lut[o]=o;
-         }
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  temp_lut, 2,
-                                  lut, 4,
-                                  256*256);
-         free (temp_lut);
-       }
-       else if (source_bpp == 2 && dest_bpp == 16)
-       {
-         uint16_t *temp_lut = malloc (256 * 256 * 2);
-         lut = malloc (256 * 256 * 16);
-         for (int o = 0; o < 256*256; o++)
-         {
-           temp_lut[o]=o;
-         }
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  temp_lut, 2,
-                                  lut, 16,
-                                  256*256);
-         free (temp_lut);
-       }
-       else if (source_bpp == 1 && dest_bpp == 4)
+       /* only the first caller to get here queues a build, everyone keeps
+        * using the conversion path until the LUT has been published.
+        */
+       if (LUT_CLAIM (BABL(babl)->fish_path.lut_pending))
        {
-         uint8_t *temp_lut = malloc (256);
-         lut = malloc (256 * 4);
-         for (int o = 0; o < 256; o++)
-         {
-           temp_lut[o]=o;
-         }
-         process_conversion_path (babl->fish_path.conversion_list,
-                                  temp_lut, 1,
-                                  lut, 4,
-                                  256);
-         free (temp_lut);
-       }
-
-       if (babl->fish_path.u8_lut == NULL)
-       {
-         (BABL(babl)->fish_path.u8_lut) = lut;
-         // XXX need memory barrier?
-         if ((BABL(babl)->fish_path.u8_lut) != lut)
-         {
-           free (lut);
-           lut = babl->fish_path.u8_lut;
-         }
-       }
-       else
-       {
-         free (lut);
-         lut = babl->fish_path.u8_lut;
+         if (!babl_parallel_background (babl_fish_lut_build_job, (void*)babl))
+           babl_fish_lut_build_job ((void*)babl);
        }
      }
 
-     if (lut)
+     LUT_ENTER (BABL(babl)->fish_path.usage[shard].lut_users);
+     lut = LUT_LOAD (babl->fish_path.u8_lut);
+     clut = lut ? NULL : LUT_LOAD (babl->fish_path.u8_clut);
+
+     if (clut)
+     {
+       babl_clut_process (clut, (const uint8_t*)source, destination, n);
+       done = 1;
+     }
+     else if (lut)
      {
        if (source_bpp == 4 && 
            ((babl->conversion.source->format.model->flags &
            BABL_MODEL_FLAG_ASSOCIATED)!=0))
          source_bpp = BPP_4ASSOCIATED;
 
-       if (_do_lut (lut, source_bpp, dest_bpp, source, destination, n))
-       {
-         BABL(babl)->fish_path.last_lut_use = babl_ticks ();
-         return 1;
-       }
+       done = babl_lut_apply (lut, source_bpp, dest_bpp, source, destination, n);
+     }
+     LUT_LEAVE (BABL(babl)->fish_path.usage[shard].lut_users);
+
+     if (done)
+     {
+       long now = babl_ticks_coarse ();
+
+       /* a store per call would bounce the cache line between threads */
+       if (now - babl->fish_path.last_lut_use > LUT_USE_RESOLUTION)
+         BABL(babl)->fish_path.last_lut_use = now;
      }
-     return 0;
+     return done;
 }
 
 
 
-#define MAX_BUFFER_SIZE            512
+/* bounds for the number of pixels processed per step of a multi-step
+ * conversion path, see conversion_path_chunk_size ()
+ */
+#define MIN_BUFFER_SIZE            64
+#define MAX_BUFFER_SIZE            2048
+
+/* bytes available for the intermediate buffers of a multi-step path, small
+ * enough that they stay resident in a 32KB L1 data cache along with the
+ * source and destination data streaming through.
+ */
+#define BABL_PATH_L1_BUDGET        (16 * 1024)
 
 int   babl_in_fish_path = 0;
 
 typedef struct _FishPathInstrumentation
 {
+  const Babl   *fmt_source;
+  const Babl   *fmt_destination;
   const Babl   *fmt_rgba_double;
   int     num_test_pixels;
   void   *source;
@@ -591,16 +1557,40 @@ typedef struct _FishPathInstrumentation
   int     init_instrumentation_done;
 } FishPathInstrumentation;
 
+/* the number of complete paths kept as candidates while searching, and how
+ * many of the cheapest of these are measured before settling for the best
+ * one found.
+ */
+#define BABL_PATH_MAX_CANDIDATES   32
+#define BABL_PATH_MEASURED         4
+
+/* estimated cost added for each step of a path, on top of the cost of the
+ * conversion itself; accounts for the intermediate buffers and makes
+ * shorter paths win among equally cheap ones.
+ */
+#define BABL_PATH_STEP_COST        1.0
+
+typedef struct PathCandidate {
+  double  estimated_cost;
+  double  estimated_error;
+  int     length;
+  Babl   *conversions[BABL_HARD_MAX_PATH_LENGTH];
+} PathCandidate;
+
 typedef struct PathContext {
   Babl     *fish_path;
   Babl     *to_format;
   BablList *current_path;
+  FishPathInstrumentation *fpi; /* shared by all paths measured */
+  double    current_cost; /* lower bound for the cost of current_path */
+  int       exhaustive;   /* measure every path, instead of collecting
+                             candidates */
+  int           n_candidates;
+  PathCandidate candidates[BABL_PATH_MAX_CANDIDATES];
 } PathContext;
 
 static void
-init_path_instrumentation (FishPathInstrumentation *fpi,
-                           Babl                    *fmt_source,
-                           Babl                    *fmt_destination);
+init_path_instrumentation (FishPathInstrumentation *fpi);
 
 static void
 destroy_path_instrumentation (FishPathInstrumentation *fpi);
@@ -634,6 +1624,12 @@ _babl_fish_create_name (char       *buf,
                         const Babl *destination,
                         int         is_reference);
 
+char *
+_babl_fish_path_create_name (char       *buf,
+                             const Babl *source,
+                             const Babl *destination,
+                             double      tolerance);
+
 
 static int max_path_length (void);
 
@@ -764,12 +1760,114 @@ bad_idea (const Babl *from, const Babl *to, const Babl *format)
  * constraint to the shortest path, that limits conversion error
  * introduced by such a path to be less than BABL_TOLERANCE. This
  * prohibits usage of any reasonable shortest path construction
- * algorithm such as Dijkstra's algorithm. The shortest path is
- * constructed by enumerating all available paths that are less
- * than BABL_PATH_LENGTH long, computing their costs and
- * conversion errors and backtracking. The backtracking is
- * implemented by recursive function get_conversion_path ().
+ * algorithm such as Dijkstra's algorithm.
+ *
+ * Instead the paths that are less than BABL_PATH_LENGTH long are
+ * enumerated by the recursive function get_conversion_path (), using
+ * the costs and errors measured for the individual conversions as
+ * estimates. The BABL_PATH_MAX_CANDIDATES paths with the lowest
+ * estimated cost that are within the error bound are kept, and
+ * partial paths that already are more expensive than all of the kept
+ * ones are not followed any further. Only the cheapest candidates are
+ * then instrumented with the test pixels by measure_path_candidates ()
+ * to pick the path actually used.
+ */
+
+/* compare the candidate path with the best path found so far, and adopt it
+ * if it is an improvement
+ */
+static void
+measure_path (PathContext *pc,
+              double       legal_error)
+{
+  double path_cost  = 0.0;
+  double ref_cost   = 0.0;
+  double path_error = 1.0;
+
+  get_path_instrumentation (pc->fpi, pc->current_path, &path_cost, &ref_cost, &path_error);
+  if(debug_conversions && babl_list_size (pc->current_path) == 1)
+    fprintf (stderr, "%s  error:%f cost:%f  \n",
+         babl_get_name (pc->current_path->items[0]), path_error, path_cost);
+
+  if ((path_cost < ref_cost) && /* do not use paths that took longer to compute than reference */
+      (path_cost < pc->fish_path->fish_path.cost) && // best thus far
+      (path_error <= legal_error )               // within tolerance
+      )
+    {
+      /* We have found the best path so far,
+       * let's copy it into our new fish */
+      pc->fish_path->fish_path.cost = path_cost;
+      pc->fish_path->fish.error  = path_error;
+      babl_list_copy (pc->current_path,
+                      pc->fish_path->fish_path.conversion_list);
+    }
+}
+
+/* insert the current path in the list of candidates, which is kept
+ * sorted by estimated cost; when the list is full the most expensive
+ * candidate is dropped.
+ */
+static void
+add_path_candidate (PathContext *pc,
+                    double       estimated_cost,
+                    double       estimated_error)
+{
+  PathCandidate *candidate;
+  int            pos = pc->n_candidates;
+  int            i;
+
+  while (pos > 0 &&
+         (pc->candidates[pos - 1].estimated_cost > estimated_cost ||
+          (pc->candidates[pos - 1].estimated_cost == estimated_cost &&
+           pc->candidates[pos - 1].estimated_error > estimated_error)))
+    pos--;
+
+  if (pos >= BABL_PATH_MAX_CANDIDATES)
+    return;
+
+  if (pc->n_candidates < BABL_PATH_MAX_CANDIDATES)
+    pc->n_candidates++;
+
+  memmove (&pc->candidates[pos + 1], &pc->candidates[pos],
+           (pc->n_candidates - 1 - pos) * sizeof (PathCandidate));
+
+  candidate = &pc->candidates[pos];
+  candidate->estimated_cost  = estimated_cost;
+  candidate->estimated_error = estimated_error;
+  candidate->length          = babl_list_size (pc->current_path);
+  for (i = 0; i < candidate->length; i++)
+    candidate->conversions[i] = pc->current_path->items[i];
+}
+
+/* instrument the candidates in order of estimated cost, stopping once
+ * BABL_PATH_MEASURED of them have been measured and one was usable.
+ * Returns 0 if all candidates were measured without finding a usable path.
  */
+static int
+measure_path_candidates (PathContext *pc,
+                         double       legal_error)
+{
+  int i, j;
+
+  for (i = 0; i < pc->n_candidates; i++)
+    {
+      if (i >= BABL_PATH_MEASURED &&
+          pc->fish_path->fish_path.conversion_list->count)
+        break;
+
+      while (babl_list_size (pc->current_path))
+        babl_list_remove_last (pc->current_path);
+      for (j = 0; j < pc->candidates[i].length; j++)
+        babl_list_insert_last (pc->current_path,
+                               pc->candidates[i].conversions[j]);
+
+      measure_path (pc, legal_error);
+    }
+  while (babl_list_size (pc->current_path))
+    babl_list_remove_last (pc->current_path);
+
+  return pc->fish_path->fish_path.conversion_list->count != 0;
+}
 
 static void
 get_conversion_path (PathContext *pc,
@@ -784,51 +1882,40 @@ get_conversion_path (PathContext *pc,
        * depth, let's bail out */
       return;
     }
+  else if (!pc->exhaustive &&
+           pc->n_candidates == BABL_PATH_MAX_CANDIDATES &&
+           pc->current_cost >=
+             pc->candidates[BABL_PATH_MAX_CANDIDATES - 1].estimated_cost)
+    {
+      /* costs only add up, this path cannot become cheaper than any
+       * of the candidates we already have */
+      return;
+    }
   else if ((current_length > 0) && (current_format == pc->to_format))
     {
        /* We have found a candidate path, let's
         * see about it's properties */
       double path_cost  = 0.0;
-      double ref_cost   = 0.0;
       double path_error = 1.0;
-#if 1
       int    i;
+
       for (i = 0; i < babl_list_size (pc->current_path); i++)
         {
-          path_error *= (1.0 + babl_conversion_error ((BablConversion *) pc->current_path->items[i]));
+          BablConversion *conversion = (BablConversion *) pc->current_path->items[i];
+
+          path_error *= (1.0 + babl_conversion_error (conversion));
+          path_cost  += babl_conversion_cost (conversion) + BABL_PATH_STEP_COST;
         }
 
       if (path_error - 1.0 <= legal_error )
                 /* check this before the more accurate measurement of error -
                    to bail earlier, this also leads to a stricter
                    discarding of bad fast paths  */
-#endif
         {
-          FishPathInstrumentation fpi;
-          memset (&fpi, 0, sizeof (fpi));
-
-          fpi.source = (Babl*) babl_list_get_first (pc->current_path)->conversion.source;
-          fpi.destination = pc->to_format;
-
-          get_path_instrumentation (&fpi, pc->current_path, &path_cost, &ref_cost, &path_error);
-          if(debug_conversions && current_length == 1)
-            fprintf (stderr, "%s  error:%f cost:%f  \n",
-                 babl_get_name (pc->current_path->items[0]), path_error, path_cost);
-
-          if ((path_cost < ref_cost) && /* do not use paths that took longer to compute than reference */
-              (path_cost < pc->fish_path->fish_path.cost) && // best thus far
-              (path_error <= legal_error )               // within tolerance
-              )
-            {
-              /* We have found the best path so far,
-               * let's copy it into our new fish */
-              pc->fish_path->fish_path.cost = path_cost;
-              pc->fish_path->fish.error  = path_error;
-              babl_list_copy (pc->current_path,
-                              pc->fish_path->fish_path.conversion_list);
-            }
-
-          destroy_path_instrumentation (&fpi);
+          if (pc->exhaustive)
+            measure_path (pc, legal_error);
+          else
+            add_path_candidate (pc, path_cost, path_error - 1.0);
         }
     }
   else
@@ -852,9 +1939,19 @@ get_conversion_path (PathContext *pc,
               Babl *next_format = BABL (next_conversion->conversion.destination);
               if (!next_format->format.visited && !bad_idea (current_format, pc->to_format, next_format))
                 {
+                  double step_cost = BABL_PATH_STEP_COST;
+
+                  /* conversions not measured yet are only measured once
+                   * they are part of a complete path, until then zero is
+                   * a safe lower bound for their cost */
+                  if (next_conversion->conversion.error != -1.0)
+                    step_cost += next_conversion->conversion.cost;
+
                   /* next_format is not in the current path, we can pay a visit */
                   babl_list_insert_last (pc->current_path, next_conversion);
+                  pc->current_cost += step_cost;
                   get_conversion_path (pc, next_format, current_length + 1, max_length, legal_error);
+                  pc->current_cost -= step_cost;
                   babl_list_remove_last (pc->current_path);
                 }
             }
@@ -877,6 +1974,25 @@ _babl_fish_create_name (char       *buf,
   return buf;
 }
 
+/* fishes made for babl_fast_fish () are kept in the fish database too, under
+ * a name that also holds their tolerance */
+char *
+_babl_fish_path_create_name (char       *buf,
+                             const Babl *source,
+                             const Babl *destination,
+                             double      tolerance)
+{
+  int length;
+
+  _babl_fish_create_name (buf, source, destination, 1);
+  if (tolerance > 0.0)
+    {
+      length = strlen (buf);
+      snprintf (buf + length, BABL_MAX_NAME_LEN - length, " %a", tolerance);
+    }
+  return buf;
+}
+
 int
 _babl_fish_path_destroy (void *data);
 
@@ -884,9 +2000,10 @@ int
 _babl_fish_path_destroy (void *data)
 {
   Babl *babl=data;
-  if (babl->fish_path.u8_lut)
-    free (babl->fish_path.u8_lut);
-  babl->fish_path.u8_lut = NULL;
+  babl_mutex_lock (babl_lut_mutex);
+  babl_lut_release (babl);
+  babl_lut_sweep ();
+  babl_mutex_unlock (babl_lut_mutex);
   if (babl->fish_path.conversion_list)
     babl_free (babl->fish_path.conversion_list);
   babl->fish_path.conversion_list = NULL;
@@ -1159,7 +2276,7 @@ _babl_fish_missing_fast_path_warning (const Babl *source,
 }
 
 
-static Babl *
+Babl *
 babl_fish_path2 (const Babl *source,
                  const Babl *destination,
                  double      tolerance)
@@ -1186,29 +2303,27 @@ babl_fish_path2 (const Babl *source,
 #endif
   }
 
-  _babl_fish_create_name (name, source, destination, 1);
-  babl_mutex_lock (babl_format_mutex);
-  babl = babl_db_exist_by_name (babl_fish_db (), name);
-
   if (tolerance <= 0.0)
   {
     is_fast = 0;
-    tolerance = _babl_legal_error ();
+    tolerance = 0.0;
   }
   else
     is_fast = 1;
 
-  if (!is_fast)
-  {
+  _babl_fish_path_create_name (name, source, destination, tolerance);
+  babl_mutex_lock (babl_format_mutex);
+  babl = babl_db_exist_by_name (babl_fish_db (), name);
+
   if (babl)
     {
       /* There is an instance already registered by the required name,
-       * returning the preexistent one instead.
+       * returning the preexistent one instead, unless it records that
+       * there is no path for a fast fish.
        */
       babl_mutex_unlock (babl_format_mutex);
-      return babl;
+      return babl->class_type == BABL_FISH_PATH ? babl : NULL;
     }
-  }
 
   if ((source->format.space != sRGB) ||
       (destination->format.space != sRGB))
@@ -1231,7 +2346,7 @@ babl_fish_path2 (const Babl *source,
       run_once[i++] = source->format.space;
       babl_conversion_class_for_each (alias_conversion, (void*)source->format.space);
 
-      _babl_space_add_universal_rgb (source->format.space);
+      _babl_space_add_universal_rgb (source->format.space, sRGB);
     }
 
     /* destination space not in initialization array */
@@ -1240,15 +2355,31 @@ babl_fish_path2 (const Babl *source,
       run_once[i++] = destination->format.space;
       babl_conversion_class_for_each (alias_conversion, (void*)destination->format.space);
 
-      _babl_space_add_universal_rgb (destination->format.space);
+      _babl_space_add_universal_rgb (destination->format.space, sRGB);
     }
 
+    /* every space gets adapters to and from sRGB, direct adapters between
+     * two other spaces are only made once a fish converts between them */
+    _babl_space_add_universal_rgb (source->format.space,
+                                   destination->format.space);
+
     if (!done && 0)
     {
       babl_conversion_class_for_each (show_item, (void*)source->format.space);
     }
   }
 
+  /* now that the conversions for the spaces involved exist, the cached
+   * path might be usable */
+  babl = babl_fish_cache_lookup (source, destination, tolerance);
+  if (babl && babl->class_type == BABL_FISH_PATH)
+  {
+    babl_mutex_unlock (babl_format_mutex);
+    return babl;
+  }
+  if (!is_fast)
+    tolerance = _babl_legal_error ();
+
   babl = babl_calloc (1, sizeof (BablFishPath) +
                       strlen (name) + 1);
   babl_set_destructor (babl, _babl_fish_path_destroy);
@@ -1266,12 +2397,14 @@ babl_fish_path2 (const Babl *source,
   babl->fish.pixels               = 0;
   babl->fish.error                = BABL_MAX_COST_VALUE;
   babl->fish_path.cost            = BABL_MAX_COST_VALUE;
+  babl->fish_path.tolerance       = is_fast ? tolerance : 0.0;
   babl->fish_path.conversion_list = babl_list_init_with_size (BABL_HARD_MAX_PATH_LENGTH);
 
 
 
   {
     PathContext pc;
+    FishPathInstrumentation fpi;
     int start_depth = max_path_length ();
     int end_depth = start_depth + 1 + ((destination->format.space != sRGB)?1:0);
     end_depth = MIN(end_depth, BABL_HARD_MAX_PATH_LENGTH);
@@ -1279,6 +2412,14 @@ babl_fish_path2 (const Babl *source,
     pc.current_path = babl_list_init_with_size (BABL_HARD_MAX_PATH_LENGTH);
     pc.fish_path = babl;
     pc.to_format = (Babl *) destination;
+    pc.fpi = &fpi;
+
+    /* the reference conversion of the test pixels is computed the first
+     * time a path gets measured, and shared by all paths measured during
+     * this search */
+    memset (&fpi, 0, sizeof (fpi));
+    fpi.fmt_source      = source;
+    fpi.fmt_destination = destination;
 
     /* we hold a global lock whilerunning get_conversion_path since
      * it depends on keeping the various format.visited members in
@@ -1291,7 +2432,19 @@ babl_fish_path2 (const Babl *source,
          babl->fish_path.conversion_list->count == 0 && max_depth <= end_depth;
          max_depth++)
     {
+      pc.n_candidates = 0;
+      pc.current_cost = 0.0;
+      pc.exhaustive   = 0;
       get_conversion_path (&pc, (Babl *) source, 0, max_depth, tolerance);
+
+      if (!measure_path_candidates (&pc, tolerance) &&
+          pc.n_candidates == BABL_PATH_MAX_CANDIDATES)
+        {
+          /* none of the candidates panned out, and there were more
+           * paths than we kept; fall back to measuring all of them */
+          pc.exhaustive = 1;
+          get_conversion_path (&pc, (Babl *) source, 0, max_depth, tolerance);
+        }
     }
 
     if (debug_missing)
@@ -1309,12 +2462,31 @@ babl_fish_path2 (const Babl *source,
     }
 
     babl_in_fish_path--;
+    destroy_path_instrumentation (&fpi);
     babl_free (pc.current_path);
   }
 
   if (babl_list_size (babl->fish_path.conversion_list) == 0)
     {
       babl_free (babl);
+      if (is_fast)
+        {
+          /* remember that the tolerance does not help, with a dummy
+           * BABL_FISH that only is found by name, not when babl_fish ()
+           * looks the pair up */
+          babl = babl_calloc (1, sizeof (BablFish) + strlen (name) + 1);
+          babl->class_type       = BABL_FISH;
+          babl->instance.id      = 0;
+          babl->instance.name    = ((char *) babl) + sizeof (BablFish);
+#ifndef _UCRT
+          strcpy (babl->instance.name, name);
+#else
+          strcpy_s (babl->instance.name, strlen(name) + 1, name);
+#endif
+          babl->fish.source      = source;
+          babl->fish.destination = destination;
+          babl_db_insert (babl_fish_db (), babl);
+        }
       babl_mutex_unlock (babl_format_mutex);
 
       return NULL;
@@ -1326,39 +2498,12 @@ babl_fish_path2 (const Babl *source,
   /* Since there is not an already registered instance by the required
    * name, inserting newly created class into database.
    */
-  if (!is_fast)
-  {
-    babl_db_insert (babl_fish_db (), babl);
-  }
+  babl_db_insert (babl_fish_db (), babl);
+  babl_fish_cache_add (babl);
   babl_mutex_unlock (babl_format_mutex);
   return babl;
 }
 
-const Babl * 
-babl_fast_fish (const void *source_format,
-                const void *destination_format,
-                const char *performance)
-{
-  double tolerance = 0.0;
-
-  if (!performance || !strcmp (performance, "default"))
-    tolerance = 0.0; // note: not _babl_legal_error() to trigger,
-                      // right code paths in babl_fish_path2
-  else if (!strcmp (performance, "exact"))
-    tolerance=0.0000000001;
-  else if (!strcmp (performance, "precise"))
-    tolerance=0.00001;
-  if (!strcmp (performance, "fast"))
-    tolerance=0.001;
-  else if (!strcmp (performance, "glitch"))
-    tolerance=0.01;
-  else {
-    tolerance = babl_parse_double (performance);
-  }
-
-  return babl_fish_path2 (source_format, destination_format, tolerance);
-}
-
 Babl *
 babl_fish_path (const Babl *source,
                 const Babl *destination)
@@ -1374,7 +2519,6 @@ babl_fish_path_process (const Babl *babl,
                         long        n,
                         void       *data)
 {
-  BABL(babl)->fish.pixels += n;
   if (babl->fish_path.is_u8_color_conv)
   {
      if (babl_fish_lut_process_maybe (babl,
@@ -1384,7 +2528,8 @@ babl_fish_path_process (const Babl *babl,
   }
   else
   {
-    babl_conv_counter+=n;
+    babl_fish_usage_add (BABL(babl), n);
+    babl_conv_count (n);
   }
   process_conversion_path (babl->fish_path.conversion_list,
                            source,
@@ -1437,7 +2582,10 @@ _babl_fish_rig_dispatch (Babl *babl)
         break;
 
       case BABL_FISH_PATH:
-        if (babl_list_size(babl->fish_path.conversion_list) == 1)
+        /* LUT candidates go through babl_fish_path_process (), which
+         * counts their pixels and builds and uses their LUT */
+        if (babl_list_size(babl->fish_path.conversion_list) == 1 &&
+            !babl->fish_path.is_u8_color_conv)
         {
           BablConversion *conversion = (void*)babl_list_get_first(babl->fish_path.conversion_list);
 
@@ -1513,6 +2661,100 @@ babl_process_rows (const Babl *fish,
   return n * rows;
 }
 
+/* smallest number of pixels worth handing to another thread */
+#define BABL_PARALLEL_MIN_PIXELS   (64 * 512)
+/* tasks per thread, more tasks than threads evens out uneven progress */
+#define BABL_PARALLEL_TASKS_PER_THREAD 4
+
+typedef struct ProcessRowsJob
+{
+  const Babl    *fish;
+  const uint8_t *source;
+  int            source_stride;
+  uint8_t       *dest;
+  int            dest_stride;
+  long           n;
+  int            source_bpp;
+  int            dest_bpp;
+  int64_t        n_pixels;
+} ProcessRowsJob;
+
+static void
+process_rows_task (int   task,
+                   int   n_tasks,
+                   void *data)
+{
+  ProcessRowsJob *job   = data;
+  Babl           *babl  = (Babl*)job->fish;
+  /* each task gets a contiguous range of the pixels of the image seen as
+   * rows laid end to end, this way a single huge row is split as well.
+   */
+  int64_t         start = job->n_pixels * task / n_tasks;
+  int64_t         end   = job->n_pixels * (task + 1) / n_tasks;
+
+  while (start < end)
+    {
+      int64_t row   = start / job->n;
+      long    col   = start % job->n;
+      long    count = MIN (job->n - col, end - start);
+
+      babl->fish.dispatch (babl,
+           (void*)(job->source + row * job->source_stride + col * job->source_bpp),
+           (void*)(job->dest + row * job->dest_stride + col * job->dest_bpp),
+           count, *babl->fish.data);
+      start += count;
+    }
+}
+
+long
+babl_process_rows_parallel (const Babl *fish,
+                            const void *source,
+                            int         source_stride,
+                            void       *dest,
+                            int         dest_stride,
+                            long        n,
+                            int         rows)
+{
+  const Babl     *source_format;
+  const Babl     *dest_format;
+  ProcessRowsJob  job;
+  int64_t         n_tasks;
+
+  babl_assert (fish && BABL_IS_BABL (fish) && source && dest);
+
+  if (n <= 0 || rows <= 0)
+    return 0;
+
+  source_format = fish->fish.source;
+  dest_format   = fish->fish.destination;
+
+  n_tasks = ((int64_t) n * rows) / BABL_PARALLEL_MIN_PIXELS;
+  n_tasks = MIN (n_tasks, babl_parallel_get_n_threads () *
+                          BABL_PARALLEL_TASKS_PER_THREAD);
+
+  if (n_tasks <= 1 ||
+      source_format->class_type != BABL_FORMAT ||
+      dest_format->class_type != BABL_FORMAT ||
+      source_format->format.planar ||
+      dest_format->format.planar)
+    return babl_process_rows (fish, source, source_stride,
+                              dest, dest_stride, n, rows);
+
+  job.fish          = fish;
+  job.source        = source;
+  job.source_stride = source_stride;
+  job.dest          = dest;
+  job.dest_stride   = dest_stride;
+  job.n             = n;
+  job.source_bpp    = source_format->format.bytes_per_pixel;
+  job.dest_bpp      = dest_format->format.bytes_per_pixel;
+  job.n_pixels      = (int64_t) n * rows;
+
+  babl_parallel_distribute (n_tasks, process_rows_task, &job);
+
+  return n * rows;
+}
+
 #include <stdint.h>
 
 #define BABL_ALIGN 16
@@ -1523,6 +2765,44 @@ static inline void *align_16 (unsigned char *ret)
   return ret;
 }
 
+/* Works out how many pixels to push through all the steps of a path at a
+ * time, based on the pixel size of the intermediate formats rather than
+ * assuming worst case sizes; paths through RGBA double get shorter chunks
+ * than paths through u8 or float formats, keeping both scratch buffers
+ * within BABL_PATH_L1_BUDGET.
+ */
+static inline long
+conversion_path_chunk_size (BablList *path,
+                            int      *temp_bpp)
+{
+  int conversions = babl_list_size (path);
+  int max_bpp     = 0;
+  long chunk_size;
+  int i;
+
+  for (i = 0; i < conversions - 1; i++)
+    {
+      const Babl *format = BABL (path->items[i])->conversion.destination;
+      int         bpp    = sizeof (double) * 5;
+
+      if (format->class_type == BABL_FORMAT)
+        bpp = format->format.bytes_per_pixel;
+      if (bpp > max_bpp)
+        max_bpp = bpp;
+    }
+
+  if (max_bpp <= 0)
+    max_bpp = 1;
+  *temp_bpp = max_bpp;
+
+  chunk_size = BABL_PATH_L1_BUDGET / (max_bpp * (conversions > 2 ? 2 : 1));
+  if (chunk_size < MIN_BUFFER_SIZE)
+    chunk_size = MIN_BUFFER_SIZE;
+  else if (chunk_size > MAX_BUFFER_SIZE)
+    chunk_size = MAX_BUFFER_SIZE;
+  return chunk_size;
+}
+
 static inline void
 process_conversion_path (BablList   *path,
                          const void *source_buffer,
@@ -1543,21 +2823,23 @@ process_conversion_path (BablList   *path,
   else
     {
       long j;
+      int  temp_bpp;
+      long chunk_size = conversion_path_chunk_size (path, &temp_bpp);
 
-      void *temp_buffer = align_16 (alloca (MIN(n, MAX_BUFFER_SIZE) *
-                                    sizeof (double) * 5 + 16));
+      void *temp_buffer = align_16 (alloca (MIN(n, chunk_size) *
+                                    temp_bpp + 16));
       void *temp_buffer2 = NULL;
 
       if (conversions > 2)
         {
           /* We'll need one more auxiliary buffer */
-          temp_buffer2 = align_16 (alloca (MIN(n, MAX_BUFFER_SIZE) *
-                                   sizeof (double) * 5 + 16));
+          temp_buffer2 = align_16 (alloca (MIN(n, chunk_size) *
+                                   temp_bpp + 16));
         }
 
-      for (j = 0; j < n; j+= MAX_BUFFER_SIZE)
+      for (j = 0; j < n; j+= chunk_size)
         {
-          long c = MIN (n - j, MAX_BUFFER_SIZE);
+          long c = MIN (n - j, chunk_size);
           int i;
 
           void *aux1_buffer = temp_buffer;
@@ -1596,14 +2878,40 @@ process_conversion_path (BablList   *path,
   }
 }
 
+/* a conversion path, or a fish if path is NULL, run over the test pixels
+ * by babl_measure_ns () */
+typedef struct _PathTiming
+{
+  BablList   *path;
+  const Babl *fish;
+  const void *source;
+  int         source_bpp;
+  void       *destination;
+  int         dest_bpp;
+  long        n;
+} PathTiming;
+
 static void
-init_path_instrumentation (FishPathInstrumentation *fpi,
-                           Babl                    *fmt_source,
-                           Babl                    *fmt_destination)
+path_timing_run (void *data)
 {
-  long   ticks_start = 0;
-  long   ticks_end   = 0;
+  PathTiming *timing = data;
 
+  if (timing->path)
+    process_conversion_path (timing->path,
+                             timing->source, timing->source_bpp,
+                             timing->destination, timing->dest_bpp,
+                             timing->n);
+  else
+    _babl_process (timing->fish,
+                   timing->source, timing->destination, timing->n);
+}
+
+static void
+init_path_instrumentation (FishPathInstrumentation *fpi)
+{
+  const Babl *fmt_source      = fpi->fmt_source;
+  const Babl *fmt_destination = fpi->fmt_destination;
+  PathTiming    timing      = {NULL,};
   const double *test_pixels = babl_get_path_test_pixels ();
 
   if (!fpi->fmt_rgba_double)
@@ -1649,12 +2957,13 @@ init_path_instrumentation (FishPathInstrumentation *fpi,
                  test_pixels, fpi->source,fpi->num_test_pixels);
 
   /* calculate the reference buffer of how it should be */
-  ticks_start = babl_ticks ();
-  _babl_process (fpi->fish_reference,
-                 fpi->source, fpi->ref_destination,
-                 fpi->num_test_pixels);
-  ticks_end = babl_ticks ();
-  fpi->reference_cost = (ticks_end - ticks_start) * BABL_TEST_ITER;
+  timing.fish        = fpi->fish_reference;
+  timing.source      = fpi->source;
+  timing.destination = fpi->ref_destination;
+  timing.n           = fpi->num_test_pixels;
+  fpi->reference_cost = babl_measure_ns (path_timing_run, &timing,
+                                         BABL_TEST_MAX_BATCH) *
+                        BABL_TEST_ITER / 1000.0;
 
   /* transform the reference destination buffer to RGBA */
   _babl_process (fpi->fish_destination_to_rgba,
@@ -1685,56 +2994,28 @@ get_path_instrumentation (FishPathInstrumentation *fpi,
                           double                  *ref_cost,
                           double                  *path_error)
 {
-  long   ticks_start = 0;
-  long   ticks_end   = 0;
-
-  Babl *babl_source = fpi->source;
-  Babl *babl_destination = fpi->destination;
-
-  int source_bpp = 0;
-  int dest_bpp = 0;
-
-  switch (babl_source->instance.class_type)
-    {
-      case BABL_FORMAT:
-        source_bpp = babl_source->format.bytes_per_pixel;
-        break;
-      case BABL_TYPE:
-        source_bpp = babl_source->type.bits / 8;
-        break;
-      default:
-        babl_log ("=eeek{%i}\n", babl_source->instance.class_type - BABL_MAGIC);
-    }
-
-  switch (babl_destination->instance.class_type)
-    {
-      case BABL_FORMAT:
-        dest_bpp = babl_destination->format.bytes_per_pixel;
-        break;
-      case BABL_TYPE:
-        dest_bpp = babl_destination->type.bits / 8;
-        break;
-      default:
-        babl_log ("-eeek{%i}\n",
-                  babl_destination->instance.class_type - BABL_MAGIC);
-     }
+  PathTiming timing;
 
   if (!fpi->init_instrumentation_done)
     {
       /* this initialization can be done only once since the
        * source and destination formats do not change during
        * the search */
-      init_path_instrumentation (fpi, babl_source, babl_destination);
+      init_path_instrumentation (fpi);
       fpi->init_instrumentation_done = 1;
     }
 
   /* calculate this path's view of what the result should be */
-  ticks_start = babl_ticks ();
-  for (int i = 0; i < BABL_TEST_ITER; i ++)
-  process_conversion_path (path, fpi->source, source_bpp, fpi->destination,
-                           dest_bpp, fpi->num_test_pixels);
-  ticks_end = babl_ticks ();
-  *path_cost = (ticks_end - ticks_start);
+  timing.path        = path;
+  timing.fish        = NULL;
+  timing.source      = fpi->source;
+  timing.source_bpp  = fpi->fmt_source->format.bytes_per_pixel;
+  timing.destination = fpi->destination;
+  timing.dest_bpp    = fpi->fmt_destination->format.bytes_per_pixel;
+  timing.n           = fpi->num_test_pixels;
+  *path_cost = babl_measure_ns (path_timing_run, &timing,
+                                BABL_TEST_MAX_BATCH) *
+               BABL_TEST_ITER / 1000.0;
 
   /* transform the reference and the actual destination buffers to RGBA
    * for comparison with each other
@@ -22,6 +22,114 @@
 #include "lcms2.h"
 #endif
 
+/* The reference fish converts in chunks, small enough for all intermediate
+ * buffers to fit in a scratch area on the stack of the calling thread; the
+ * planar views of these buffers are also built on the stack. This keeps the
+ * reference code paths free of allocations and global locks, so that
+ * conversions falling back to them scale with the number of threads.
+ */
+#define BABL_REFERENCE_SCRATCH  4096  /* doubles */
+
+typedef struct
+{
+  BablImage      image;
+  BablComponent *component[BABL_MAX_COMPONENTS];
+  BablSampling  *sampling[BABL_MAX_COMPONENTS];
+  BablType      *type[BABL_MAX_COMPONENTS];
+  char          *data[BABL_MAX_COMPONENTS];
+  int            pitch[BABL_MAX_COMPONENTS];
+  int            stride[BABL_MAX_COMPONENTS];
+} ReferenceImage;
+
+static BablImage *
+reference_image_init (ReferenceImage *storage,
+                      int             components)
+{
+  BablImage *image = &storage->image;
+
+  babl_assert (components <= BABL_MAX_COMPONENTS);
+  memset (image, 0, sizeof (BablImage));
+  image->instance.class_type = BABL_IMAGE;
+  image->instance.name       = "slartibartfast";
+  image->components          = components;
+  image->component           = storage->component;
+  image->sampling            = storage->sampling;
+  image->type                = storage->type;
+  image->data                = storage->data;
+  image->pitch               = storage->pitch;
+  image->stride              = storage->stride;
+
+  return image;
+}
+
+/* a single component plane, like babl_image_new() with one component */
+static BablImage *
+reference_plane_init (ReferenceImage *storage)
+{
+  BablImage *image = reference_image_init (storage, 1);
+
+  image->component[0] = (BablComponent *) babl_component_from_id (BABL_GRAY_LINEAR);
+  image->sampling[0]  = NULL;
+  image->type[0]      = NULL;
+  image->data[0]      = NULL;
+  image->pitch[0]     = 1;
+  image->stride[0]    = 0;
+
+  return image;
+}
+
+/* like babl_image_from_linear () */
+static Babl *
+reference_image_from_linear (ReferenceImage *storage,
+                             char           *buffer,
+                             const Babl     *format)
+{
+  BablImage *image;
+  int        components;
+  int        pitch = 0;
+  int        offset = 0;
+  int        i;
+
+  if (format->class_type == BABL_FORMAT)
+    {
+      components   = format->format.components;
+      image        = reference_image_init (storage, components);
+      image->format = (BablFormat *) format;
+      image->model  = (BablModel *) format->format.model;
+      for (i = 0; i < components; i++)
+        {
+          image->component[i] = format->format.component[i];
+          image->sampling[i]  = format->format.sampling[i];
+          image->type[i]      = format->format.type[i];
+          pitch += image->type[i]->bits / 8;
+        }
+    }
+  else
+    {
+      /* models are backed by doubles */
+      components   = format->model.components;
+      image        = reference_image_init (storage, components);
+      image->model = (BablModel *) format;
+      for (i = 0; i < components; i++)
+        {
+          image->component[i] = format->model.component[i];
+          image->sampling[i]  = (BablSampling *) babl_sampling (1, 1);
+          image->type[i]      = (BablType *) babl_type_from_id (BABL_DOUBLE);
+          pitch += 64 / 8;
+        }
+    }
+
+  for (i = 0; i < components; i++)
+    {
+      image->pitch[i]  = pitch;
+      image->stride[i] = 0;
+      image->data[i]   = buffer + offset;
+      offset += image->type[i]->bits / 8;
+    }
+
+  return (Babl *) image;
+}
+
 
 static Babl *
 assert_conversion_find (const void *source,
@@ -171,13 +279,10 @@ convert_to_double (BablFormat      *source_fmt,
 {
   int        i;
 
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  ReferenceImage src_storage;
+  ReferenceImage dst_storage;
+  BablImage     *src_img = reference_plane_init (&src_storage);
+  BablImage     *dst_img = reference_plane_init (&dst_storage);
 
   dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_DOUBLE);
   dst_img->pitch[0] =
@@ -234,8 +339,6 @@ convert_to_double (BablFormat      *source_fmt,
         }
     }
   }
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
 
@@ -248,13 +351,10 @@ convert_from_double (BablFormat *source_fmt,
 {
   int        i;
 
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  ReferenceImage src_storage;
+  ReferenceImage dst_storage;
+  BablImage     *src_img = reference_plane_init (&src_storage);
+  BablImage     *dst_img = reference_plane_init (&dst_storage);
 
   src_img->type[0]   = (BablType *) babl_type_from_id (BABL_DOUBLE);
   src_img->pitch[0]  = (src_img->type[0]->bits / 8) * destination_fmt->model->components;
@@ -305,8 +405,6 @@ convert_from_double (BablFormat *source_fmt,
 
       dst_img->data[0] += dst_img->type[0]->bits / 8;
     }
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
 
@@ -316,13 +414,10 @@ ncomponent_convert_to_double (BablFormat       *source_fmt,
                               char             *source_double_buf,
                               int               n)
 {
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  ReferenceImage src_storage;
+  ReferenceImage dst_storage;
+  BablImage     *src_img = reference_plane_init (&src_storage);
+  BablImage     *dst_img = reference_plane_init (&dst_storage);
 
   dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_DOUBLE);
   dst_img->pitch[0] = (dst_img->type[0]->bits / 8);
@@ -339,8 +434,6 @@ ncomponent_convert_to_double (BablFormat       *source_fmt,
     assert_conversion_find (src_img->type[0], dst_img->type[0]),
     (void*)src_img, (void*)dst_img,
     n * source_fmt->components);
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
 static void
@@ -349,13 +442,10 @@ ncomponent_convert_from_double (BablFormat *destination_fmt,
                                 char       *destination_buf,
                                 int         n)
 {
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  ReferenceImage src_storage;
+  ReferenceImage dst_storage;
+  BablImage     *src_img = reference_plane_init (&src_storage);
+  BablImage     *dst_img = reference_plane_init (&dst_storage);
 
   src_img->type[0]   = (BablType *) babl_type_from_id (BABL_DOUBLE);
   src_img->pitch[0]  = (src_img->type[0]->bits / 8);
@@ -374,16 +464,81 @@ ncomponent_convert_from_double (BablFormat *destination_fmt,
     n * destination_fmt->components);
 
   dst_img->data[0] += dst_img->type[0]->bits / 8;
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
 
+typedef void (*ReferenceChunkFunc) (const Babl *babl,
+                                    const char *source,
+                                    char       *destination,
+                                    long        n,
+                                    double     *scratch,
+                                    void       *data);
+
 static int
+reference_doubles_per_pixel (const Babl *babl)
+{
+  const Babl *source_format      = babl->fish.source;
+  const Babl *destination_format = babl->fish.destination;
+  /* enough room for the intermediate buffers of every code path: the source
+   * and destination model and format components, RGBA and CMYKA */
+  return source_format->format.model->components +
+         source_format->format.components +
+         destination_format->format.model->components +
+         destination_format->format.components + 4 + 5;
+}
+
+static void
+reference_process_chunked (const Babl        *babl,
+                           const char        *source,
+                           char              *destination,
+                           long               n,
+                           double            *scratch,
+                           ReferenceChunkFunc func,
+                           void              *data)
+{
+  int  per_pixel  = reference_doubles_per_pixel (babl);
+  /* less one pixel, for the padding of the float path */
+  long chunk      = BABL_REFERENCE_SCRATCH / per_pixel - 1;
+  int  source_bpp = babl->fish.source->format.bytes_per_pixel;
+  int  dest_bpp   = babl->fish.destination->format.bytes_per_pixel;
+  long i;
+
+  if (n <= 0)
+    return;
+
+  if (chunk < 1)
+    {
+      /* formats with very many components get an allocated scratch area */
+      double *alloc = babl_malloc (sizeof (double) * per_pixel * (n + 1));
+
+      func (babl, source, destination, n, alloc, data);
+      babl_free (alloc);
+      return;
+    }
+
+  /* when converting in place to a wider format, start from the end so that
+   * no chunk overwrites source pixels that are yet to be converted */
+  if (dest_bpp > source_bpp)
+    {
+      for (i = ((n - 1) / chunk) * chunk; i >= 0; i -= chunk)
+        func (babl, source + i * source_bpp, destination + i * dest_bpp,
+              n - i < chunk ? n - i : chunk, scratch, data);
+    }
+  else
+    {
+      for (i = 0; i < n; i += chunk)
+        func (babl, source + i * source_bpp, destination + i * dest_bpp,
+              n - i < chunk ? n - i : chunk, scratch, data);
+    }
+}
+
+static void
 process_to_n_component (const Babl  *babl,
                         const char *source,
                         char       *destination,
-                        long        n)
+                        long        n,
+                        double     *scratch,
+                        void       *data)
 {
   void *double_buf;
 #ifndef MAX
@@ -394,7 +549,7 @@ process_to_n_component (const Babl  *babl,
   components = MAX(components, BABL (babl->fish.destination)->format.components);
   components = MAX(components, BABL (babl->fish.destination)->model.components);
 
-  double_buf = babl_malloc (sizeof (double) * n * components);
+  double_buf = scratch;
       memset (double_buf, 0,sizeof (double) * n * components);
 
  /* a single precision path could be added here*/
@@ -413,9 +568,6 @@ process_to_n_component (const Babl  *babl,
         n
       );
     }
-
-  babl_free (double_buf);
-  return 0;
 }
 
 static int compatible_components (const BablFormat *a,
@@ -436,13 +588,10 @@ ncomponent_convert_to_float (BablFormat       *source_fmt,
                              char             *source_float_buf,
                              int               n)
 {
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  ReferenceImage src_storage;
+  ReferenceImage dst_storage;
+  BablImage     *src_img = reference_plane_init (&src_storage);
+  BablImage     *dst_img = reference_plane_init (&dst_storage);
 
   dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_FLOAT);
   dst_img->pitch[0] = (dst_img->type[0]->bits / 8);
@@ -459,8 +608,6 @@ ncomponent_convert_to_float (BablFormat       *source_fmt,
     assert_conversion_find (src_img->type[0], dst_img->type[0]),
     (void*)src_img, (void*)dst_img,
     n * source_fmt->components);
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
 static void
@@ -470,13 +617,10 @@ ncomponent_convert_from_float (BablFormat *source_fmt,
                                char       *destination_buf,
                                int         n)
 {
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  ReferenceImage src_storage;
+  ReferenceImage dst_storage;
+  BablImage     *src_img = reference_plane_init (&src_storage);
+  BablImage     *dst_img = reference_plane_init (&dst_storage);
 
   src_img->type[0]   = (BablType *) babl_type_from_id (BABL_FLOAT);
   src_img->pitch[0]  = (src_img->type[0]->bits / 8);
@@ -495,8 +639,6 @@ ncomponent_convert_from_float (BablFormat *source_fmt,
     n * destination_fmt->components);
 
   dst_img->data[0] += dst_img->type[0]->bits / 8;
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
 static void
@@ -507,13 +649,10 @@ convert_to_float (BablFormat *source_fmt,
 {
   int        i;
 
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  ReferenceImage src_storage;
+  ReferenceImage dst_storage;
+  BablImage     *src_img = reference_plane_init (&src_storage);
+  BablImage     *dst_img = reference_plane_init (&dst_storage);
 
   dst_img->type[0]  = (BablType *) babl_type_from_id (BABL_FLOAT);
   dst_img->pitch[0] =
@@ -570,8 +709,6 @@ convert_to_float (BablFormat *source_fmt,
         }
     }
   }
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
 
@@ -584,13 +721,10 @@ convert_from_float (BablFormat *source_fmt,
 {
   int        i;
 
-  BablImage *src_img;
-  BablImage *dst_img;
-
-  src_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
-  dst_img = (BablImage *) babl_image_new (
-    babl_component_from_id (BABL_GRAY_LINEAR), NULL, 1, 0, NULL);
+  ReferenceImage src_storage;
+  ReferenceImage dst_storage;
+  BablImage     *src_img = reference_plane_init (&src_storage);
+  BablImage     *dst_img = reference_plane_init (&dst_storage);
 
   src_img->type[0]   = (BablType *) babl_type_from_id (BABL_FLOAT);
   src_img->pitch[0]  = (src_img->type[0]->bits / 8) * destination_fmt->model->components;
@@ -638,8 +772,6 @@ convert_from_float (BablFormat *source_fmt,
 
       dst_img->data[0] += dst_img->type[0]->bits / 8;
     }
-  babl_free (src_img);
-  babl_free (dst_img);
 }
 
 
@@ -648,19 +780,18 @@ static void
 process_same_model (const Babl  *babl,
                     const char *source,
                     char       *destination,
-                    long        n)
+                    long        n,
+                    double     *scratch,
+                    void       *data)
 {
   const void *type_float = babl_type_from_id (BABL_FLOAT);
-#define MAX(a, b) ((a) > (b) ? (a) : (b))
 
   if ((babl->fish.source->format.type[0]->bits < 32 ||
        babl->fish.source->format.type[0] == type_float) &&
       (babl->fish.destination->format.type[0]->bits < 32 ||
        babl->fish.destination->format.type[0] == type_float))
   {
-     void *float_buf = babl_malloc (sizeof (float) * n *
-                            MAX (BABL (babl->fish.source)->format.model->components,
-                                 BABL (babl->fish.source)->format.components));
+     void *float_buf = scratch;
     if (compatible_components ((void*)babl->fish.source,
                                (void*)babl->fish.destination))
     {
@@ -691,14 +822,10 @@ process_same_model (const Babl  *babl,
           (char *) destination,
           n);
     }
-    babl_free (float_buf);
   }
   else
   {
-     void *double_buf = babl_malloc (sizeof (double) * n *
-                            MAX (BABL (babl->fish.source)->format.model->components,
-                                 BABL (babl->fish.source)->format.components));
-#undef MAX
+     void *double_buf = scratch;
     if (compatible_components ((void*)babl->fish.source,
                                (void*)babl->fish.destination))
     {
@@ -728,7 +855,6 @@ process_same_model (const Babl  *babl,
           (char *) destination,
           n);
     }
-    babl_free (double_buf);
   }
 }
 
@@ -744,6 +870,7 @@ babl_fish_reference_process_double (const Babl *babl,
                                     const char *source,
                                     char       *destination,
                                     long        n,
+                                    double     *scratch,
                                     void       *data)
 {
   Kind  source_kind             = KIND_RGB;
@@ -752,16 +879,20 @@ babl_fish_reference_process_double (const Babl *babl,
   Babl *rgba_image              = NULL;
   Babl *cmyka_image             = NULL;
   Babl *destination_image       = NULL;
+  ReferenceImage source_storage;
+  ReferenceImage rgba_storage;
+  ReferenceImage cmyka_storage;
+  ReferenceImage destination_storage;
 
-
-
-  void *source_double_buf_alloc = NULL;
+  /* the scratch area is split up among the intermediate buffers */
+  void *source_double_buf_alloc = scratch;
   void *source_double_buf       = NULL;
-  void *rgba_double_buf_alloc   = NULL;
+  void *rgba_double_buf_alloc   = (double *) source_double_buf_alloc +
+                                  n * babl->fish.source->format.model->components;
   void *rgba_double_buf         = NULL;
-  void *cmyka_double_buf_alloc  = NULL;
+  void *cmyka_double_buf_alloc  = (double *) rgba_double_buf_alloc + n * 4;
   void *cmyka_double_buf        = NULL;
-  void *destination_double_buf_alloc = NULL;
+  void *destination_double_buf_alloc = (double *) cmyka_double_buf_alloc + n * 5;
   void *destination_double_buf;
   const void *type_double  = babl_type_from_id (BABL_DOUBLE);
 
@@ -782,16 +913,14 @@ babl_fish_reference_process_double (const Babl *babl,
       BABL(babl->fish.source)->format.model->components)
   {
     source_double_buf = (void*)source;
-    source_image = babl_image_from_linear (
+    source_image = reference_image_from_linear (&source_storage,
        source_double_buf, BABL (BABL ((babl->fish.source))->format.model));
   }
   else
   {
-    source_double_buf =
-    source_double_buf_alloc = babl_malloc (sizeof (double) * n *
-                                BABL (babl->fish.source)->format.model->components);
+    source_double_buf = source_double_buf_alloc;
 
-    source_image = babl_image_from_linear (
+    source_image = reference_image_from_linear (&source_storage,
       source_double_buf, BABL (BABL ((babl->fish.source))->format.model));
     convert_to_double (
       (BablFormat *) BABL (babl->fish.source),
@@ -801,7 +930,6 @@ babl_fish_reference_process_double (const Babl *babl,
     );
   }
 
-  babl_mutex_lock (babl_reference_mutex);
   switch (source_kind)
   {
     case KIND_RGB:
@@ -811,10 +939,9 @@ babl_fish_reference_process_double (const Babl *babl,
        babl_remodel_with_space (babl_model_from_id (BABL_RGBA),
                          source_space));
 
-       rgba_double_buf       =
-       rgba_double_buf_alloc = babl_malloc (sizeof (double) * n * 4);
+       rgba_double_buf       = rgba_double_buf_alloc;
 
-       rgba_image = babl_image_from_linear (
+       rgba_image = reference_image_from_linear (&rgba_storage,
           rgba_double_buf, babl_remodel_with_space (babl_model_from_id (BABL_RGBA), source_space));
 
        if (conv->class_type == BABL_CONVERSION_PLANAR)
@@ -833,7 +960,7 @@ babl_fish_reference_process_double (const Babl *babl,
       if (babl_model_is ((void*)babl->fish.source->format.model, "cmykA"))
       {
         cmyka_double_buf = source_double_buf;
-        cmyka_image = babl_image_from_linear (cmyka_double_buf,
+        cmyka_image = reference_image_from_linear (&cmyka_storage, cmyka_double_buf,
                                 (void*)babl->fish.source->format.model);
       }
       else
@@ -843,10 +970,9 @@ babl_fish_reference_process_double (const Babl *babl,
                    babl_remodel_with_space (babl_model ("cmykA"),
                          source_space));
 
-        cmyka_double_buf       =
-        cmyka_double_buf_alloc = babl_malloc (sizeof (double) * n * 5);
+        cmyka_double_buf       = cmyka_double_buf_alloc;
 
-        cmyka_image = babl_image_from_linear (
+        cmyka_image = reference_image_from_linear (&cmyka_storage,
           cmyka_double_buf, babl_remodel_with_space (babl_model ("cmykA"),
           source_space));
 
@@ -882,9 +1008,8 @@ babl_fish_reference_process_double (const Babl *babl,
   else if (source_kind      == KIND_RGB &&
            destination_kind == KIND_CMYK)
   {
-    cmyka_double_buf        =
-    cmyka_double_buf_alloc  = babl_malloc (sizeof (double) * n * 5);
-    cmyka_image = babl_image_from_linear (
+    cmyka_double_buf        = cmyka_double_buf_alloc;
+    cmyka_image = reference_image_from_linear (&cmyka_storage,
         cmyka_double_buf, babl_remodel_with_space (babl_model ("cmykA"),
         destination_space));
 
@@ -948,9 +1073,8 @@ babl_fish_reference_process_double (const Babl *babl,
           destination_kind == KIND_RGB)
  {
     /* */
-    rgba_double_buf_alloc  = babl_malloc (sizeof (double) * n * 4);
     rgba_double_buf        = rgba_double_buf_alloc;
-    rgba_image = babl_image_from_linear (
+    rgba_image = reference_image_from_linear (&rgba_storage,
         rgba_double_buf, babl_remodel_with_space (babl_model_from_id (BABL_RGBA),
         destination_space));
 
@@ -1035,6 +1159,8 @@ babl_fish_reference_process_double (const Babl *babl,
 
      int cmyk_cmyk_no;
       double *cmyka = cmyka_double_buf;
+     /* only the lookup of the shared transform is serialized, not its use */
+     babl_mutex_lock (babl_reference_mutex);
      for (cmyk_cmyk_no = 0; cmyk_cmyk_no < cmyk_cmyk_count; cmyk_cmyk_no++)
      {
        if (cmyk_cmyk_source[cmyk_cmyk_no] == source_space &&
@@ -1062,6 +1188,7 @@ babl_fish_reference_process_double (const Babl *babl,
 
        cmyk_cmyk_count ++;
      }
+     babl_mutex_unlock (babl_reference_mutex);
       for (int i = 0; i < n; i++)
       {
         cmyka[i * 5 + 0] = (1.0-cmyka[i * 5 + 0])*100.0;
@@ -1101,12 +1228,10 @@ babl_fish_reference_process_double (const Babl *babl,
           Babl *conv =
             assert_conversion_find (destination_cmyka_format,
                              BABL (babl->fish.destination)->format.model);
-          destination_double_buf =
-          destination_double_buf_alloc = babl_malloc (sizeof (double) * n *
-                                          BABL (babl->fish.destination)->format.model->components);
+          destination_double_buf = destination_double_buf_alloc;
           if (conv->class_type == BABL_CONVERSION_PLANAR)
           {
-            destination_image = babl_image_from_linear (
+            destination_image = reference_image_from_linear (&destination_storage,
               destination_double_buf, BABL (BABL ((babl->fish.destination))->format.model));
             babl_conversion_process (conv,
               (void*)cmyka_image, (void*)destination_image, n);
@@ -1138,13 +1263,11 @@ babl_fish_reference_process_double (const Babl *babl,
         Babl *conv =
           assert_conversion_find (destination_rgba_format,
              BABL (babl->fish.destination)->format.model);
-           destination_double_buf_alloc = babl_malloc (sizeof (double) * n *
-                                            BABL (babl->fish.destination)->format.model->components);
            destination_double_buf = destination_double_buf_alloc;
 
         if (conv->class_type == BABL_CONVERSION_PLANAR)
           {
-            destination_image = babl_image_from_linear (
+            destination_image = reference_image_from_linear (&destination_storage,
               destination_double_buf, BABL (BABL ((babl->fish.destination))->format.model));
             babl_conversion_process (
               conv,
@@ -1166,7 +1289,6 @@ babl_fish_reference_process_double (const Babl *babl,
      }
    break;
   }
-  babl_mutex_unlock (babl_reference_mutex);
 
  /* convert from double model backing target pixel format to final representation */
   convert_from_double (
@@ -1176,99 +1298,45 @@ babl_fish_reference_process_double (const Babl *babl,
     destination,
     n
   );
-
-  if (destination_double_buf_alloc)
-    babl_free (destination_double_buf_alloc);
-  if (rgba_double_buf_alloc)
-    babl_free (rgba_double_buf_alloc);
-  if (cmyka_double_buf_alloc)
-    babl_free (cmyka_double_buf_alloc);
-  if (source_double_buf_alloc)
-    babl_free (source_double_buf_alloc);
-  if (source_image)
-    babl_free (source_image);
-  if (rgba_image)
-    babl_free (rgba_image);
-  if (cmyka_image)
-    babl_free (cmyka_image);
-  if (destination_image)
-    babl_free (destination_image);
 }
 
+/* the float conversions and formats used by the single precision code path,
+ * looked up once per call rather than for every chunk */
+typedef struct
+{
+  const Babl *source_float_format;
+  const Babl *source_rgba_format;
+  const Babl *destination_float_format;
+  Babl       *conv_to_rgba;
+  Babl       *conv_from_rgba;
+  int         destination_is_rgba;
+} ReferenceFloat;
+
 static void
-babl_fish_reference_process_float (const Babl *babl,
-                                   const char *source,
-                                   char       *destination,
-                                   long        n,
-                                   void       *data)
+babl_fish_reference_process_float_chunk (const Babl *babl,
+                                         const char *source,
+                                         char       *destination,
+                                         long        n,
+                                         double     *scratch,
+                                         void       *data)
 {
-  const void *type_float = babl_type_from_id (BABL_FLOAT);
+    ReferenceFloat *rf = data;
     Babl *source_image = NULL;
     Babl *rgba_image = NULL;
     Babl *destination_image = NULL;
-    void *source_float_buf_alloc = NULL;
+    ReferenceImage source_storage;
+    ReferenceImage rgba_storage;
+    ReferenceImage destination_storage;
     void *source_float_buf;
-    void *rgba_float_buf_alloc = NULL;
     void *rgba_float_buf;
-    void *destination_float_buf_alloc = NULL;
     void *destination_float_buf;
-    const Babl *destination_float_format;
-    Babl *conv_to_rgba;
-    Babl *conv_from_rgba;
-    char dst_name[256];
-
-
-    {
-    char src_name[256];
-    snprintf (src_name, sizeof(src_name), "%s float", babl_get_name((void*)babl->fish.source->format.model));
-    conv_to_rgba =
-        babl_conversion_find (
-        babl_format_with_space (src_name,
-                   BABL (BABL ((babl->fish.source))->format.space)),
-        babl_format_with_space ("RGBA float",
-                   BABL (BABL ((babl->fish.source))->format.space)));
-    }
-    {
-      snprintf (dst_name, sizeof(dst_name), "%s float", babl_get_name((void*)babl->fish.destination->format.model));
-      destination_float_format =
-        babl_format_with_space (dst_name,
-                   BABL (BABL ((babl->fish.destination))->format.space));
-      conv_from_rgba  =
-        babl_conversion_find (
-        babl_format_with_space ("RGBA float",
-                   BABL (BABL ((babl->fish.destination))->format.space)),
-                   destination_float_format);
-    }
 
-    if (!conv_to_rgba || !conv_from_rgba)
-    {
-      /* needed float conversions not found, using double code path instead */
-      babl_fish_reference_process_double (babl, source, destination, n, data);
-      return;
-    }
-
-    babl_mutex_lock (babl_reference_mutex);
-    if (babl->fish.source->format.type[0] == type_float &&
-        BABL(babl->fish.source)->format.components ==
-        BABL(babl->fish.source)->format.model->components && 0)
-    {
-      source_float_buf = (void*)source;
-      source_image = babl_image_from_linear (
-         source_float_buf,
-         babl_format_with_model_as_type ((void*)((babl->fish.source))->format.model,
-         type_float));
-    }
-    else
     {
       /* the +1 is to mask a valgrind 'invalid read of size 16' false positive  */
-      source_float_buf_alloc = babl_malloc (sizeof (float) * (n+1) *
-                                  (BABL (babl->fish.source)->format.model->components));
+      source_float_buf = scratch;
 
-      source_float_buf = source_float_buf_alloc;
-      source_image = babl_image_from_linear (
-        source_float_buf,
-      babl_format_with_model_as_type (BABL(BABL ((babl->fish.source))->format.model),
-         type_float));
+      source_image = reference_image_from_linear (&source_storage,
+        source_float_buf, rf->source_float_format);
       convert_to_float (
         (BablFormat *) BABL (babl->fish.source),
         source,
@@ -1277,40 +1345,29 @@ babl_fish_reference_process_float (const Babl *babl,
       );
     }
 
-    if (babl_model_is ((void*)babl->fish.source->format.model, "RGBA") && 0)
     {
-      rgba_float_buf = source_float_buf;
-      rgba_image = babl_image_from_linear (
-          rgba_float_buf,
-          (void*)babl->fish.source->format.model);
-    }
-    else
-    {
-      rgba_float_buf_alloc  = babl_malloc (sizeof (float) * n * 4);
-      rgba_float_buf        = rgba_float_buf_alloc;
+      rgba_float_buf        = (float *) source_float_buf + (n+1) *
+                              BABL (babl->fish.source)->format.model->components;
 
-      rgba_image = babl_image_from_linear (
-          rgba_float_buf,
-        babl_format_with_space ("RGBA float",
-                   BABL (BABL ((babl->fish.source))->format.space)));
+      rgba_image = reference_image_from_linear (&rgba_storage,
+          rgba_float_buf, rf->source_rgba_format);
 
 
-    if (conv_to_rgba->class_type == BABL_CONVERSION_PLANAR)
+    if (rf->conv_to_rgba->class_type == BABL_CONVERSION_PLANAR)
       {
         babl_conversion_process (
-          conv_to_rgba,
+          rf->conv_to_rgba,
           (void*)source_image, (void*)rgba_image,
           n);
       }
-    else if (conv_to_rgba->class_type == BABL_CONVERSION_LINEAR)
+    else if (rf->conv_to_rgba->class_type == BABL_CONVERSION_LINEAR)
       {
         babl_conversion_process (
-          conv_to_rgba,
+          rf->conv_to_rgba,
           source_float_buf, rgba_float_buf,
           n);
       }
     }
-    babl_mutex_unlock (babl_reference_mutex);
 
     if (((babl->fish.source)->format.space !=
         ((babl->fish.destination)->format.space)))
@@ -1326,31 +1383,26 @@ babl_fish_reference_process_float (const Babl *babl,
     }
 
     {
-      if(babl_format_with_space ("RGBA float",
-                   BABL (BABL ((babl->fish.destination))->format.space)) ==
-         babl_format_with_space (dst_name,
-                   BABL (BABL ((babl->fish.destination))->format.space)))
+      if (rf->destination_is_rgba)
       {
         destination_float_buf = rgba_float_buf;
       }
       else
       {
-        destination_float_buf_alloc = babl_malloc (sizeof (float) * n *
-                                        BABL (babl->fish.destination)->format.model->components);
-        destination_float_buf = destination_float_buf_alloc;
+        destination_float_buf = (float *) rgba_float_buf + n * 4;
 
-        if (conv_from_rgba->class_type == BABL_CONVERSION_PLANAR)
+        if (rf->conv_from_rgba->class_type == BABL_CONVERSION_PLANAR)
         {
-           destination_image = babl_image_from_linear (
-             destination_float_buf, destination_float_format);
+           destination_image = reference_image_from_linear (&destination_storage,
+             destination_float_buf, rf->destination_float_format);
              babl_conversion_process (
-               conv_from_rgba,
+               rf->conv_from_rgba,
                (void*)rgba_image, (void*)destination_image,
              n);
         }
-        else if (conv_from_rgba->class_type == BABL_CONVERSION_LINEAR)
+        else if (rf->conv_from_rgba->class_type == BABL_CONVERSION_LINEAR)
         {
-          babl_conversion_process (conv_from_rgba, rgba_float_buf,
+          babl_conversion_process (rf->conv_from_rgba, rgba_float_buf,
                                    destination_float_buf, n);
         }
       }
@@ -1363,19 +1415,62 @@ babl_fish_reference_process_float (const Babl *babl,
       destination,
       n
     );
+}
+
+static void
+babl_fish_reference_process_float (const Babl *babl,
+                                   const char *source,
+                                   char       *destination,
+                                   long        n,
+                                   double     *scratch)
+{
+  const void *type_float = babl_type_from_id (BABL_FLOAT);
+    ReferenceFloat rf;
+    char dst_name[256];
+
+
+    {
+    char src_name[256];
+    snprintf (src_name, sizeof(src_name), "%s float", babl_get_name((void*)babl->fish.source->format.model));
+    rf.source_rgba_format =
+        babl_format_with_space ("RGBA float",
+                   BABL (BABL ((babl->fish.source))->format.space));
+    rf.conv_to_rgba =
+        babl_conversion_find (
+        babl_format_with_space (src_name,
+                   BABL (BABL ((babl->fish.source))->format.space)),
+        rf.source_rgba_format);
+    }
+    {
+      snprintf (dst_name, sizeof(dst_name), "%s float", babl_get_name((void*)babl->fish.destination->format.model));
+      rf.destination_float_format =
+        babl_format_with_space (dst_name,
+                   BABL (BABL ((babl->fish.destination))->format.space));
+      rf.conv_from_rgba  =
+        babl_conversion_find (
+        babl_format_with_space ("RGBA float",
+                   BABL (BABL ((babl->fish.destination))->format.space)),
+                   rf.destination_float_format);
+      rf.destination_is_rgba =
+        babl_format_with_space ("RGBA float",
+                   BABL (BABL ((babl->fish.destination))->format.space)) ==
+        rf.destination_float_format;
+    }
+
+    if (!rf.conv_to_rgba || !rf.conv_from_rgba)
+    {
+      /* needed float conversions not found, using double code path instead */
+      reference_process_chunked (babl, source, destination, n, scratch,
+                                 babl_fish_reference_process_double, NULL);
+      return;
+    }
+
+    rf.source_float_format =
+      babl_format_with_model_as_type (BABL(BABL ((babl->fish.source))->format.model),
+         type_float);
 
-    if (destination_float_buf_alloc)
-      babl_free (destination_float_buf_alloc);
-    if (rgba_float_buf_alloc)
-      babl_free (rgba_float_buf_alloc);
-    if (source_float_buf_alloc)
-      babl_free (source_float_buf_alloc);
-    if (source_image)
-      babl_free (source_image);
-    if (rgba_image)
-      babl_free (rgba_image);
-    if (destination_image)
-      babl_free (destination_image);
+    reference_process_chunked (babl, source, destination, n, scratch,
+                               babl_fish_reference_process_float_chunk, &rf);
 }
 
 void
@@ -1387,6 +1482,7 @@ babl_fish_reference_process (const Babl *babl,
 {
   static const void *type_float = NULL;
   static int allow_float_reference = -1;
+  double scratch[BABL_REFERENCE_SCRATCH];
 #ifdef _UCRT
   char *env = NULL;
 #endif
@@ -1408,21 +1504,24 @@ babl_fish_reference_process (const Babl *babl,
        BABL (babl->fish.destination)->format.space)
       )
   {
-    process_same_model (babl, source, destination, n);
+    reference_process_chunked (babl, source, destination, n, scratch,
+                               process_same_model, NULL);
     return;
   }
 
   /* we're converting to a n_component format - special case   */
   if (babl_format_is_format_n (BABL (babl->fish.destination)))
   {
-    process_to_n_component (babl, source, destination, n);
+    reference_process_chunked (babl, source, destination, n, scratch,
+                               process_to_n_component, NULL);
     return;
   }
 
   if (format_has_cmyk_model (babl->fish.source) ||
       format_has_cmyk_model (babl->fish.destination))
   {
-    babl_fish_reference_process_double (babl, source, destination, n, data);
+    reference_process_chunked (babl, source, destination, n, scratch,
+                               babl_fish_reference_process_double, NULL);
     return;
   }
 
@@ -1457,11 +1556,12 @@ babl_fish_reference_process (const Babl *babl,
       !babl_format_is_palette (babl->fish.source) &&
       !babl_format_is_palette (babl->fish.destination))
   {
-    babl_fish_reference_process_float (babl, source, destination, n, data);
+    babl_fish_reference_process_float (babl, source, destination, n, scratch);
   }
   else /*   double  */
   {
-    babl_fish_reference_process_double (babl, source, destination, n, data);
+    reference_process_chunked (babl, source, destination, n, scratch,
+                               babl_fish_reference_process_double, NULL);
   }
 
 }
@@ -21,9 +21,54 @@
 #include "babl-internal.h"
 #include "babl-db.h"
 #include <stddef.h>
+#include <stdint.h>
 #include <string.h>
 #include <stdarg.h>
 
+#ifdef HAVE_STDATOMIC_H
+#include <stdatomic.h>
+#define BABL_ATOMIC _Atomic
+#define LOAD(ptr)         atomic_load_explicit (&(ptr), memory_order_acquire)
+#define STORE(ptr, value) atomic_store_explicit (&(ptr), value, memory_order_release)
+#define COUNT(counter)    atomic_fetch_add_explicit (&(counter), 1, memory_order_relaxed)
+#else
+#define BABL_ATOMIC volatile
+#define LOAD(ptr)         (ptr)
+#define STORE(ptr, value) ((ptr) = (value))
+#define COUNT(counter)    ((counter)++)
+#endif
+
+/* direct mapped cache of the fishes most recently returned by babl_fish (),
+ * checked before the fish database. A slot holds only the fish, the source
+ * and destination it was made for are validated against the fish itself,
+ * so a single atomic load gives a consistent entry.
+ */
+#define BABL_FISH_LOOKUP_CACHE_SIZE  256  /* must be a power of two */
+
+static const Babl *BABL_ATOMIC lookup_cache[BABL_FISH_LOOKUP_CACHE_SIZE];
+
+/* the same for babl_fast_fish (), where the slot also depends on the
+ * tolerance of the tier. The answer for a tier can be a fish that is not
+ * a path, and carries no tolerance, so slots point to entries holding the
+ * whole key. Entries are never changed once published, and are only freed
+ * by babl_fish_lookup_cache_clear ().
+ */
+typedef struct _BablFastFishEntry BablFastFishEntry;
+
+struct _BablFastFishEntry
+{
+  const Babl        *source;
+  const Babl        *destination;
+  double             tolerance;
+  const Babl        *fish;
+  BablFastFishEntry *next;  /* all entries, for finding and freeing them */
+};
+
+static BablFastFishEntry *BABL_ATOMIC fast_lookup_cache[BABL_FISH_LOOKUP_CACHE_SIZE];
+static BablFastFishEntry             *fast_entries = NULL;
+static long BABL_ATOMIC        lookup_hits   = 0;
+static long BABL_ATOMIC        lookup_misses = 0;
+
 typedef struct _BablFindFish BablFindFish;
 
 typedef struct _BablFindFish
@@ -64,6 +109,9 @@ find_fish_path (Babl *item,
         }
       else if (item->instance.class_type == BABL_FISH_PATH)
         {
+          /* made by babl_fast_fish () for a looser tolerance */
+          if (item->fish_path.tolerance != 0.0)
+            return 0;
           ffish->fish_path = item;
           ffish->fishes++;
         }
@@ -182,18 +230,30 @@ int
 babl_fish_get_id (const Babl *source,
                   const Babl *destination)
 {
-  /* value of 'id' will be used as argument for hash function,
-   * substraction serves as simple combination of
-   * source/destination values. */
-  int id = (((size_t)source * 93)) ^ ((size_t)destination);
+  /* value of 'id' will be used as argument for hash function, mix the full
+   * width of both pointers so that fishes for different pairs rarely share
+   * an id. */
+  uint64_t key = (uint64_t) (uintptr_t) source * 0x9e3779b97f4a7c15ull;
+  int      id;
+
+  key ^= (uint64_t) (uintptr_t) destination;
+  key ^= key >> 33;
+  key *= 0xff51afd7ed558ccdull;
+  key ^= key >> 33;
+  key *= 0xc4ceb9fe1a85ec53ull;
+  key ^= key >> 33;
+
+  id = key & 0x7fffffff;
   /* instances with id 0 won't be inserted into database */
-  id *= ((((size_t)  (destination))) % 37);
-
   if (id == 0)
     id = 1;
   return id;
 }
 
+static const Babl *
+babl_fish_lookup (const Babl *source_format,
+                  const Babl *destination_format);
+
 const Babl *
 babl_fish (const void *source,
            const void *destination)
@@ -228,6 +288,31 @@ babl_fish (const void *source,
       return NULL;
     }
 
+  {
+    int         slot = babl_fish_get_id (source_format, destination_format) &
+                       (BABL_FISH_LOOKUP_CACHE_SIZE - 1);
+    const Babl *fish = LOAD (lookup_cache[slot]);
+
+    if (fish &&
+        fish->fish.source == source_format &&
+        fish->fish.destination == destination_format)
+      {
+        COUNT (lookup_hits);
+        return fish;
+      }
+
+    COUNT (lookup_misses);
+    fish = babl_fish_lookup (source_format, destination_format);
+    if (fish)
+      STORE (lookup_cache[slot], fish);
+    return fish;
+  }
+}
+
+static const Babl *
+babl_fish_lookup (const Babl *source_format,
+                  const Babl *destination_format)
+{
   {
     int            hashval;
     BablHashTable *id_htable;
@@ -292,6 +377,19 @@ babl_fish (const void *source,
           }
         }
 
+        if (!ffish.fish_fish)
+          {
+            /* the pair might have been cached by an earlier run */
+            Babl *cached = babl_fish_cache_lookup (source_format, destination_format, 0.0);
+
+            if (cached && cached->class_type == BABL_FISH_PATH)
+              {
+                babl_mutex_unlock (babl_fish_mutex);
+                return cached;
+              }
+            ffish.fish_fish = cached;
+          }
+
         if (!ffish.fish_fish)
           {
             const Babl *src_space = (void*)source_format->format.space;
@@ -330,6 +428,7 @@ babl_fish (const void *source,
                     fish->fish.source               = source_format;
                     fish->fish.destination          = destination_format;
                     babl_db_insert (babl_fish_db (), fish);
+                    babl_fish_cache_add (fish);
                   }
 #endif
                 }
@@ -364,6 +463,152 @@ babl_fish (const void *source,
   }
 }
 
+void
+babl_fish_get_lookup_stats (long *hits,
+                            long *misses)
+{
+  if (hits)
+    *hits = LOAD (lookup_hits);
+  if (misses)
+    *misses = LOAD (lookup_misses);
+}
+
+void
+babl_fish_lookup_cache_clear (void)
+{
+  int i;
+
+  for (i = 0; i < BABL_FISH_LOOKUP_CACHE_SIZE; i++)
+    {
+      STORE (lookup_cache[i], NULL);
+      STORE (fast_lookup_cache[i], NULL);
+    }
+  STORE (lookup_hits, 0);
+  STORE (lookup_misses, 0);
+
+  while (fast_entries)
+    {
+      BablFastFishEntry *next = fast_entries->next;
+
+      babl_free (fast_entries);
+      fast_entries = next;
+    }
+}
+
+/* the entry for a pair and tolerance, made once so that threads racing
+ * for the same slot store the same entry */
+static BablFastFishEntry *
+fast_fish_entry (const Babl *source,
+                 const Babl *destination,
+                 double      tolerance,
+                 const Babl *fish)
+{
+  BablFastFishEntry *entry;
+
+  babl_mutex_lock (babl_fish_mutex);
+  for (entry = fast_entries; entry; entry = entry->next)
+    if (entry->source == source &&
+        entry->destination == destination &&
+        entry->tolerance == tolerance)
+      break;
+
+  if (!entry)
+    {
+      entry = babl_malloc (sizeof (BablFastFishEntry));
+      entry->source      = source;
+      entry->destination = destination;
+      entry->tolerance   = tolerance;
+      entry->fish        = fish;
+      entry->next        = fast_entries;
+      fast_entries       = entry;
+    }
+  babl_mutex_unlock (babl_fish_mutex);
+  return entry;
+}
+
+static int
+fast_fish_slot (const Babl *source_format,
+                const Babl *destination_format,
+                double      tolerance)
+{
+  uint64_t bits;
+
+  memcpy (&bits, &tolerance, sizeof (bits));
+  bits *= 0x9e3779b97f4a7c15ull;
+  /* only the top bits of the product depend on all bits of the tolerance */
+  return (babl_fish_get_id (source_format, destination_format) ^
+          (int) (bits >> 56)) & (BABL_FISH_LOOKUP_CACHE_SIZE - 1);
+}
+
+const Babl *
+babl_fast_fish (const void *source_format,
+                const void *destination_format,
+                const char *performance)
+{
+  const Babl        *source      = NULL;
+  const Babl        *destination = NULL;
+  const Babl        *fish;
+  BablFastFishEntry *entry;
+  double             tolerance;
+  int                slot;
+
+  if (!performance || !strcmp (performance, "default"))
+    return babl_fish (source_format, destination_format);
+  else if (!strcmp (performance, "exact"))
+    tolerance = 0.0000000001;
+  else if (!strcmp (performance, "precise"))
+    tolerance = 0.00001;
+  else if (!strcmp (performance, "fast"))
+    tolerance = 0.001;
+  else if (!strcmp (performance, "glitch"))
+    tolerance = 0.01;
+  else
+    tolerance = babl_parse_double (performance);
+
+  if (!(tolerance > 0.0))
+    return babl_fish (source_format, destination_format);
+
+  babl_assert (source_format);
+  babl_assert (destination_format);
+
+  if (BABL_IS_BABL (source_format))
+    source = source_format;
+  else
+    source = babl_format ((char *) source_format);
+
+  if (BABL_IS_BABL (destination_format))
+    destination = destination_format;
+  else
+    destination = babl_format ((char *) destination_format);
+
+  if (!source || !destination)
+    {
+      babl_log ("args=(%p, %p) format invalid", source_format, destination_format);
+      return NULL;
+    }
+
+  slot = fast_fish_slot (source, destination, tolerance);
+  entry = LOAD (fast_lookup_cache[slot]);
+  if (entry &&
+      entry->source == source &&
+      entry->destination == destination &&
+      entry->tolerance == tolerance)
+    return entry->fish;
+
+  fish = babl_fish_path2 (source, destination, tolerance);
+  if (!fish || fish->class_type != BABL_FISH_PATH)
+    {
+      /* no path is good enough even for this tolerance, neither is there
+       * one for the default tolerance */
+      fish = babl_fish (source, destination);
+      if (!fish)
+        return NULL;
+    }
+
+  entry = fast_fish_entry (source, destination, tolerance, fish);
+  STORE (fast_lookup_cache[slot], entry);
+  return entry->fish;
+}
 
 BablFishProcess babl_fish_get_process (const Babl *babl)
 {
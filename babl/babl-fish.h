@@ -19,6 +19,14 @@
 #ifndef _BABL_FISH_H
 #define _BABL_FISH_H
 
+/* for the members of path fishes shared between the threads converting
+ * with a fish and the thread building its LUT, see babl-fish-path.c */
+#ifdef HAVE_STDATOMIC_H
+#include <stdatomic.h>
+#define BABL_FISH_ATOMIC _Atomic
+#else
+#define BABL_FISH_ATOMIC volatile
+#endif
 
 /****************************************************************/
 /* BablFish */
@@ -54,6 +62,18 @@ typedef struct
 } BablFishSimple;
 
 
+/* the pixel count of a path fish is spread over shards on separate cache
+ * lines, threads count into their own shard, see babl_fish_usage_add ()
+ */
+#define BABL_FISH_USAGE_SHARDS  8
+
+typedef struct
+{
+  long BABL_FISH_ATOMIC pixels;
+  int  BABL_FISH_ATOMIC lut_users;   /* threads currently reading the LUT */
+  char       pad[64 - sizeof (long) - sizeof (int)];
+} BablFishUsage;
+
 /* BablFishPath is a combination of registered conversions, both
  * from the reference types / model conversions, and optimized format to
  * format conversion.
@@ -70,9 +90,20 @@ typedef struct
   int        source_bpp;
   int        dest_bpp;
   unsigned int is_u8_color_conv:1; // keep track of count, and make 
-  uint32_t  *u8_lut;
+  uint32_t  *BABL_FISH_ATOMIC u8_lut;
+  struct _BablClut *BABL_FISH_ATOMIC u8_clut; /* compact 3D alternative to
+                                               * u8_lut */
+  int BABL_FISH_ATOMIC lut_pending; /* a LUT build has been queued */
+  int        lut_failures; /* failed LUT builds, each doubles the pixels
+                            * converted before the next try */
+  long       lut_size;    /* bytes held by u8_lut or u8_clut */
+  int        lut_mapped;  /* the table is mapped from the LUT store */
+  Babl      *lut_next;    /* next fish holding a LUT */
   long       last_lut_use;
+  double     tolerance;   /* of a babl_fast_fish (), 0.0 for babl_fish () */
   BablList  *conversion_list;
+  BablFishUsage usage[BABL_FISH_USAGE_SHARDS]; /* pixels not yet folded
+                                                * into fish.pixels */
 } BablFishPath;
 
 /* BablFishReference
@@ -16,99 +16,125 @@
  * <https://www.gnu.org/licenses/>.
  */
 
-/* Implementation of hash table data structure based on coalesced hashing.
+/* Implementation of hash table data structure based on open addressing
+ * with linear probing.
  * Copyright (C) 2008, Jan Heller
  */
 
+/* Lookups do not take any locks, inserts are expected to be serialized by
+ * the caller (BablDb holds its mutex). Items are never moved or removed
+ * once inserted, an insert only fills an empty slot: the hash is written
+ * first and the item published with a release store. Growing the table
+ * builds a complete new table that replaces the old one with a single
+ * pointer store. Tables that have been replaced might still be in use by a
+ * concurrent lookup, they are kept around until the hash table itself is
+ * destroyed - since the table size doubles each time, they add up to less
+ * than the size of the current table.
+ */
+
 #include "config.h"
+#include <stdint.h>
 #include "babl-internal.h"
 
+#ifdef HAVE_STDATOMIC_H
+#include <stdatomic.h>
+#define BABL_ATOMIC _Atomic
+#define LOAD(ptr)         atomic_load_explicit (&(ptr), memory_order_acquire)
+#define STORE(ptr, value) atomic_store_explicit (&(ptr), value, memory_order_release)
+#else
+#define BABL_ATOMIC volatile
+#define LOAD(ptr)         (ptr)
+#define STORE(ptr, value) ((ptr) = (value))
+#endif
+
 #define BABL_HASH_TABLE_INITIAL_MASK   0x1FF  /* 511 */
 
-/* static functions declarations */
-static inline int
-hash_insert (BablHashTable *htab,
-             Babl          *item);
+typedef struct _BablHashTableData BablHashTableData;
 
-static void
-hash_rehash (BablHashTable *htab);
+struct _BablHashTableData
+{
+  Babl *BABL_ATOMIC  *items;
+  uint32_t           *hashes;   /* full hash of the item in each slot */
+  int                 mask;
+  BablHashTableData  *retired;  /* the table this one replaced */
+};
 
-static inline int
-hash_insert (BablHashTable *htab,
-             Babl          *item)
+struct _BablHashTable
+{
+  BablHashTableData *BABL_ATOMIC data;
+  int                  count;
+  BablHashValFunction  hash_func;
+  BablHashFindFunction find_func;
+};
+
+static BablHashTableData *
+hash_data_new (int mask)
 {
-  int hash = htab->hash_func(htab, item);
+  BablHashTableData *data = babl_calloc (sizeof (BablHashTableData), 1);
 
-  if (htab->data_table[hash] == NULL)
-    {
-      /* create new chain */
-      htab->data_table[hash] = item;
-    }
-  else
-    {
-      int it, oit, cursor = 0;
+  data->mask   = mask;
+  data->items  = babl_calloc (sizeof (Babl *), mask + 1);
+  data->hashes = babl_calloc (sizeof (uint32_t), mask + 1);
 
-      while ((cursor < (htab->mask + 1)) && (htab->data_table[cursor] != NULL))
-        ++cursor;
+  return data;
+}
 
-      htab->data_table[cursor] = item;
+static inline void
+hash_insert (BablHashTableData *data,
+             uint32_t           hash,
+             Babl              *item)
+{
+  int slot;
 
-      for (oit = hash, it = htab->chain_table[oit]; it != -1; oit = it, it = htab->chain_table[oit])
-        ;
-      htab->chain_table[oit] = cursor;
-    }
+  for (slot = hash & data->mask;
+       data->items[slot];
+       slot = (slot + 1) & data->mask);
 
-  htab->count++;
-  return 0;
+  /* the hash is in place before the item becomes visible */
+  data->hashes[slot] = hash;
+  STORE (data->items[slot], item);
 }
 
 static void
 hash_rehash (BablHashTable *htab)
 {
-  Babl *item;
+  BablHashTableData *data = htab->data;
+  BablHashTableData *ndata = hash_data_new ((data->mask << 1) + 1);
   int  i;
-  BablHashTable *nhtab = babl_calloc (sizeof (BablHashTable), 1);
-
-  nhtab->data_table = NULL;
-  nhtab->chain_table = NULL;
-  nhtab->mask = (htab->mask << 1) + 1;
-  nhtab->count = 0;
-  nhtab->hash_func = htab->hash_func;
-  nhtab->find_func = htab->find_func;
-  if (nhtab->mask)
-    {
-      nhtab->data_table = babl_calloc (sizeof (BablInstance *), babl_hash_table_size(nhtab));
-      nhtab->chain_table = babl_malloc (sizeof (int) * babl_hash_table_size(nhtab));
-      memset (nhtab->chain_table, -1, sizeof (int) * babl_hash_table_size(nhtab));
-    }
 
-  for (i = 0; i < babl_hash_table_size (htab); i++)
+  for (i = 0; i <= data->mask; i++)
     {
-      item = htab->data_table[i];
-      babl_hash_table_insert (nhtab, item);
+      Babl *item = data->items[i];
+      if (item)
+        hash_insert (ndata, data->hashes[i], item);
     }
 
-  htab->mask = nhtab->mask;
-  babl_free (htab->data_table);
-  babl_free (htab->chain_table);
-  htab->data_table = nhtab->data_table;
-  htab->chain_table = nhtab->chain_table;
-  babl_free (nhtab);
+  ndata->retired = data;
+  STORE (htab->data, ndata);
 }
 
 int
 babl_hash_table_size (BablHashTable *htab)
 {
-    return htab->mask + 1;
+    return LOAD (htab->data)->mask + 1;
 }
 
 
 static int
 babl_hash_table_destroy (void *data)
 {
-  BablHashTable *htab = data;
-  babl_free (htab->data_table);
-  babl_free (htab->chain_table);
+  BablHashTable     *htab = data;
+  BablHashTableData *hdata = htab->data;
+
+  while (hdata)
+    {
+      BablHashTableData *retired = hdata->retired;
+
+      babl_free ((void *) hdata->items);
+      babl_free (hdata->hashes);
+      babl_free (hdata);
+      hdata = retired;
+    }
   return 0;
 }
 
@@ -125,18 +151,10 @@ babl_hash_table_init (BablHashValFunction  hfunc,
   htab = babl_calloc (sizeof (BablHashTable), 1);
   babl_set_destructor (htab, babl_hash_table_destroy);
 
-  htab->data_table = NULL;
-  htab->chain_table = NULL;
-  htab->mask = BABL_HASH_TABLE_INITIAL_MASK;
+  htab->data = hash_data_new (BABL_HASH_TABLE_INITIAL_MASK);
   htab->count = 0;
   htab->hash_func = hfunc;
   htab->find_func = ffunc;
-  if (htab->mask)
-  {
-      htab->data_table = babl_calloc (sizeof (BablInstance *), babl_hash_table_size(htab));
-      htab->chain_table = babl_malloc (sizeof (int) * babl_hash_table_size(htab));
-      memset (htab->chain_table, -1, sizeof (int) * babl_hash_table_size(htab));
-  }
 
   return htab;
 }
@@ -148,9 +166,12 @@ babl_hash_table_insert (BablHashTable *htab,
   babl_assert (htab);
   babl_assert (BABL_IS_BABL(item));
 
-  if (babl_hash_table_size (htab) < htab->count + 1)
+  /* keep the table at most half full, so probe sequences stay short */
+  if (babl_hash_table_size (htab) < (htab->count + 1) * 2)
     hash_rehash (htab);
-  return hash_insert (htab, item);
+  hash_insert (htab->data, htab->hash_func (htab, item), item);
+  htab->count++;
+  return 0;
 }
 
 Babl *
@@ -159,32 +180,24 @@ babl_hash_table_find (BablHashTable       *htab,
                       BablHashFindFunction find_func,
                       void                *data)
 {
-  int  it;
+  BablHashTableData *hdata;
+  int  slot;
   Babl *item;
 
   babl_assert (htab);
 
-  it = hash;
-  item = htab->data_table[it];
-
-  if (!item)
-    return NULL;
+  if (!find_func)
+    find_func = htab->find_func;
 
-  for (;;)
+  hdata = LOAD (htab->data);
+  for (slot = hash & hdata->mask;
+       (item = LOAD (hdata->items[slot]));
+       slot = (slot + 1) & hdata->mask)
     {
-      if (find_func)
-        {
-          if (find_func (item, data))
-            return item;
-        }
-      else if (htab->find_func (item, data))
+      if (hdata->hashes[slot] == (uint32_t) hash &&
+          find_func (item, data))
         return item;
-      it = htab->chain_table[it];
-      if (it == -1)
-        break;
-      item = htab->data_table[it];
     }
 
   return NULL;
 }
-
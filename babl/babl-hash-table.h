@@ -26,19 +26,11 @@
 
 typedef struct _BablHashTable BablHashTable;
 
+/* hash functions return the full hash value, the table reduces it to its
+ * current size */
 typedef int  (*BablHashValFunction) (BablHashTable *htab, Babl *item);
 typedef int  (*BablHashFindFunction) (Babl *item, void *data);
 
-typedef struct _BablHashTable
-{
-  Babl                 **data_table;
-  int                  *chain_table;
-  int                  mask;
-  int                  count;
-  BablHashValFunction  hash_func;
-  BablHashFindFunction find_func;
-} _BablHashTable;
-
 
 BablHashTable *
 babl_hash_table_init (BablHashValFunction  hfunc,
@@ -91,6 +91,7 @@ BablMutex *babl_debug_mutex;
 BablMutex *babl_reference_mutex;
 BablMutex *babl_space_mutex;
 BablMutex *babl_remodel_mutex;
+BablMutex *babl_lut_mutex;
 
 void
 babl_internal_init (void)
@@ -102,6 +103,7 @@ babl_internal_init (void)
   babl_reference_mutex = babl_mutex_new ();
   babl_space_mutex = babl_mutex_new ();
   babl_remodel_mutex = babl_mutex_new ();
+  babl_lut_mutex = babl_mutex_new ();
 #if BABL_DEBUG_MEM
   babl_debug_mutex = babl_mutex_new ();
 #endif
@@ -113,6 +115,7 @@ babl_internal_destroy (void)
   babl_mutex_destroy (babl_fish_mutex);
   babl_mutex_destroy (babl_format_mutex);
   babl_mutex_destroy (babl_reference_mutex);
+  babl_mutex_destroy (babl_lut_mutex);
 #if BABL_DEBUG_MEM
   babl_mutex_destroy (babl_debug_mutex);
 #endif
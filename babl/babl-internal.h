@@ -52,6 +52,7 @@
 #include "babl-util.h"
 #include "babl-memory.h"
 #include "babl-mutex.h"
+#include "babl-parallel.h"
 #include "babl-cpuaccel.h"
 #include "babl-polynomial.h"
 
@@ -83,6 +84,9 @@ Babl   * babl_fish_reference            (const Babl     *source,
 Babl   * babl_fish_simple               (BablConversion *conversion);
 Babl   * babl_fish_path                 (const Babl     *source,
                                          const Babl     *destination);
+Babl   * babl_fish_path2                (const Babl     *source,
+                                         const Babl     *destination,
+                                         double          tolerance);
 
 int      babl_fish_get_id               (const Babl     *source,
                                          const Babl     *destination);
@@ -247,6 +251,7 @@ extern BablMutex *babl_fish_mutex;
 extern BablMutex *babl_reference_mutex;
 extern BablMutex *babl_space_mutex;
 extern BablMutex *babl_remodel_mutex;
+extern BablMutex *babl_lut_mutex;
 
 #define BABL_DEBUG_MEM 0
 #if BABL_DEBUG_MEM
@@ -357,6 +362,45 @@ _conversion_new (const char    *name,
 double _babl_legal_error (void);
 void babl_init_db (void);
 void babl_store_db (void);
+/* appends a newly created fish to the on-disk cache */
+void babl_fish_cache_add (Babl *fish);
+/* creates and registers the fish for a pair of formats and tolerance, 0.0
+ * for the default one, from the on-disk cache, if it has one; called with
+ * babl_fish_mutex held */
+Babl *babl_fish_cache_lookup (const Babl *source,
+                              const Babl *destination,
+                              double      tolerance);
+/* the LUT timings measured on the CPU identified by key, kept in the
+ * on-disk cache; load returns 0 if the cache does not have them */
+int   babl_lut_timings_load (const char  *key,
+                             float       *timings,
+                             int          n_timings);
+void  babl_lut_timings_save (const char  *key,
+                             const float *timings,
+                             int          n_timings);
+
+/* the kinds of tables kept in the on-disk LUT store */
+#define BABL_LUT_STORE_LUT   0
+#define BABL_LUT_STORE_CLUT  1
+
+/* maps the stored table of kind and size for a fish path, if the store is
+ * enabled and has it; release it with babl_lut_store_unmap ()
+ */
+void *babl_lut_store_load  (const Babl *fish,
+                            int         kind,
+                            long        size);
+void  babl_lut_store_unmap (void       *lut,
+                            long        size);
+/* writes a table to the LUT store, returns 1 on success */
+int   babl_lut_store_save  (const Babl *fish,
+                            int         kind,
+                            const void *lut,
+                            long        size);
+
+/* forget the fishes remembered by babl_fish (), needs to happen before
+ * they are freed.
+ */
+void babl_fish_lookup_cache_clear (void);
 int _babl_max_path_len (void);
 
 
@@ -384,7 +428,23 @@ const char *
 babl_conversion_create_name (Babl *source, Babl *destination, int type,
                              int allow_collision);
 
-extern void (*_babl_space_add_universal_rgb) (const Babl *space);
+extern void (*_babl_space_add_universal_rgb) (const Babl *space,
+                                              const Babl *other);
+
+/* source_bpp passed to babl_lut_apply for 4 byte premultiplied sources,
+ * that get un-premultiplied before the lookup.
+ */
+#define BPP_4ASSOCIATED   14
+
+/* applies a conversion LUT built by babl-fish-path.c to n pixels, returns
+ * 0 if the bpp pair has no LUT support.
+ */
+extern int (*babl_lut_apply) (const uint32_t *lut,
+                              int             source_bpp,
+                              int             dest_bpp,
+                              const void     *source,
+                              void           *destination,
+                              long            n);
 const Babl *
 babl_trc_formula_srgb (double gamma, double a, double b, double c, double d, double e, double f);
 const Babl *
@@ -85,3 +85,66 @@ babl_mutex_unlock (BablMutex *mutex)
   pthread_mutex_unlock (mutex);
 #endif
 }
+
+/* returns 1 if the lock was acquired, 0 if it is held elsewhere */
+int
+babl_mutex_trylock (BablMutex *mutex)
+{
+#ifdef _WIN32
+  return TryEnterCriticalSection (mutex) != 0;
+#else
+  return pthread_mutex_trylock (mutex) == 0;
+#endif
+}
+
+BablCond *
+babl_cond_new (void)
+{
+  BablCond *cond = malloc (sizeof (BablCond));
+#ifdef _WIN32
+  InitializeConditionVariable (cond);
+#else
+  pthread_cond_init (cond, NULL);
+#endif
+  return cond;
+}
+
+void
+babl_cond_destroy (BablCond *cond)
+{
+#ifndef _WIN32
+  pthread_cond_destroy (cond);
+#endif
+  free (cond);
+}
+
+void
+babl_cond_wait (BablCond  *cond,
+                BablMutex *mutex)
+{
+#ifdef _WIN32
+  SleepConditionVariableCS (cond, mutex, INFINITE);
+#else
+  pthread_cond_wait (cond, mutex);
+#endif
+}
+
+void
+babl_cond_signal (BablCond *cond)
+{
+#ifdef _WIN32
+  WakeConditionVariable (cond);
+#else
+  pthread_cond_signal (cond);
+#endif
+}
+
+void
+babl_cond_broadcast (BablCond *cond)
+{
+#ifdef _WIN32
+  WakeAllConditionVariable (cond);
+#else
+  pthread_cond_broadcast (cond);
+#endif
+}
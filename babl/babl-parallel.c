@@ -0,0 +1,389 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* A small thread pool used for splitting up large conversions. Work is
+ * handed out as numbered tasks that idle threads - including the thread
+ * that submitted the job - claim one at a time, so threads that finish
+ * early keep taking tasks until the job is done.
+ *
+ * Work that nobody waits for, like building LUTs, is queued for a single
+ * background thread instead, which is only started once there is something
+ * for it to do.
+ */
+
+#include "config.h"
+#include "babl-internal.h"
+
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+typedef struct BablParallelJob
+{
+  BablParallelTask  task;
+  void             *data;
+  int               n_tasks;
+  int               next_task; /* next task to be claimed */
+  int               pending;   /* tasks not yet completed */
+} BablParallelJob;
+
+static BablMutex       *pool_mutex   = NULL;
+static BablCond        *work_cond    = NULL;
+static BablCond        *done_cond    = NULL;
+static BablParallelJob *current_job  = NULL;
+static int              n_threads    = 1;
+static int              n_workers    = 0;
+static int              pool_quit    = 0;
+
+static BablExecutor     executor      = NULL;
+static void            *executor_data = NULL;
+
+#ifdef _WIN32
+static HANDLE           workers[BABL_MAX_THREADS];
+#else
+static pthread_t        workers[BABL_MAX_THREADS];
+#endif
+
+typedef struct BablBackgroundJob
+{
+  BablBackgroundFunc        func;
+  void                     *data;
+  struct BablBackgroundJob *next;
+} BablBackgroundJob;
+
+static BablCond          *background_cond    = NULL;
+static BablBackgroundJob *background_queue   = NULL;
+static BablBackgroundJob *background_last    = NULL;
+static int                background_running = 0;
+#ifdef _WIN32
+static HANDLE             background_thread;
+#else
+static pthread_t          background_thread;
+#endif
+
+static int
+default_n_threads (void)
+{
+#ifdef _WIN32
+  SYSTEM_INFO info;
+  GetSystemInfo (&info);
+  return info.dwNumberOfProcessors;
+#elif defined(_SC_NPROCESSORS_ONLN)
+  return sysconf (_SC_NPROCESSORS_ONLN);
+#else
+  return 1;
+#endif
+}
+
+/* must be called with pool_mutex held, returns with it held */
+static void
+run_tasks (BablParallelJob *job)
+{
+  while (job->next_task < job->n_tasks)
+    {
+      int task = job->next_task++;
+
+      babl_mutex_unlock (pool_mutex);
+      job->task (task, job->n_tasks, job->data);
+      babl_mutex_lock (pool_mutex);
+
+      if (--job->pending == 0)
+        babl_cond_broadcast (done_cond);
+    }
+}
+
+#ifdef _WIN32
+static unsigned __stdcall
+worker_main (void *data)
+#else
+static void *
+worker_main (void *data)
+#endif
+{
+  babl_mutex_lock (pool_mutex);
+  while (!pool_quit)
+    {
+      if (current_job && current_job->next_task < current_job->n_tasks)
+        run_tasks (current_job);
+      else
+        babl_cond_wait (work_cond, pool_mutex);
+    }
+  babl_mutex_unlock (pool_mutex);
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+#ifdef _WIN32
+static unsigned __stdcall
+background_main (void *data)
+#else
+static void *
+background_main (void *data)
+#endif
+{
+  babl_mutex_lock (pool_mutex);
+  while (!pool_quit)
+    {
+      BablBackgroundJob *job = background_queue;
+
+      if (job)
+        {
+          background_queue = job->next;
+          if (!background_queue)
+            background_last = NULL;
+
+          babl_mutex_unlock (pool_mutex);
+          job->func (job->data);
+          babl_free (job);
+          babl_mutex_lock (pool_mutex);
+        }
+      else
+        babl_cond_wait (background_cond, pool_mutex);
+    }
+  babl_mutex_unlock (pool_mutex);
+#ifdef _WIN32
+  return 0;
+#else
+  return NULL;
+#endif
+}
+
+/* spawn the worker threads the first time they are needed,
+ * must be called with pool_mutex held.
+ */
+static void
+ensure_workers (void)
+{
+  while (n_workers < n_threads - 1)
+    {
+#ifdef _WIN32
+      workers[n_workers] = (HANDLE) _beginthreadex (NULL, 0, worker_main,
+                                                    NULL, 0, NULL);
+      if (!workers[n_workers])
+        break;
+#else
+      if (pthread_create (&workers[n_workers], NULL, worker_main, NULL))
+        break;
+#endif
+      n_workers++;
+    }
+  /* if we failed to spawn threads, make do with those we got */
+  n_threads = n_workers + 1;
+}
+
+void
+babl_parallel_init (void)
+{
+  char *env = NULL;
+
+  pool_mutex = babl_mutex_new ();
+  work_cond  = babl_cond_new ();
+  done_cond  = babl_cond_new ();
+  background_cond = babl_cond_new ();
+  pool_quit  = 0;
+
+#ifndef _UCRT
+  env = getenv ("BABL_THREADS");
+#else
+  _dupenv_s (&env, NULL, "BABL_THREADS");
+#endif
+  if (env && env[0] != '\0')
+    n_threads = atoi (env);
+  else
+    n_threads = default_n_threads ();
+#ifdef _UCRT
+  free (env);
+#endif
+
+  if (n_threads > BABL_MAX_THREADS)
+    n_threads = BABL_MAX_THREADS;
+  else if (n_threads < 1)
+    n_threads = 1;
+}
+
+void
+babl_parallel_destroy (void)
+{
+  int i;
+
+  babl_mutex_lock (pool_mutex);
+  pool_quit = 1;
+  babl_cond_broadcast (work_cond);
+  babl_cond_broadcast (background_cond);
+  babl_mutex_unlock (pool_mutex);
+
+  /* the job being run is finished, those still queued are dropped */
+  if (background_running)
+    {
+#ifdef _WIN32
+      WaitForSingleObject (background_thread, INFINITE);
+      CloseHandle (background_thread);
+#else
+      pthread_join (background_thread, NULL);
+#endif
+      background_running = 0;
+    }
+  while (background_queue)
+    {
+      BablBackgroundJob *job = background_queue;
+
+      background_queue = job->next;
+      babl_free (job);
+    }
+  background_last = NULL;
+
+  for (i = 0; i < n_workers; i++)
+    {
+#ifdef _WIN32
+      WaitForSingleObject (workers[i], INFINITE);
+      CloseHandle (workers[i]);
+#else
+      pthread_join (workers[i], NULL);
+#endif
+    }
+  n_workers = 0;
+
+  babl_cond_destroy (work_cond);
+  babl_cond_destroy (done_cond);
+  babl_cond_destroy (background_cond);
+  babl_mutex_destroy (pool_mutex);
+  work_cond = done_cond = background_cond = NULL;
+  pool_mutex = NULL;
+}
+
+int
+babl_parallel_get_n_threads (void)
+{
+  return n_threads;
+}
+
+void
+babl_set_executor (BablExecutor  new_executor,
+                   void         *user_data)
+{
+  executor      = new_executor;
+  executor_data = user_data;
+}
+
+void
+babl_parallel_distribute (int               n_tasks,
+                          BablParallelTask  task,
+                          void             *data)
+{
+  BablParallelJob job;
+  int             i;
+
+  if (n_tasks <= 0)
+    return;
+
+  if (executor)
+    {
+      executor (task, n_tasks, data, executor_data);
+      return;
+    }
+
+  if (n_tasks == 1 || n_threads <= 1 || !pool_mutex)
+    {
+      for (i = 0; i < n_tasks; i++)
+        task (i, n_tasks, data);
+      return;
+    }
+
+  babl_mutex_lock (pool_mutex);
+  if (current_job)
+    {
+      /* the pool is busy with another job, possibly the one we are being
+       * called from, do the work on this thread instead of waiting.
+       */
+      babl_mutex_unlock (pool_mutex);
+      for (i = 0; i < n_tasks; i++)
+        task (i, n_tasks, data);
+      return;
+    }
+
+  ensure_workers ();
+
+  job.task      = task;
+  job.data      = data;
+  job.n_tasks   = n_tasks;
+  job.next_task = 0;
+  job.pending   = n_tasks;
+
+  current_job = &job;
+  babl_cond_broadcast (work_cond);
+
+  run_tasks (&job);
+  while (job.pending)
+    babl_cond_wait (done_cond, pool_mutex);
+
+  current_job = NULL;
+  babl_mutex_unlock (pool_mutex);
+}
+
+int
+babl_parallel_background (BablBackgroundFunc  func,
+                          void               *data)
+{
+  BablBackgroundJob *job;
+
+  if (!pool_mutex)
+    return 0;
+
+  babl_mutex_lock (pool_mutex);
+  if (pool_quit)
+    {
+      babl_mutex_unlock (pool_mutex);
+      return 0;
+    }
+
+  if (!background_running)
+    {
+#ifdef _WIN32
+      background_thread = (HANDLE) _beginthreadex (NULL, 0, background_main,
+                                                   NULL, 0, NULL);
+      background_running = background_thread != 0;
+#else
+      background_running = !pthread_create (&background_thread, NULL,
+                                            background_main, NULL);
+#endif
+      if (!background_running)
+        {
+          babl_mutex_unlock (pool_mutex);
+          return 0;
+        }
+    }
+
+  job = babl_malloc (sizeof (BablBackgroundJob));
+  job->func = func;
+  job->data = data;
+  job->next = NULL;
+  if (background_last)
+    background_last->next = job;
+  else
+    background_queue = job;
+  background_last = job;
+
+  babl_cond_signal (background_cond);
+  babl_mutex_unlock (pool_mutex);
+  return 1;
+}
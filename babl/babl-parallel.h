@@ -0,0 +1,53 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#ifndef _BABL_PARALLEL_H
+#define _BABL_PARALLEL_H
+
+#ifndef _BABL_H
+#error  babl-parallel.h is only to be included after babl.h
+#endif
+
+#define BABL_MAX_THREADS   64
+
+void babl_parallel_init          (void);
+void babl_parallel_destroy       (void);
+
+/* number of threads work is distributed over, including the calling thread,
+ * when no external executor is set; controlled with BABL_THREADS.
+ */
+int  babl_parallel_get_n_threads (void);
+
+/* run task (i, n_tasks, data) for all i in 0..n_tasks-1 and return when all
+ * tasks have completed, the calling thread takes part in the processing.
+ */
+void babl_parallel_distribute    (int               n_tasks,
+                                  BablParallelTask  task,
+                                  void             *data);
+
+typedef void (*BablBackgroundFunc) (void *data);
+
+/* queue func (data) to be run on babl's background thread, jobs run one at
+ * a time in the order they were queued. Returns 0 if the job could not be
+ * queued, in which case it is up to the caller to do the work. Jobs still
+ * queued when babl is shut down are dropped.
+ */
+int  babl_parallel_background    (BablBackgroundFunc  func,
+                                  void               *data);
+
+#endif
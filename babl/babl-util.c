@@ -53,20 +53,44 @@ init_ticks (void)
   QueryPerformanceFrequency(&timer_freq);
 }
 
-long
-babl_ticks (void)
+int64_t
+babl_ticks_ns (void)
 {
   LARGE_INTEGER end_time;
 
   init_ticks ();
 
   QueryPerformanceCounter(&end_time);
-  return (end_time.QuadPart - start_time.QuadPart) * (1000000.0 / timer_freq.QuadPart);
+  return (end_time.QuadPart - start_time.QuadPart) * (1000000000.0 / timer_freq.QuadPart);
+}
+#elif defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC)
+static struct timespec start_time;
+
+#define nsecs(time)    ((int64_t) (time.tv_sec - start_time.tv_sec) * 1000000000 + time.tv_nsec)
+
+static void
+init_ticks (void)
+{
+  static int done = 0;
+
+  if (done)
+    return;
+  done = 1;
+  clock_gettime (CLOCK_MONOTONIC, &start_time);
+}
+
+int64_t
+babl_ticks_ns (void)
+{
+  struct timespec measure_time;
+  init_ticks ();
+  clock_gettime (CLOCK_MONOTONIC, &measure_time);
+  return nsecs (measure_time) - nsecs (start_time);
 }
 #else
 static struct timeval start_time;
 
-#define usecs(time)    ((time.tv_sec - start_time.tv_sec) * 1000000 + time.tv_usec)
+#define usecs(time)    ((int64_t) (time.tv_sec - start_time.tv_sec) * 1000000 + time.tv_usec)
 
 static void
 init_ticks (void)
@@ -79,16 +103,84 @@ init_ticks (void)
   gettimeofday (&start_time, NULL);
 }
 
-long
-babl_ticks (void)
+int64_t
+babl_ticks_ns (void)
 {
   struct timeval measure_time;
   init_ticks ();
   gettimeofday (&measure_time, NULL);
-  return usecs (measure_time) - usecs (start_time);
+  return (usecs (measure_time) - usecs (start_time)) * 1000;
 }
 #endif
 
+long
+babl_ticks (void)
+{
+  return babl_ticks_ns () / 1000;
+}
+
+long
+babl_ticks_coarse (void)
+{
+#if !defined(_WIN32) && defined(HAVE_CLOCK_GETTIME) && defined(CLOCK_MONOTONIC_COARSE)
+  struct timespec measure_time;
+  init_ticks ();
+  clock_gettime (CLOCK_MONOTONIC_COARSE, &measure_time);
+  return (nsecs (measure_time) - nsecs (start_time)) / 1000;
+#else
+  return babl_ticks ();
+#endif
+}
+
+/* A single run of a conversion over the test pixels can take less time
+ * than the clock resolves, and any single run can get interrupted. The run
+ * is repeated in batches lasting at least BABL_TIMING_BATCH_NS, after a
+ * warm-up run that takes the first touches of the buffers and tables out
+ * of the measurement, and the fastest of BABL_TIMING_TRIALS batches is
+ * used - noise only ever makes a batch slower.
+ */
+#define BABL_TIMING_TRIALS    5
+#define BABL_TIMING_BATCH_NS  20000
+
+double
+babl_measure_ns (void (*run) (void *data),
+                 void  *data,
+                 long   max_iterations)
+{
+  double best       = 0.0;
+  long   iterations = 1;
+  long   i;
+  int    trial;
+
+  run (data);
+
+  for (trial = 0; trial < BABL_TIMING_TRIALS; trial++)
+    {
+      int64_t start = babl_ticks_ns ();
+      int64_t elapsed;
+      double  per_run;
+
+      for (i = 0; i < iterations; i++)
+        run (data);
+      elapsed = babl_ticks_ns () - start;
+
+      /* grow the batches until they are long enough to time */
+      if (elapsed < BABL_TIMING_BATCH_NS && iterations < max_iterations)
+        {
+          iterations *= 2;
+          if (iterations > max_iterations)
+            iterations = max_iterations;
+          trial--;
+          continue;
+        }
+
+      per_run = elapsed / (double) iterations;
+      if (best == 0.0 || per_run < best)
+        best = per_run;
+    }
+  return best;
+}
+
 double
 babl_rel_avg_error (const double *imgA,
                     const double *imgB,
@@ -20,6 +20,7 @@
 #define _BABL_UTIL_H
 
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <sys/types.h>
 #include <sys/stat.h>
@@ -33,6 +34,21 @@ typedef struct _stat64 BablStat;
 long
 babl_ticks     (void);
 
+int64_t
+babl_ticks_ns  (void);
+
+/* babl_ticks () at the resolution of the scheduler tick, cheap enough to
+ * be read on every call of hot paths */
+long
+babl_ticks_coarse (void);
+
+/* the time a call of run takes in nanoseconds, measured robustly by
+ * repeating it at most max_iterations times per batch */
+double
+babl_measure_ns (void (*run) (void *data),
+                 void  *data,
+                 long   max_iterations);
+
 double
 babl_rel_avg_error (const double *imgA,
                     const double *imgB,
@@ -239,6 +239,7 @@ babl_init (void)
       char * dir_list;
 
       babl_internal_init ();
+      babl_parallel_init ();
       babl_sampling_class_init ();
       babl_type_db ();
       babl_trc_class_init ();
@@ -277,10 +278,13 @@ babl_exit (void)
 {
   if (!-- ref_count)
     {
+      /* stop background work before the fishes it might use go away */
+      babl_parallel_destroy ();
       babl_store_db ();
 
       babl_extension_deinit ();
       babl_free (babl_extension_db ());;
+      babl_fish_lookup_cache_clear ();
       babl_free (babl_fish_db ());;
       babl_free (babl_conversion_db ());;
       babl_free (babl_format_db ());;
@@ -318,8 +322,10 @@ babl_trc_new_generic (const char *name,
                       int         n_lut,
                       float      *lut);
 
-void _babl_space_add_universal_rgb_generic (const Babl *space);
-void (*_babl_space_add_universal_rgb) (const Babl *space) =
+void _babl_space_add_universal_rgb_generic (const Babl *space,
+                                            const Babl *other);
+void (*_babl_space_add_universal_rgb) (const Babl *space,
+                                       const Babl *other) =
   _babl_space_add_universal_rgb_generic;
 
 const Babl *
@@ -331,13 +337,29 @@ const Babl *
               int         n_lut,
               float      *lut) = babl_trc_new_generic;
 
+int babl_lut_apply_generic (const uint32_t *lut,
+                            int             source_bpp,
+                            int             dest_bpp,
+                            const void     *source,
+                            void           *destination,
+                            long            n);
+int (*babl_lut_apply) (const uint32_t *lut,
+                       int             source_bpp,
+                       int             dest_bpp,
+                       const void     *source,
+                       void           *destination,
+                       long            n) = babl_lut_apply_generic;
+
 #ifdef ARCH_X86_64
 void babl_base_init_x86_64_v2 (void);
 void babl_base_init_x86_64_v3 (void);
 void babl_base_init_x86_64_v4 (void);
-void _babl_space_add_universal_rgb_x86_64_v2 (const Babl *space);
-void _babl_space_add_universal_rgb_x86_64_v3 (const Babl *space);
-void _babl_space_add_universal_rgb_x86_64_v4 (const Babl *space);
+void _babl_space_add_universal_rgb_x86_64_v2 (const Babl *space,
+                                              const Babl *other);
+void _babl_space_add_universal_rgb_x86_64_v3 (const Babl *space,
+                                              const Babl *other);
+void _babl_space_add_universal_rgb_x86_64_v4 (const Babl *space,
+                                              const Babl *other);
 
 const Babl *
 babl_trc_lookup_by_name_x86_64_v2 (const char *name);
@@ -365,10 +387,30 @@ babl_trc_new_x86_64_v4 (const char *name,
                         int         n_lut,
                         float      *lut);
 
+int babl_lut_apply_x86_64_v2 (const uint32_t *lut,
+                              int             source_bpp,
+                              int             dest_bpp,
+                              const void     *source,
+                              void           *destination,
+                              long            n);
+int babl_lut_apply_x86_64_v3 (const uint32_t *lut,
+                              int             source_bpp,
+                              int             dest_bpp,
+                              const void     *source,
+                              void           *destination,
+                              long            n);
+int babl_lut_apply_x86_64_v4 (const uint32_t *lut,
+                              int             source_bpp,
+                              int             dest_bpp,
+                              const void     *source,
+                              void           *destination,
+                              long            n);
+
 #endif
 #ifdef ARCH_ARM
 void babl_base_init_arm_neon (void);
-void _babl_space_add_universal_rgb_arm_neon (const Babl *space);
+void _babl_space_add_universal_rgb_arm_neon (const Babl *space,
+                                             const Babl *other);
 
 const Babl *
 babl_trc_lookup_by_name_arm_neon (const char *name);
@@ -380,6 +422,13 @@ babl_trc_new_arm_neon (const char *name,
                        int         n_lut,
                        float      *lut);
 
+int babl_lut_apply_arm_neon (const uint32_t *lut,
+                             int             source_bpp,
+                             int             dest_bpp,
+                             const void     *source,
+                             void           *destination,
+                             long            n);
+
 #endif
 
 static const char **simd_init (void)
@@ -389,24 +438,22 @@ static const char **simd_init (void)
   BablCpuAccelFlags accel = babl_cpu_accel_get_support ();
   if ((accel & BABL_CPU_ACCEL_X86_64_V4) == BABL_CPU_ACCEL_X86_64_V4)
   {
-    static const char *exclude[] = {"x86-64-v3-", "x86-64-v2", NULL};
-    // TODO : make use of actual builds for this arch
-    babl_base_init = babl_base_init_x86_64_v2;
-    babl_trc_new = babl_trc_new_x86_64_v2;
-    babl_trc_lookup_by_name = babl_trc_lookup_by_name_x86_64_v2;
-    _babl_space_add_universal_rgb = _babl_space_add_universal_rgb_x86_64_v3;
+    static const char *exclude[] = {"x86-64-v3-", "x86-64-v2-", NULL};
+    babl_base_init = babl_base_init_x86_64_v4;
+    babl_trc_new = babl_trc_new_x86_64_v4;
+    babl_trc_lookup_by_name = babl_trc_lookup_by_name_x86_64_v4;
+    _babl_space_add_universal_rgb = _babl_space_add_universal_rgb_x86_64_v4;
+    babl_lut_apply = babl_lut_apply_x86_64_v4;
     return exclude;
   }
   else if ((accel & BABL_CPU_ACCEL_X86_64_V3) == BABL_CPU_ACCEL_X86_64_V3)
   {
     static const char *exclude[] = {"x86-64-v4-", "x86-64-v2-", NULL};
-    babl_base_init = babl_base_init_x86_64_v2; /// !!
-                                               // this is correct,
-                                               // it performs better
-                                               // as observed in benchmarking
-    babl_trc_new = babl_trc_new_x86_64_v2;
-    babl_trc_lookup_by_name = babl_trc_lookup_by_name_x86_64_v2;
+    babl_base_init = babl_base_init_x86_64_v3;
+    babl_trc_new = babl_trc_new_x86_64_v3;
+    babl_trc_lookup_by_name = babl_trc_lookup_by_name_x86_64_v3;
     _babl_space_add_universal_rgb = _babl_space_add_universal_rgb_x86_64_v3;
+    babl_lut_apply = babl_lut_apply_x86_64_v3;
     return exclude;
   }
   else if ((accel & BABL_CPU_ACCEL_X86_64_V2) == BABL_CPU_ACCEL_X86_64_V2)
@@ -416,6 +463,7 @@ static const char **simd_init (void)
     babl_trc_new = babl_trc_new_x86_64_v2;
     babl_trc_lookup_by_name = babl_trc_lookup_by_name_x86_64_v2;
     _babl_space_add_universal_rgb = _babl_space_add_universal_rgb_x86_64_v2;
+    babl_lut_apply = babl_lut_apply_x86_64_v2;
     return exclude;
   }
   else
@@ -433,6 +481,7 @@ static const char **simd_init (void)
     babl_trc_new = babl_trc_new_arm_neon;
     babl_trc_lookup_by_name = babl_trc_lookup_by_name_arm_neon;
     _babl_space_add_universal_rgb = _babl_space_add_universal_rgb_arm_neon;
+    babl_lut_apply = babl_lut_apply_arm_neon;
     return exclude;
   }
   else
@@ -228,6 +228,22 @@ const Babl * babl_format_get_space  (const Babl *format);
 const Babl * babl_fish (const void *source_format,
                         const void *destination_format);
 
+/**
+ * babl_fish_get_lookup_stats:
+ * @hits: (out) (optional): where to store the number of babl_fish() calls
+ *        answered from the lookup cache.
+ * @misses: (out) (optional): where to store the number of babl_fish()
+ *          calls that had to consult the fish database.
+ *
+ * babl_fish() remembers the most recently returned fishes in a small
+ * cache indexed by source and destination format, these counters make
+ * it possible to verify how often repeated calls are served from it.
+ *
+ * Since: babl-0.1.128
+ */
+void         babl_fish_get_lookup_stats (long *hits,
+                                         long *misses);
+
 
 /**
  * babl_fast_fish:
@@ -238,9 +254,10 @@ const Babl * babl_fish (const void *source_format,
  * increasing order of speed gain are:
  *    "exact" "precise" "fast" "glitch"
  *
- * Fast fishes should be cached, since they are not internally kept track
- * of/made into singletons by babl and many creations of fast fishes will
- * otherwise be a leak.
+ * Like the fishes of babl_fish() fast fishes are singletons, kept per
+ * pair of formats and tolerance, and stored in the fish cache; repeated
+ * calls return the same fish. When no path meets the tolerance the fish
+ * babl_fish() returns is used.
  *
  */
 const Babl * babl_fast_fish (const void *source_format,
@@ -267,6 +284,49 @@ long         babl_process_rows (const Babl *babl_fish,
                                 long        n,
                                 int         rows);
 
+/**
+ * babl_process_rows_parallel:
+ *
+ *  Like babl_process_rows(), but the rows - or spans of rows for short
+ *  and wide images - are split into tasks that are processed concurrently
+ *  by babl's thread pool, or by the executor set with babl_set_executor().
+ *  Returns number of pixels converted.
+ *
+ * Since: babl-0.1.128
+ */
+long         babl_process_rows_parallel (const Babl *babl_fish,
+                                         const void *source,
+                                         int         source_stride,
+                                         void       *dest,
+                                         int         dest_stride,
+                                         long        n,
+                                         int         rows);
+
+typedef void (*BablParallelTask) (int   task,
+                                  int   n_tasks,
+                                  void *task_data);
+
+typedef void (*BablExecutor)     (BablParallelTask  task,
+                                  int               n_tasks,
+                                  void             *task_data,
+                                  void             *user_data);
+
+/**
+ * babl_set_executor: (skip)
+ * @executor: function running task (i, n_tasks, task_data) for all i in
+ *            0..n_tasks-1, returning when all of them have completed, or
+ *            %NULL to use babl's built-in thread pool.
+ * @user_data: passed on as the last argument of @executor.
+ *
+ * Hand the scheduling of parallel babl work over to a host application
+ * thread pool. Tasks of a single call may run in any order and on any
+ * thread.
+ *
+ * Since: babl-0.1.128
+ */
+void         babl_set_executor (BablExecutor  executor,
+                                void         *user_data);
+
 
 /**
  * babl_get_name:
@@ -769,6 +829,38 @@ BablFishProcess babl_fish_get_process (const Babl *babl);
  */
 void babl_gc (void);
 
+/**
+ * babl_set_lut_memory_limit:
+ * @bytes: the number of bytes all conversion LUTs may take together, or 0
+ *         for no limit.
+ *
+ * Caps the memory used by the lookup tables babl builds for frequently
+ * used 8bit conversions; when a new table does not fit, the least recently
+ * used tables are freed. The initial limit is taken from the
+ * BABL_LUT_MEMORY_LIMIT environment variable, in megabytes.
+ *
+ * Since: babl-0.1.128
+ */
+void babl_set_lut_memory_limit (long bytes);
+
+/**
+ * babl_get_lut_memory_limit:
+ *
+ * Returns the limit set with babl_set_lut_memory_limit(), 0 means no limit.
+ *
+ * Since: babl-0.1.128
+ */
+long babl_get_lut_memory_limit (void);
+
+/**
+ * babl_get_lut_memory_usage:
+ *
+ * Returns the number of bytes currently held by conversion LUTs.
+ *
+ * Since: babl-0.1.128
+ */
+long babl_get_lut_memory_usage (void);
+
 
 /* values below this are stored associated with this value, it should also be
  * used as a generic alpha zero epsilon in GEGL to keep the threshold effects
@@ -28,10 +28,14 @@
 #ifdef X86_64_V3
 #define BABL_SIMD_SUFFIX(symbol) symbol##_x86_64_v3
 #else
+#ifdef X86_64_V4
+#define BABL_SIMD_SUFFIX(symbol) symbol##_x86_64_v4
+#else
 #define BABL_SIMD_SUFFIX(symbol) symbol##_generic
 #endif
 #endif
 #endif
+#endif
 
 extern void (*babl_base_init)    (void);
 
@@ -0,0 +1,457 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+/* Application of the u8 conversion LUTs built by babl-fish-path.c, built
+ * once per SIMD variant of babl/base. The AVX2 and AVX-512 builds look up
+ * 8 or 16 pixels at a time with gathers, the remaining pixels - and all
+ * pixels of the other builds - go through the scalar loops.
+ */
+
+#include "config.h"
+#include <stdint.h>
+#include <string.h>
+#include "babl-internal.h"
+#include "babl-base.h"
+
+#if defined(__AVX2__)
+#if defined(__AVX512F__) && defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 13
+/* the AVX-512 intrinsics of gcc 12 trip its own uninitialized warning */
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+#include <immintrin.h>
+#endif
+
+/* 255 * 256 / alpha, for un-premultiplying associated alpha without a
+ * division per pixel */
+#define RECIP1(a)   ((256 * 255) / ((a) ? (a) : 1))
+#define RECIP4(a)   RECIP1(a), RECIP1(a + 1), RECIP1(a + 2), RECIP1(a + 3)
+#define RECIP16(a)  RECIP4(a), RECIP4(a + 4), RECIP4(a + 8), RECIP4(a + 12)
+#define RECIP64(a)  RECIP16(a), RECIP16(a + 16), RECIP16(a + 32), RECIP16(a + 48)
+
+static const uint32_t recip_alpha[256] = {
+  RECIP64(0), RECIP64(64), RECIP64(128), RECIP64(192)
+};
+
+static void
+lut_4associated_4 (const uint32_t *lut,
+                   const uint32_t *src,
+                   uint32_t       *dst,
+                   long            n)
+{
+#if defined(__AVX512F__)
+  {
+    const __m512i byte = _mm512_set1_epi32 (0xff);
+    for (; n >= 16; n -= 16, src += 16, dst += 16)
+      {
+        __m512i   col    = _mm512_loadu_si512 ((const void *) src);
+        __m512i   alpha  = _mm512_srli_epi32 (col, 24);
+        __m512i   recip  = _mm512_i32gather_epi32 (alpha, (const void *) recip_alpha, 4);
+        __m512i   r      = _mm512_and_si512 (col, byte);
+        __m512i   g      = _mm512_and_si512 (_mm512_srli_epi32 (col, 8), byte);
+        __m512i   b      = _mm512_and_si512 (_mm512_srli_epi32 (col, 16), byte);
+        __m512i   index;
+        __mmask16 opaque = _mm512_test_epi32_mask (alpha, alpha);
+
+        r = _mm512_and_si512 (_mm512_srli_epi32 (_mm512_mullo_epi32 (r, recip), 8), byte);
+        g = _mm512_and_si512 (_mm512_srli_epi32 (_mm512_mullo_epi32 (g, recip), 8), byte);
+        b = _mm512_and_si512 (_mm512_srli_epi32 (_mm512_mullo_epi32 (b, recip), 8), byte);
+        index = _mm512_or_si512 (r, _mm512_or_si512 (_mm512_slli_epi32 (g, 8),
+                                                     _mm512_slli_epi32 (b, 16)));
+        col = _mm512_mask_i32gather_epi32 (_mm512_setzero_si512 (), opaque,
+                                           index, (const void *) lut, 4);
+        col = _mm512_maskz_or_epi32 (opaque, col, _mm512_slli_epi32 (alpha, 24));
+        _mm512_storeu_si512 ((void *) dst, col);
+      }
+  }
+#endif
+#if defined(__AVX2__)
+  {
+    const __m256i byte = _mm256_set1_epi32 (0xff);
+    for (; n >= 8; n -= 8, src += 8, dst += 8)
+      {
+        __m256i col    = _mm256_loadu_si256 ((const void *) src);
+        __m256i alpha  = _mm256_srli_epi32 (col, 24);
+        __m256i recip  = _mm256_i32gather_epi32 ((const int *) recip_alpha, alpha, 4);
+        __m256i r      = _mm256_and_si256 (col, byte);
+        __m256i g      = _mm256_and_si256 (_mm256_srli_epi32 (col, 8), byte);
+        __m256i b      = _mm256_and_si256 (_mm256_srli_epi32 (col, 16), byte);
+        __m256i transparent = _mm256_cmpeq_epi32 (alpha, _mm256_setzero_si256 ());
+        __m256i index;
+
+        r = _mm256_and_si256 (_mm256_srli_epi32 (_mm256_mullo_epi32 (r, recip), 8), byte);
+        g = _mm256_and_si256 (_mm256_srli_epi32 (_mm256_mullo_epi32 (g, recip), 8), byte);
+        b = _mm256_and_si256 (_mm256_srli_epi32 (_mm256_mullo_epi32 (b, recip), 8), byte);
+        index = _mm256_or_si256 (r, _mm256_or_si256 (_mm256_slli_epi32 (g, 8),
+                                                     _mm256_slli_epi32 (b, 16)));
+        col = _mm256_i32gather_epi32 ((const int *) lut, index, 4);
+        col = _mm256_or_si256 (col, _mm256_slli_epi32 (alpha, 24));
+        _mm256_storeu_si256 ((void *) dst, _mm256_andnot_si256 (transparent, col));
+      }
+  }
+#endif
+  while (n--)
+    {
+      uint32_t col    = *src++;
+      uint32_t oalpha = col >> 24;
+
+      if (oalpha == 0)
+        {
+          *dst++ = 0;
+        }
+      else
+        {
+          uint32_t ralpha = recip_alpha[oalpha];
+          uint32_t r = (((col & 0xff) * ralpha) >> 8) & 0xff;
+          uint32_t g = ((((col >> 8) & 0xff) * ralpha) >> 8) & 0xff;
+          uint32_t b = ((((col >> 16) & 0xff) * ralpha) >> 8) & 0xff;
+
+          *dst++ = lut[r | (g << 8) | (b << 16)] | (oalpha << 24);
+        }
+    }
+}
+
+static void
+lut_4_4 (const uint32_t *lut,
+         const uint32_t *src,
+         uint32_t       *dst,
+         long            n)
+{
+#if defined(__AVX512F__)
+  {
+    const __m512i rgb = _mm512_set1_epi32 (0xffffff);
+    for (; n >= 16; n -= 16, src += 16, dst += 16)
+      {
+        __m512i col = _mm512_loadu_si512 ((const void *) src);
+        __m512i val = _mm512_i32gather_epi32 (_mm512_and_si512 (col, rgb),
+                                              (const void *) lut, 4);
+        _mm512_storeu_si512 ((void *) dst,
+                             _mm512_or_si512 (_mm512_andnot_si512 (rgb, col), val));
+      }
+  }
+#endif
+#if defined(__AVX2__)
+  {
+    const __m256i rgb = _mm256_set1_epi32 (0xffffff);
+    for (; n >= 8; n -= 8, src += 8, dst += 8)
+      {
+        __m256i col = _mm256_loadu_si256 ((const void *) src);
+        __m256i val = _mm256_i32gather_epi32 ((const int *) lut,
+                                              _mm256_and_si256 (col, rgb), 4);
+        _mm256_storeu_si256 ((void *) dst,
+                             _mm256_or_si256 (_mm256_andnot_si256 (rgb, col), val));
+      }
+  }
+#endif
+  while (n--)
+    {
+      uint32_t col = *src++;
+      *dst++ = (col & 0xff000000) | lut[col & 0xffffff];
+    }
+}
+
+static void
+lut_4_16 (const uint32_t *lut,
+          const uint32_t *src,
+          float          *dst,
+          long            n)
+{
+  /* each entry is a whole pixel, so rather than gathering the channels
+   * separately the entries are copied, with the alpha patched in */
+#if defined(__AVX2__)
+  {
+    const __m256i rgb = _mm256_set1_epi32 (0xffffff);
+    const __m256  max = _mm256_set1_ps (255.0f);
+    for (; n >= 8; n -= 8, src += 8, dst += 32)
+      {
+        __m256i col = _mm256_loadu_si256 ((const void *) src);
+        uint32_t offset[8];
+        float    alpha[8];
+        int      i;
+
+        _mm256_storeu_si256 ((void *) offset,
+                             _mm256_slli_epi32 (_mm256_and_si256 (col, rgb), 2));
+        _mm256_storeu_ps (alpha,
+                          _mm256_div_ps (_mm256_cvtepi32_ps (_mm256_srli_epi32 (col, 24)),
+                                         max));
+        for (i = 0; i < 8; i++)
+          {
+            __m128 pixel = _mm_loadu_ps ((const float *) lut + offset[i]);
+            pixel = _mm_insert_ps (pixel, _mm_set_ss (alpha[i]), 0x30);
+            _mm_storeu_ps (dst + i * 4, pixel);
+          }
+      }
+  }
+#endif
+  while (n--)
+    {
+      uint32_t col = *src++;
+      uint32_t lut_offset = col & 0xffffff;
+      float alpha = (col >> 24) / 255.0f;
+
+      memcpy (dst, lut + lut_offset * 4, 3 * sizeof (float));
+      dst[3] = alpha;
+      dst += 4;
+    }
+}
+
+static void
+lut_4_8 (const uint32_t *lut,
+         const uint32_t *src,
+         uint16_t       *dst,
+         long            n)
+{
+  const uint16_t *lut16 = (const uint16_t *) lut;
+
+#if defined(__AVX2__)
+  {
+    const __m128i rgb   = _mm_set1_epi32 (0xffffff);
+    const __m256i color = _mm256_set1_epi64x (0x0000ffffffffffffLL);
+    for (; n >= 4; n -= 4, src += 4, dst += 16)
+      {
+        __m128i col   = _mm_loadu_si128 ((const void *) src);
+        __m256i val   = _mm256_i32gather_epi64 ((const long long *) lut,
+                                                _mm_and_si128 (col, rgb), 8);
+        __m256i alpha = _mm256_slli_epi64 (_mm256_cvtepu32_epi64 (_mm_srli_epi32 (col, 24)),
+                                           56);
+        _mm256_storeu_si256 ((void *) dst,
+                             _mm256_or_si256 (_mm256_and_si256 (val, color), alpha));
+      }
+  }
+#endif
+  while (n--)
+    {
+      uint32_t col = *src++;
+      uint32_t lut_offset = col & 0xffffff;
+      uint16_t alpha = (col >> 24) << 8;
+
+      dst[0] = lut16[lut_offset * 4 + 0];
+      dst[1] = lut16[lut_offset * 4 + 1];
+      dst[2] = lut16[lut_offset * 4 + 2];
+      dst[3] = alpha;
+      dst += 4;
+    }
+}
+
+static void
+lut_2_16 (const uint32_t *lut,
+          const uint16_t *src,
+          uint32_t       *dst,
+          long            n)
+{
+  while (n--)
+    {
+      memcpy (dst, lut + *src++ * 4, 4 * sizeof (uint32_t));
+      dst += 4;
+    }
+}
+
+static void
+lut_2_4 (const uint32_t *lut,
+         const uint16_t *src,
+         uint32_t       *dst,
+         long            n)
+{
+#if defined(__AVX512F__)
+  for (; n >= 16; n -= 16, src += 16, dst += 16)
+    {
+      __m512i index = _mm512_cvtepu16_epi32 (_mm256_loadu_si256 ((const void *) src));
+      _mm512_storeu_si512 ((void *) dst,
+                           _mm512_i32gather_epi32 (index, (const void *) lut, 4));
+    }
+#endif
+#if defined(__AVX2__)
+  for (; n >= 8; n -= 8, src += 8, dst += 8)
+    {
+      __m256i index = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const void *) src));
+      _mm256_storeu_si256 ((void *) dst,
+                           _mm256_i32gather_epi32 ((const int *) lut, index, 4));
+    }
+#endif
+  while (n--)
+    *dst++ = lut[*src++];
+}
+
+static void
+lut_2_2 (const uint32_t *lut,
+         const uint16_t *src,
+         uint16_t       *dst,
+         long            n)
+{
+  const uint16_t *lut16 = (const uint16_t *) lut;
+
+#if defined(__AVX2__)
+  /* gathers the aligned pair of entries holding each value, the table is
+   * not padded for unaligned 32bit loads past its last entry */
+  for (; n >= 8; n -= 8, src += 8, dst += 8)
+    {
+      __m256i index = _mm256_cvtepu16_epi32 (_mm_loadu_si128 ((const void *) src));
+      __m256i shift = _mm256_slli_epi32 (_mm256_and_si256 (index, _mm256_set1_epi32 (1)), 4);
+      __m256i val   = _mm256_i32gather_epi32 ((const int *) lut,
+                                              _mm256_srli_epi32 (index, 1), 4);
+
+      val = _mm256_and_si256 (_mm256_srlv_epi32 (val, shift), _mm256_set1_epi32 (0xffff));
+      val = _mm256_permute4x64_epi64 (_mm256_packus_epi32 (val, val), 0x08);
+      _mm_storeu_si128 ((void *) dst, _mm256_castsi256_si128 (val));
+    }
+#endif
+  while (n--)
+    *dst++ = lut16[*src++];
+}
+
+static void
+lut_1_4 (const uint32_t *lut,
+         const uint8_t  *src,
+         uint32_t       *dst,
+         long            n)
+{
+#if defined(__AVX2__)
+  for (; n >= 8; n -= 8, src += 8, dst += 8)
+    {
+      __m256i index = _mm256_cvtepu8_epi32 (_mm_loadl_epi64 ((const void *) src));
+      _mm256_storeu_si256 ((void *) dst,
+                           _mm256_i32gather_epi32 ((const int *) lut, index, 4));
+    }
+#endif
+  while (n--)
+    *dst++ = lut[*src++];
+}
+
+#if defined(__AVX2__)
+/* the LUT offsets of 8 packed 3 byte pixels, r * 65536 + g * 256 + b; reads
+ * 28 bytes */
+static inline __m256i
+lut_3_offsets (const uint8_t *src)
+{
+  const __m256i shuffle = _mm256_setr_epi8 (2, 1, 0, -1, 5, 4, 3, -1,
+                                            8, 7, 6, -1, 11, 10, 9, -1,
+                                            2, 1, 0, -1, 5, 4, 3, -1,
+                                            8, 7, 6, -1, 11, 10, 9, -1);
+  __m256i pixels = _mm256_inserti128_si256 (
+                     _mm256_castsi128_si256 (_mm_loadu_si128 ((const void *) src)),
+                     _mm_loadu_si128 ((const void *) (src + 12)), 1);
+
+  return _mm256_shuffle_epi8 (pixels, shuffle);
+}
+#endif
+
+static void
+lut_3_3 (const uint32_t *lut,
+         const uint8_t  *src,
+         uint8_t        *dst,
+         long            n)
+{
+#if defined(__AVX2__)
+  {
+    const __m256i shuffle = _mm256_setr_epi8 (0, 1, 2, 4, 5, 6, 8, 9,
+                                              10, 12, 13, 14, -1, -1, -1, -1,
+                                              0, 1, 2, 4, 5, 6, 8, 9,
+                                              10, 12, 13, 14, -1, -1, -1, -1);
+    /* the loads read 4 bytes past the 8 pixels, the stores write exactly
+     * 8 pixels; converting in place works */
+    for (; n >= 10; n -= 8, src += 24, dst += 24)
+      {
+        __m256i val = _mm256_i32gather_epi32 ((const int *) lut,
+                                              lut_3_offsets (src), 4);
+        __m128i lo, hi;
+        int32_t tail;
+
+        val = _mm256_shuffle_epi8 (val, shuffle);
+        lo = _mm256_castsi256_si128 (val);
+        hi = _mm256_extracti128_si256 (val, 1);
+        _mm_storel_epi64 ((void *) dst, lo);
+        tail = _mm_extract_epi32 (lo, 2);
+        memcpy (dst + 8, &tail, 4);
+        _mm_storel_epi64 ((void *) (dst + 12), hi);
+        tail = _mm_extract_epi32 (hi, 2);
+        memcpy (dst + 20, &tail, 4);
+      }
+  }
+#endif
+  while (n--)
+    {
+      uint32_t col = src[0] * 256 * 256 + src[1] * 256 + src[2];
+      uint32_t val = lut[col];
+      dst[2] = (val >> 16) & 0xff;
+      dst[1] = (val >> 8) & 0xff;
+      dst[0] = val & 0xff;
+      dst += 3;
+      src += 3;
+    }
+}
+
+static void
+lut_3_4 (const uint32_t *lut,
+         const uint8_t  *src,
+         uint32_t       *dst,
+         long            n)
+{
+#if defined(__AVX2__)
+  for (; n >= 10; n -= 8, src += 24, dst += 8)
+    {
+      _mm256_storeu_si256 ((void *) dst,
+                           _mm256_i32gather_epi32 ((const int *) lut,
+                                                   lut_3_offsets (src), 4));
+    }
+#endif
+  while (n--)
+    {
+      *dst++ = lut[src[0] * 256 * 256 + src[1] * 256 + src[2]];
+      src += 3;
+    }
+}
+
+int
+BABL_SIMD_SUFFIX (babl_lut_apply) (const uint32_t *lut,
+                                   int             source_bpp,
+                                   int             dest_bpp,
+                                   const void     *source,
+                                   void           *destination,
+                                   long            n);
+
+int
+BABL_SIMD_SUFFIX (babl_lut_apply) (const uint32_t *lut,
+                                   int             source_bpp,
+                                   int             dest_bpp,
+                                   const void     *source,
+                                   void           *destination,
+                                   long            n)
+{
+  if (source_bpp == BPP_4ASSOCIATED && dest_bpp == 4)
+    lut_4associated_4 (lut, source, destination, n);
+  else if (source_bpp == 4 && dest_bpp == 16)
+    lut_4_16 (lut, source, destination, n);
+  else if (source_bpp == 4 && dest_bpp == 8)
+    lut_4_8 (lut, source, destination, n);
+  else if (source_bpp == 2 && dest_bpp == 16)
+    lut_2_16 (lut, source, destination, n);
+  else if (source_bpp == 4 && dest_bpp == 4)
+    lut_4_4 (lut, source, destination, n);
+  else if (source_bpp == 2 && dest_bpp == 4)
+    lut_2_4 (lut, source, destination, n);
+  else if (source_bpp == 2 && dest_bpp == 2)
+    lut_2_2 (lut, source, destination, n);
+  else if (source_bpp == 1 && dest_bpp == 4)
+    lut_1_4 (lut, source, destination, n);
+  else if (source_bpp == 3 && dest_bpp == 3)
+    lut_3_3 (lut, source, destination, n);
+  else if (source_bpp == 3 && dest_bpp == 4)
+    lut_3_4 (lut, source, destination, n);
+  else
+    return 0;
+  return 1;
+}
@@ -184,6 +184,15 @@ universal_y_converter (const Babl    *conversion,
 }
 
 
+/* pixels converted at a time by universal_nonlinear_rgb_u8_converter (),
+ * small enough for the planes of a chunk to stay in L1 */
+#define RGB_U8_CHUNK 256
+
+/* Converts a chunk at a time: the input TRC is looked up in the tables made
+ * by prep_conversion (), and the matrix, the output TRC and quantization
+ * are applied to the chunk while it is in planar form on the stack. The
+ * loops are plain C, vectorized for every SIMD level the base is built for.
+ */
 static inline void
 universal_nonlinear_rgb_u8_converter (const Babl    *conversion,
                                       unsigned char *__restrict__ src_char,
@@ -192,37 +201,78 @@ universal_nonlinear_rgb_u8_converter (const Babl    *conversion,
                                       void          *data)
 {
   const Babl *destination_space = conversion->conversion.destination->format.space;
-
-  float * matrixf = data;
-  float * in_trc_lut_red = matrixf + 9;
-  float * in_trc_lut_green = in_trc_lut_red + 256;
-  float * in_trc_lut_blue = in_trc_lut_green + 256;
-  unsigned int i;
-  uint8_t *rgb_in_u8 = (void*)src_char;
+  const Babl *trc_red   = destination_space->space.trc[0];
+  const Babl *trc_green = destination_space->space.trc[1];
+  const Babl *trc_blue  = destination_space->space.trc[2];
+
+  const float *matrixf = data;
+  const float *in_trc_lut_red = matrixf + 9;
+  const float *in_trc_lut_green = in_trc_lut_red + 256;
+  const float *in_trc_lut_blue = in_trc_lut_green + 256;
+  const float  m_0_0 = matrixf[0], m_0_1 = matrixf[1], m_0_2 = matrixf[2];
+  const float  m_1_0 = matrixf[3], m_1_1 = matrixf[4], m_1_2 = matrixf[5];
+  const float  m_2_0 = matrixf[6], m_2_1 = matrixf[7], m_2_2 = matrixf[8];
+  const uint8_t *rgb_in_u8 = (void*)src_char;
   uint8_t *rgb_out_u8 = (void*)dst_char;
 
-  float *rgba_out = babl_malloc (sizeof (float) * 4 * samples);
+  float __attribute__ ((aligned (32))) linear[3 * RGB_U8_CHUNK];
+  float __attribute__ ((aligned (32))) rgb[3 * RGB_U8_CHUNK];
 
-  for (i = 0; i < samples; i++)
+  while (samples > 0)
   {
-    rgba_out[i*4+0]=in_trc_lut_red[rgb_in_u8[i*3+0]];
-    rgba_out[i*4+1]=in_trc_lut_green[rgb_in_u8[i*3+1]];
-    rgba_out[i*4+2]=in_trc_lut_blue[rgb_in_u8[i*3+2]];
-    rgba_out[i*4+3]=rgb_in_u8[i*3+2] * 255.0f;
-  }
+    int    n = samples < RGB_U8_CHUNK ? samples : RGB_U8_CHUNK;
+    float *red   = rgb;
+    float *green = rgb + n;
+    float *blue  = rgb + 2 * n;
+    int    i;
 
-  babl_matrix_mul_vectorff_buf4 (matrixf, rgba_out, rgba_out, samples);
+    for (i = 0; i < n; i++)
+    {
+      linear[i]                    = in_trc_lut_red[rgb_in_u8[i*3+0]];
+      linear[RGB_U8_CHUNK + i]     = in_trc_lut_green[rgb_in_u8[i*3+1]];
+      linear[RGB_U8_CHUNK * 2 + i] = in_trc_lut_blue[rgb_in_u8[i*3+2]];
+    }
 
-  {
-    TRC_OUT(rgba_out, rgba_out);
+    for (i = 0; i < n; i++)
+    {
+      float r = linear[i];
+      float g = linear[RGB_U8_CHUNK + i];
+      float b = linear[RGB_U8_CHUNK * 2 + i];
 
-    for (i = 0; i < samples; i++)
-      for (unsigned int c = 0; c < 3; c ++)
-        rgb_out_u8[i*3+c] = rgba_out[i*4+c] * 255.0f;
-  }
+      red[i]   = m_0_0 * r + m_0_1 * g + m_0_2 * b;
+      green[i] = m_1_0 * r + m_1_1 * g + m_1_2 * b;
+      blue[i]  = m_2_0 * r + m_2_1 * g + m_2_2 * b;
+    }
+
+    /* the planes are adjacent, a shared TRC does all of them in one go */
+    if (trc_red == trc_green && trc_green == trc_blue)
+    {
+      babl_trc_from_linear_buf (trc_red, rgb, rgb, 1, 1, 1, 3 * n);
+    }
+    else
+    {
+      babl_trc_from_linear_buf (trc_red, red, red, 1, 1, 1, n);
+      babl_trc_from_linear_buf (trc_green, green, green, 1, 1, 1, n);
+      babl_trc_from_linear_buf (trc_blue, blue, blue, 1, 1, 1, n);
+    }
+
+    for (i = 0; i < 3 * n; i++)
+    {
+      float v = rgb[i] * 255.0f + 0.5f;
+      rgb[i] = !(v > 0.0f) ? 0.0f : v > 255.0f ? 255.0f : v;
+    }
 
-  babl_free (rgba_out);
+    for (i = 0; i < n; i++)
+    {
+      rgb_out_u8[i*3+0] = red[i];
+      rgb_out_u8[i*3+1] = green[i];
+      rgb_out_u8[i*3+2] = blue[i];
+    }
 
+    rgb_in_u8  += n * 3;
+    rgb_out_u8 += n * 3;
+    samples    -= n;
+  }
 }
 
 
@@ -231,6 +281,9 @@ universal_nonlinear_rgb_u8_converter (const Babl    *conversion,
 #define m(matr, j, i)  matr[j*3+i]
 
 #include <emmintrin.h>
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
 
 static inline void babl_matrix_mul_vectorff_buf4_sse2 (const float *mat,
                                                        const float *v_in,
@@ -243,24 +296,129 @@ static inline void babl_matrix_mul_vectorff_buf4_sse2 (const float *mat,
   unsigned int i;
   for (i = 0; i < samples; i ++)
   {
-    __v4sf a, b, c = _mm_load_ps(&v_in[0]);
+    __v4sf a, b, c = _mm_loadu_ps(&v_in[0]);
     a = (__v4sf) _mm_shuffle_epi32((__m128i)c, _MM_SHUFFLE(0,0,0,0));
     b = (__v4sf) _mm_shuffle_epi32((__m128i)c, _MM_SHUFFLE(1,1,1,1));
     c = (__v4sf) _mm_shuffle_epi32((__m128i)c, _MM_SHUFFLE(3,2,2,2));
-    _mm_store_ps (v_out, m___0 * a + m___1 * b + m___2 * c);
+    _mm_storeu_ps (v_out, m___0 * a + m___1 * b + m___2 * c);
     v_out += 4;
     v_in  += 4;
   }
   _mm_empty ();
 }
 
+#if defined(__AVX2__) && defined(__FMA__)
+/* two pixels per vector, the components of each broadcast within its
+ * 128 bit lane; alpha is copied rather than computed, like the scalar
+ * version does */
+static inline void babl_matrix_mul_vectorff_buf4_avx2 (const float *mat,
+                                                       const float *v_in,
+                                                       float       *v_out,
+                                                       unsigned int samples)
+{
+  const __m256 m___0 = _mm256_setr_ps (m(mat, 0, 0), m(mat, 1, 0), m(mat, 2, 0), 0,
+                                       m(mat, 0, 0), m(mat, 1, 0), m(mat, 2, 0), 0);
+  const __m256 m___1 = _mm256_setr_ps (m(mat, 0, 1), m(mat, 1, 1), m(mat, 2, 1), 0,
+                                       m(mat, 0, 1), m(mat, 1, 1), m(mat, 2, 1), 0);
+  const __m256 m___2 = _mm256_setr_ps (m(mat, 0, 2), m(mat, 1, 2), m(mat, 2, 2), 0,
+                                       m(mat, 0, 2), m(mat, 1, 2), m(mat, 2, 2), 0);
+  unsigned int i;
+
+#define MUL_2(v) \
+  _mm256_blend_ps (_mm256_fmadd_ps (m___0, _mm256_permute_ps (v, _MM_SHUFFLE(0,0,0,0)), \
+                   _mm256_fmadd_ps (m___1, _mm256_permute_ps (v, _MM_SHUFFLE(1,1,1,1)), \
+                   _mm256_mul_ps (m___2, _mm256_permute_ps (v, _MM_SHUFFLE(2,2,2,2))))), \
+                   v, 0x88)
+
+  for (i = 0; i + 4 <= samples; i += 4)
+  {
+    __m256 v0 = _mm256_loadu_ps (v_in);
+    __m256 v1 = _mm256_loadu_ps (v_in + 8);
+    _mm256_storeu_ps (v_out, MUL_2 (v0));
+    _mm256_storeu_ps (v_out + 8, MUL_2 (v1));
+    v_in  += 16;
+    v_out += 16;
+  }
+  for (; i < samples; i ++)
+  {
+    __m256 v = _mm256_castps128_ps256 (_mm_loadu_ps (v_in));
+    _mm_storeu_ps (v_out, _mm256_castps256_ps128 (MUL_2 (v)));
+    v_in  += 4;
+    v_out += 4;
+  }
+#undef MUL_2
+}
+#endif
+
+#if defined(__AVX512F__)
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 13
+/* the AVX-512 intrinsics of gcc 12 trip its own uninitialized warning */
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+/* four pixels per vector, with the tail done under a mask */
+static inline void babl_matrix_mul_vectorff_buf4_avx512 (const float *mat,
+                                                         const float *v_in,
+                                                         float       *v_out,
+                                                         unsigned int samples)
+{
+  const __m512 m___0 = _mm512_setr4_ps (m(mat, 0, 0), m(mat, 1, 0), m(mat, 2, 0), 0);
+  const __m512 m___1 = _mm512_setr4_ps (m(mat, 0, 1), m(mat, 1, 1), m(mat, 2, 1), 0);
+  const __m512 m___2 = _mm512_setr4_ps (m(mat, 0, 2), m(mat, 1, 2), m(mat, 2, 2), 0);
+  unsigned int i;
+
+#define MUL_4(v) \
+  _mm512_mask_blend_ps (0x8888, \
+                        _mm512_fmadd_ps (m___0, _mm512_permute_ps (v, _MM_SHUFFLE(0,0,0,0)), \
+                        _mm512_fmadd_ps (m___1, _mm512_permute_ps (v, _MM_SHUFFLE(1,1,1,1)), \
+                        _mm512_mul_ps (m___2, _mm512_permute_ps (v, _MM_SHUFFLE(2,2,2,2))))), \
+                        v)
+
+  for (i = 0; i + 8 <= samples; i += 8)
+  {
+    __m512 v0 = _mm512_loadu_ps (v_in);
+    __m512 v1 = _mm512_loadu_ps (v_in + 16);
+    _mm512_storeu_ps (v_out, MUL_4 (v0));
+    _mm512_storeu_ps (v_out + 16, MUL_4 (v1));
+    v_in  += 32;
+    v_out += 32;
+  }
+  for (; i < samples; i += 4)
+  {
+    unsigned int n    = samples - i < 4 ? samples - i : 4;
+    __mmask16    mask = (1u << (n * 4)) - 1;
+    __m512       v    = _mm512_maskz_loadu_ps (mask, v_in);
+    _mm512_mask_storeu_ps (v_out, mask, MUL_4 (v));
+    v_in  += 16;
+    v_out += 16;
+  }
+#undef MUL_4
+}
+#if defined(__GNUC__) && !defined(__clang__) && __GNUC__ < 13
+#pragma GCC diagnostic pop
+#endif
+#endif
+
 #undef m
 
+/* the widest of the kernels above this part of the base is built for */
+#if defined(__AVX512F__)
+#define babl_matrix_mul_vectorff_buf4_simd babl_matrix_mul_vectorff_buf4_avx512
+#elif defined(__AVX2__) && defined(__FMA__)
+#define babl_matrix_mul_vectorff_buf4_simd babl_matrix_mul_vectorff_buf4_avx2
+#else
+#define babl_matrix_mul_vectorff_buf4_simd babl_matrix_mul_vectorff_buf4_sse2
+#endif
+
+/* the converters below run their stages a chunk at a time, so that the TRC
+ * and matrix passes over a chunk find it in L1 rather than in memory */
+#define RGBA_CHUNK 512
+
 static inline void
-universal_nonlinear_rgba_converter_sse2 (const Babl    *conversion,
+universal_nonlinear_rgba_converter_simd (const Babl    *conversion,
                                          unsigned char *__restrict__ src_char,
                                          unsigned char *__restrict__ dst_char,
-                                         long           samples,
+                                         long           n_samples,
                                          void          *data)
 {
   const Babl *source_space = babl_conversion_get_source_space (conversion);
@@ -269,16 +427,25 @@ universal_nonlinear_rgba_converter_sse2 (const Babl    *conversion,
   float *rgba_in = (void*)src_char;
   float *rgba_out = (void*)dst_char;
 
-  TRC_IN(rgba_in, rgba_out);
+  while (n_samples > 0)
+  {
+    long samples = n_samples < RGBA_CHUNK ? n_samples : RGBA_CHUNK;
 
-  babl_matrix_mul_vectorff_buf4_sse2 (matrixf, rgba_out, rgba_out, samples);
+    TRC_IN(rgba_in, rgba_out);
 
-  TRC_OUT(rgba_out, rgba_out);
+    babl_matrix_mul_vectorff_buf4_simd (matrixf, rgba_out, rgba_out, samples);
+
+    TRC_OUT(rgba_out, rgba_out);
+
+    rgba_in   += samples * 4;
+    rgba_out  += samples * 4;
+    n_samples -= samples;
+  }
 }
 
 
 static inline void
-universal_rgba_converter_sse2 (const Babl *conversion,
+universal_rgba_converter_simd (const Babl *conversion,
                                unsigned char *__restrict__ src_char,
                                unsigned char *__restrict__ dst_char,
                                long samples,
@@ -288,53 +455,14 @@ universal_rgba_converter_sse2 (const Babl *conversion,
   float *rgba_in = (void*)src_char;
   float *rgba_out = (void*)dst_char;
 
-  babl_matrix_mul_vectorff_buf4_sse2 (matrixf, rgba_in, rgba_out, samples);
+  babl_matrix_mul_vectorff_buf4_simd (matrixf, rgba_in, rgba_out, samples);
 }
 
 static inline void
-universal_nonlinear_rgb_u8_converter_sse2 (const Babl    *conversion,
-                                           unsigned char *__restrict__ src_char,
-                                           unsigned char *__restrict__ dst_char,
-                                           long           samples,
-                                           void          *data)
-{
-  const Babl *destination_space = conversion->conversion.destination->format.space;
-
-  float * matrixf = data;
-  float * in_trc_lut_red = matrixf + 9;
-  float * in_trc_lut_green = in_trc_lut_red + 256;
-  float * in_trc_lut_blue = in_trc_lut_green + 256;
-  unsigned int i;
-  uint8_t *rgb_in_u8 = (void*)src_char;
-  uint8_t *rgb_out_u8 = (void*)dst_char;
-
-  // The alignment is necessary for SIMD intrinsics in babl_matrix_mul_vectorff_buf4_sse2()
-  float __attribute__ ((aligned (16))) rgba_out[4*samples];
-
-  for (i = 0; i < samples; i++)
-  {
-    rgba_out[i*4+0]=in_trc_lut_red[rgb_in_u8[i*3+0]];
-    rgba_out[i*4+1]=in_trc_lut_green[rgb_in_u8[i*3+1]];
-    rgba_out[i*4+2]=in_trc_lut_blue[rgb_in_u8[i*3+2]];
-  }
-
-  babl_matrix_mul_vectorff_buf4_sse2 (matrixf, rgba_out, rgba_out, samples);
-
-  {
-    TRC_OUT(rgba_out, rgba_out);
-
-    for (i = 0; i < samples; i++)
-      for (unsigned c = 0; c < 3; c ++)
-        rgb_out_u8[i*3+c] = rgba_out[i*4+c] * 255 + 0.5f;
-  }
-}
-
-
-static inline void
-universal_nonlinear_rgb_linear_converter_sse2 (const Babl    *conversion,
+universal_nonlinear_rgb_linear_converter_simd (const Babl    *conversion,
                                                unsigned char *__restrict__ src_char,
                                                unsigned char *__restrict__ dst_char,
-                                               long           samples,
+                                               long           n_samples,
                                                void          *data)
 {
   const Babl *source_space = babl_conversion_get_source_space (conversion);
@@ -342,17 +470,26 @@ universal_nonlinear_rgb_linear_converter_sse2 (const Babl    *conversion,
   float *rgba_in  = (void*)src_char;
   float *rgba_out = (void*)dst_char;
 
-  TRC_IN(rgba_in, rgba_out);
+  while (n_samples > 0)
+  {
+    long samples = n_samples < RGBA_CHUNK ? n_samples : RGBA_CHUNK;
 
-  babl_matrix_mul_vectorff_buf4_sse2 (matrixf, rgba_out, rgba_out, samples);
+    TRC_IN(rgba_in, rgba_out);
+
+    babl_matrix_mul_vectorff_buf4_simd (matrixf, rgba_out, rgba_out, samples);
+
+    rgba_in   += samples * 4;
+    rgba_out  += samples * 4;
+    n_samples -= samples;
+  }
 }
 
 
 static inline void
-universal_linear_rgb_nonlinear_converter_sse2 (const Babl    *conversion,
+universal_linear_rgb_nonlinear_converter_simd (const Babl    *conversion,
                                                unsigned char *__restrict__ src_char,
                                                unsigned char *__restrict__ dst_char,
-                                               long           samples,
+                                               long           n_samples,
                                                void          *data)
 {
   const Babl *destination_space = conversion->conversion.destination->format.space;
@@ -360,192 +497,121 @@ universal_linear_rgb_nonlinear_converter_sse2 (const Babl    *conversion,
   float *rgba_in = (void*)src_char;
   float *rgba_out = (void*)dst_char;
 
-  if (((uintptr_t) rgba_in & 0xF) == 0)
-    {
-      babl_matrix_mul_vectorff_buf4_sse2 (matrixf, rgba_in, rgba_out, samples);
-    }
-  else
-    {
-      /* babl_matrix_mul_vectorff_buf4_sse2() requires source pointer address
-       * to be 16-bytes aligned.
-       */
-      float __attribute__ ((aligned (16))) aligned_rgba_in[4 * 4 * samples];
+  while (n_samples > 0)
+  {
+    long samples = n_samples < RGBA_CHUNK ? n_samples : RGBA_CHUNK;
 
-      memcpy (aligned_rgba_in, rgba_in, 4 * 4 * samples);
-      babl_matrix_mul_vectorff_buf4_sse2 (matrixf, aligned_rgba_in, rgba_out, samples);
-    }
+    babl_matrix_mul_vectorff_buf4_simd (matrixf, rgba_in, rgba_out, samples);
 
-  TRC_OUT(rgba_out, rgba_out);
+    TRC_OUT(rgba_out, rgba_out);
+
+    rgba_in   += samples * 4;
+    rgba_out  += samples * 4;
+    n_samples -= samples;
+  }
 }
 #endif
 
 
-static int
-add_rgb_adapter (Babl *babl,
-                 void *space)
+/* adds the conversions from the formats of one space to those of another */
+static void
+add_rgb_adapters (const Babl *from,
+                  const Babl *to)
 {
-  if (babl != space)
-  {
-
 #if defined(USE_SSE2)
-    if ((babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_SSE) &&
-        (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_SSE2))
-    {
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("RGBA float", space),
-                       babl_format_with_space("RGBA float", babl),
-                       "linear", universal_rgba_converter_sse2,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("RGBA float", babl),
-                       babl_format_with_space("RGBA float", space),
-                       "linear", universal_rgba_converter_sse2,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B'A float", space),
-                       babl_format_with_space("R'G'B'A float", babl),
-                       "linear", universal_nonlinear_rgba_converter_sse2,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B'A float", babl),
-                       babl_format_with_space("R'G'B'A float", space),
-                       "linear", universal_nonlinear_rgba_converter_sse2,
-                       NULL));
-
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B'A float", space),
-                       babl_format_with_space("RGBA float", babl),
-                       "linear", universal_nonlinear_rgb_linear_converter_sse2,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B'A float", babl),
-                       babl_format_with_space("RGBA float", space),
-                       "linear", universal_nonlinear_rgb_linear_converter_sse2,
-                       NULL));
-
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("RGBA float", babl),
-                       babl_format_with_space("R'G'B'A float", space),
-                       "linear", universal_linear_rgb_nonlinear_converter_sse2,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("RGBA float", space),
-                       babl_format_with_space("R'G'B'A float", babl),
-                       "linear", universal_linear_rgb_nonlinear_converter_sse2,
-                       NULL));
-
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B' u8", space),
-                       babl_format_with_space("R'G'B' u8", babl),
-                       "linear", universal_nonlinear_rgb_u8_converter_sse2,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B' u8", babl),
-                       babl_format_with_space("R'G'B' u8", space),
-                       "linear", universal_nonlinear_rgb_u8_converter_sse2,
-                       NULL));
-    }
-    else
-#endif
-    {
-#if 1
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("RGBA float", space),
-                       babl_format_with_space("RGBA float", babl),
-                       "linear", universal_rgba_converter,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("RGBA float", babl),
-                       babl_format_with_space("RGBA float", space),
-                       "linear", universal_rgba_converter,
-                       NULL));
-
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B'A float", space),
-                       babl_format_with_space("R'G'B'A float", babl),
-                       "linear", universal_nonlinear_rgba_converter,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B'A float", babl),
-                       babl_format_with_space("R'G'B'A float", space),
-                       "linear", universal_nonlinear_rgba_converter,
-                       NULL));
-#endif
-#if 1
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B'A float", space),
-                       babl_format_with_space("RGBA float", babl),
-                       "linear", universal_nonlinear_rgb_linear_converter,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B'A float", babl),
-                       babl_format_with_space("RGBA float", space),
-                       "linear", universal_nonlinear_rgb_linear_converter,
-                       NULL));
-#endif
-
-#if 1
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B' u8", space),
-                       babl_format_with_space("R'G'B' u8", babl),
-                       "linear", universal_nonlinear_rgb_u8_converter,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("R'G'B' u8", babl),
-                       babl_format_with_space("R'G'B' u8", space),
-                       "linear", universal_nonlinear_rgb_u8_converter,
-                       NULL));
-
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("RGBA float", babl),
-                       babl_format_with_space("R'G'B'A float", space),
-                       "linear", universal_linear_rgb_nonlinear_converter,
-                       NULL));
-       prep_conversion(babl_conversion_new(
-                       babl_format_with_space("RGBA float", space),
-                       babl_format_with_space("R'G'B'A float", babl),
-                       "linear", universal_linear_rgb_nonlinear_converter,
-                       NULL));
-#endif
-    }
+  if ((babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_SSE) &&
+      (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_SSE2))
+  {
     prep_conversion(babl_conversion_new(
-                    babl_format_with_space("RGB float", space),
-                    babl_format_with_space("RGB float", babl),
-                    "linear", universal_rgb_converter,
+                    babl_format_with_space("RGBA float", from),
+                    babl_format_with_space("RGBA float", to),
+                    "linear", universal_rgba_converter_simd,
                     NULL));
     prep_conversion(babl_conversion_new(
-                    babl_format_with_space("RGB float", babl),
-                    babl_format_with_space("RGB float", space),
-                    "linear", universal_rgb_converter,
+                    babl_format_with_space("R'G'B'A float", from),
+                    babl_format_with_space("R'G'B'A float", to),
+                    "linear", universal_nonlinear_rgba_converter_simd,
                     NULL));
     prep_conversion(babl_conversion_new(
-                    babl_format_with_space("Y float", space),
-                    babl_format_with_space("Y float", babl),
-                    "linear", universal_y_converter,
+                    babl_format_with_space("R'G'B'A float", from),
+                    babl_format_with_space("RGBA float", to),
+                    "linear", universal_nonlinear_rgb_linear_converter_simd,
                     NULL));
     prep_conversion(babl_conversion_new(
-                    babl_format_with_space("YaA float", babl),
-                    babl_format_with_space("YaA float", space),
-                    "linear", universal_ya_converter,
+                    babl_format_with_space("RGBA float", from),
+                    babl_format_with_space("R'G'B'A float", to),
+                    "linear", universal_linear_rgb_nonlinear_converter_simd,
                     NULL));
+  }
+  else
+#endif
+  {
     prep_conversion(babl_conversion_new(
-                    babl_format_with_space("YA float", babl),
-                    babl_format_with_space("YA float", space),
-                    "linear", universal_ya_converter,
+                    babl_format_with_space("RGBA float", from),
+                    babl_format_with_space("RGBA float", to),
+                    "linear", universal_rgba_converter,
+                    NULL));
+    prep_conversion(babl_conversion_new(
+                    babl_format_with_space("R'G'B'A float", from),
+                    babl_format_with_space("R'G'B'A float", to),
+                    "linear", universal_nonlinear_rgba_converter,
+                    NULL));
+    prep_conversion(babl_conversion_new(
+                    babl_format_with_space("R'G'B'A float", from),
+                    babl_format_with_space("RGBA float", to),
+                    "linear", universal_nonlinear_rgb_linear_converter,
+                    NULL));
+    prep_conversion(babl_conversion_new(
+                    babl_format_with_space("RGBA float", from),
+                    babl_format_with_space("R'G'B'A float", to),
+                    "linear", universal_linear_rgb_nonlinear_converter,
                     NULL));
   }
-  return 0;
+  prep_conversion(babl_conversion_new(
+                  babl_format_with_space("R'G'B' u8", from),
+                  babl_format_with_space("R'G'B' u8", to),
+                  "linear", universal_nonlinear_rgb_u8_converter,
+                  NULL));
+  prep_conversion(babl_conversion_new(
+                  babl_format_with_space("RGB float", from),
+                  babl_format_with_space("RGB float", to),
+                  "linear", universal_rgb_converter,
+                  NULL));
+  prep_conversion(babl_conversion_new(
+                  babl_format_with_space("Y float", from),
+                  babl_format_with_space("Y float", to),
+                  "linear", universal_y_converter,
+                  NULL));
+  prep_conversion(babl_conversion_new(
+                  babl_format_with_space("YaA float", from),
+                  babl_format_with_space("YaA float", to),
+                  "linear", universal_ya_converter,
+                  NULL));
+  prep_conversion(babl_conversion_new(
+                  babl_format_with_space("YA float", from),
+                  babl_format_with_space("YA float", to),
+                  "linear", universal_ya_converter,
+                  NULL));
 }
 
-/* The first time a new Babl space is used - for creation of a fish, is when
- * this function is called, it adds conversions hooks that provides its formats
- * with conversions internally as well as for conversions to and from other RGB
- * spaces.
+/* The first time a fish is made for formats of two different RGB spaces,
+ * this function is called to add the conversions between them, in both
+ * directions. Adapters are only made for the pairs of spaces that are
+ * converted between, rather than between every space in use, keeping the
+ * conversion graph that paths are searched in small.
  */
 void
-BABL_SIMD_SUFFIX(_babl_space_add_universal_rgb) (const Babl *space);
+BABL_SIMD_SUFFIX(_babl_space_add_universal_rgb) (const Babl *space,
+                                                 const Babl *other);
 void
-BABL_SIMD_SUFFIX(_babl_space_add_universal_rgb) (const Babl *space)
+BABL_SIMD_SUFFIX(_babl_space_add_universal_rgb) (const Babl *space,
+                                                 const Babl *other)
 {
-  babl_space_class_for_each (add_rgb_adapter, (void*)space);
+  if (space == other ||
+      babl_conversion_find (babl_format_with_space ("RGBA float", space),
+                            babl_format_with_space ("RGBA float", other)))
+    return;
+
+  add_rgb_adapters (space, other);
+  add_rgb_adapters (other, space);
 }
@@ -18,19 +18,113 @@
 
 #define MAX_TRCS   100
 
-/* FIXME: choose parameters more intelligently */
-#define POLY_GAMMA_X0     (  0.5 / 255.0)
-#define POLY_GAMMA_X1     (254.5 / 255.0)
-#define POLY_GAMMA_DEGREE 6
-#define POLY_GAMMA_SCALE  2
-
 #include "config.h"
+#include <float.h>
+#include <stdint.h>
 #include "babl-internal.h"
 #include "babl-base.h"
 #include "base/util.h"
 
 static BablTRC trc_db[MAX_TRCS];
 
+/* cond ? a : b, as bit masking; the compiler turns a plain ?: with
+ * arithmetic in its arms back into a branch, which stops vectorization.
+ */
+static inline float
+_babl_trc_select (int   cond,
+                  float a,
+                  float b)
+{
+  uint32_t mask = -(uint32_t) (cond != 0);
+  uint32_t ia, ib;
+
+  memcpy (&ia, &a, sizeof (ia));
+  memcpy (&ib, &b, sizeof (ib));
+  ia = (ia & mask) | (ib & ~mask);
+  memcpy (&a, &ia, sizeof (a));
+  return a;
+}
+
+/* The exponent is split in a short high part, whose products with the
+ * integer part of the logarithm are exact, so the fractional part fed to
+ * the exp2 polynomial of _babl_trc_pow () keeps full float precision for
+ * large results.
+ */
+static inline void
+_babl_trc_pow_split (float  exponent,
+                     float *g_hi,
+                     float *g_lo)
+{
+  uint32_t g_bits;
+
+  memcpy (&g_bits, &exponent, sizeof (g_bits));
+  g_bits &= 0xfffff000;
+  memcpy (g_hi, &g_bits, sizeof (*g_hi));
+  *g_lo = exponent - *g_hi;
+}
+
+/* x ^ exponent for positive normal x, 0.0 otherwise, as
+ * 2 ^ (exponent * log2 (x)) with both halves evaluated by polynomials and
+ * no data dependent branches. Every TRC evaluates its powers with this,
+ * for single samples as well as for spans, so that both agree.
+ */
+static inline float
+_babl_trc_pow (float x,
+               float exponent,
+               float g_hi,
+               float g_lo)
+{
+  const float magic = 12582912.0f; /* 1.5 * 2^23, rounds to integer */
+  uint32_t    bits;
+  int         big, e;
+  float       m, s, z, log2_m, hi, lo, n, f, f2, p, scale;
+
+  memcpy (&bits, &x, sizeof (bits));
+  /* x = 2^e * m, with m in [sqrt(1/2), sqrt(2)) */
+  big  = (bits & 0x007fffff) > 0x003504f3;
+  e    = (int) ((bits >> 23) & 0xff) - 127 + big;
+  bits = (bits & 0x007fffff) | (big ? 0x3f000000 : 0x3f800000);
+  memcpy (&m, &bits, sizeof (m));
+
+  /* log2 (m) = 2 / ln (2) * atanh (s); the polynomials are Chebyshev
+   * fits, evaluated in Estrin form to keep dependency chains short
+   */
+  s      = (m - 1.0f) / (m + 1.0f);
+  z      = s * s;
+  log2_m = s * ((2.88539008f + 0.961798846f * z) +
+                z * z * (0.57671451f + 0.431733017f * z));
+
+  hi = g_hi * e;
+  lo = g_lo * e + exponent * log2_m;
+  n  = (hi + lo + magic) - magic;
+  f  = (hi - n) + lo;
+
+  /* 2^f for f in [-0.5, 0.5] */
+  f2 = f * f;
+  p  = (1.0f + 0.693147207f * f) +
+       f2 * (0.240226512f + 0.0555032721f * f) +
+       f2 * f2 * ((0.0096180256f + 0.00134004322f * f) +
+                  f2 * 0.000154697319f);
+
+  bits = (uint32_t) (((int) n + 127) & 0xff) << 23;
+  memcpy (&scale, &bits, sizeof (scale));
+  p *= scale;
+
+  /* zero for non-positive, denormal and NaN x and on underflow */
+  p = _babl_trc_select (n > 127.0f, INFINITY, p);
+  return _babl_trc_select ((x >= FLT_MIN) & (n >= -126.0f), p, 0.0f);
+}
+
+static inline float
+_babl_trc_powf (float x,
+                float exponent)
+{
+  float g_hi, g_lo;
+
+  _babl_trc_pow_split (exponent, &g_hi, &g_lo);
+  return _babl_trc_pow (x, exponent, g_hi, g_lo);
+}
+
 static inline float 
 _babl_trc_linear (const Babl *trc_, 
                   float       value)
@@ -97,16 +191,7 @@ _babl_trc_gamma_to_linear (const Babl *trc_,
                            float       value)
 {
   BablTRC *trc = (void*)trc_;
-  if (value >= trc->poly_gamma_to_linear_x0 &&
-      value <= trc->poly_gamma_to_linear_x1)
-    {
-      return babl_polynomial_eval (&trc->poly_gamma_to_linear, value);
-    }
-  else if (value > 0.0f)
-    {
-      return powf (value, trc->gamma);
-    }
-  return 0.0f;
+  return _babl_trc_powf (value, trc->gamma);
 }
 
 static inline float 
@@ -114,62 +199,7 @@ _babl_trc_gamma_from_linear (const Babl *trc_,
                              float       value)
 {
   BablTRC *trc = (void*)trc_;
-  if (value >= trc->poly_gamma_from_linear_x0 &&
-      value <= trc->poly_gamma_from_linear_x1)
-    {
-      return babl_polynomial_eval (&trc->poly_gamma_from_linear, value);
-    }
-  else if (value > 0.0f)
-    {
-      return powf (value, trc->rgamma);
-    }
-  return 0.0f;
-}
-
-static inline void 
-_babl_trc_gamma_to_linear_buf (const Babl  *trc_, 
-                               const float *__restrict__ in, 
-                               float       *__restrict__ out, 
-                               int          in_gap, 
-                               int          out_gap, 
-                               int          components, 
-                               int          count)
-{
-  if (in_gap == out_gap && in_gap == 4 && components == 3)
-  {
-    for (int i = 0; i < count; i ++)
-      for (int c = 0; c < 3; c ++)
-        out[4 * i + c] = _babl_trc_gamma_to_linear (trc_, in[4 *i + c]);
-  }
-  else
-  {
-    for (int i = 0; i < count; i ++)
-      for (int c = 0; c < components; c ++)
-        out[out_gap * i + c] = _babl_trc_gamma_to_linear (trc_, in[in_gap *i + c]);
-  }
-}
-
-static inline void 
-_babl_trc_gamma_from_linear_buf (const Babl  *trc_, 
-                                 const float *__restrict__ in, 
-                                 float       *__restrict__ out, 
-                                 int          in_gap, 
-                                 int          out_gap, 
-                                 int          components, 
-                                 int          count)
-{
-  if (in_gap == out_gap && in_gap == 4 && components == 3)
-  {
-    for (int i = 0; i < count; i ++)
-      for (int c = 0; c < 3; c ++)
-        out[4 * i + c] = _babl_trc_gamma_from_linear (trc_, in[4 *i + c]);
-  }
-  else
-  {
-    for (int i = 0; i < count; i ++)
-      for (int c = 0; c < components; c ++)
-        out[out_gap * i + c] = _babl_trc_gamma_from_linear (trc_, in[in_gap *i + c]);
-  }
+  return _babl_trc_powf (value, trc->rgamma);
 }
 
 static inline float 
@@ -194,7 +224,7 @@ _babl_trc_formula_srgb_from_linear (const Babl *trc_,
     return 0.0f;
   }
   if (c > 0.0f)
-    return (x - e) / c;
+    return (x - e) * (1.0f / c);
   return 0.0f;
 }
 
@@ -260,60 +290,18 @@ static inline float
 _babl_trc_srgb_to_linear (const Babl *trc_, 
                           float       value)
 {
-  return babl_gamma_2_2_to_linearf (value);
+  if (value > 0.04045f)
+    return _babl_trc_powf ((value + 0.055f) / 1.055f, 2.4f);
+  return value / 12.92f;
 }
 
 static inline float 
 _babl_trc_srgb_from_linear (const Babl *trc_, 
                             float       value)
 {
-  return babl_linear_to_gamma_2_2f (value);
-}
-
-static inline void 
-_babl_trc_srgb_to_linear_buf (const Babl  *trc_, 
-                              const float *in, 
-                              float       *out, 
-                              int          in_gap, 
-                              int          out_gap, 
-                              int          components, 
-                              int          count)
-{
-  if (in_gap == out_gap && in_gap == 4 && components == 3)
-  {
-  for (int i = 0; i < count; i ++)
-    for (int c = 0; c < 3; c++)
-      out[4 * i + c] = babl_gamma_2_2_to_linearf (in[4 * i + c]);
-  }
-  else
-  {
-  for (int i = 0; i < count; i ++)
-    for (int c = 0; c < components; c++)
-      out[out_gap * i + c] = babl_gamma_2_2_to_linearf (in[in_gap * i + c]);
-  }
-}
-
-static inline void 
-_babl_trc_srgb_from_linear_buf (const Babl  *trc_,
-                                const float *in, 
-                                float       *out,
-                                int          in_gap,
-                                int          out_gap,
-                                int          components,
-                                int          count)
-{
-  if (in_gap == out_gap && in_gap == 4 && components == 3)
-  {
-      for (int i = 0; i < count; i ++)
-       for (int c = 0; c < 3; c++)
-         out[4 * i + c] = babl_linear_to_gamma_2_2f (in[4 * i + c]);
-  }
-  else
-  {
-     for (int i = 0; i < count; i ++)
-       for (int c = 0; c < components; c++)
-         out[out_gap * i + c] = babl_linear_to_gamma_2_2f (in[in_gap * i + c]);
-  }
+  if (value > 0.003130804954f)
+    return 1.055f * _babl_trc_powf (value, 1.0f / 2.4f) - 0.055f;
+  return 12.92f * value;
 }
 
 static inline void 
@@ -366,6 +354,315 @@ _babl_trc_from_linear_buf_generic (const Babl  *trc_,
 
 
 
+/* The span functions below evaluate the TRCs TRC_BLOCK samples at a time,
+ * with fixed trip count and no data dependent branches in the inner loops,
+ * so that the compiler vectorizes them for each SIMD level babl is built
+ * for.  Out of range inputs are handled by computing all candidates and
+ * selecting among them, rather than by branching per sample.
+ */
+#define TRC_BLOCK 16
+
+/* evaluates the TRC for TRC_BLOCK samples of in into v, which never alias */
+typedef void (*BablTRCBlockFunc) (const BablTRC *trc,
+                                  const float   *in,
+                                  float         *v);
+
+/* v[i] = in[i] ^ exponent, see _babl_trc_pow () */
+static inline void
+_babl_trc_pow_block (const float *in,
+                     float       *v,
+                     float        exponent)
+{
+  float g_hi, g_lo;
+
+  _babl_trc_pow_split (exponent, &g_hi, &g_lo);
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = _babl_trc_pow (in[i], exponent, g_hi, g_lo);
+}
+
+/* plain gamma spans are the most common; declared inline, they stay within
+ * the span loops of _babl_trc_buf_blocks () instead of being called per
+ * block */
+static inline void
+_babl_trc_gamma_to_linear_block (const BablTRC *trc,
+                                 const float   *in,
+                                 float         *v)
+{
+  _babl_trc_pow_block (in, v, trc->gamma);
+}
+
+static inline void
+_babl_trc_gamma_from_linear_block (const BablTRC *trc,
+                                   const float   *in,
+                                   float         *v)
+{
+  _babl_trc_pow_block (in, v, trc->rgamma);
+}
+
+static void
+_babl_trc_formula_srgb_to_linear_block (const BablTRC *trc,
+                                        const float   *in,
+                                        float         *v)
+{
+  const float a = trc->lut[1];
+  const float b = trc->lut[2];
+  const float c = trc->lut[3];
+  const float d = trc->lut[4];
+  const float e = trc->lut[5];
+  const float f = trc->lut[6];
+
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = a * in[i] + b;
+  _babl_trc_pow_block (v, v, trc->gamma);
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = _babl_trc_select (in[i] >= d, v[i] + e, c * in[i] + f);
+}
+
+static void
+_babl_trc_formula_srgb_from_linear_block (const BablTRC *trc,
+                                          const float   *in,
+                                          float         *v)
+{
+  const float a = trc->lut[1];
+  const float b = trc->lut[2];
+  const float c = trc->lut[3];
+  const float d = trc->lut[4];
+  const float e = trc->lut[5];
+  const float f = trc->lut[6];
+  const float rc = c > 0.0f ? 1.0f / c : 0.0f;
+
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = in[i] - f;
+  _babl_trc_pow_block (v, v, trc->rgamma);
+  for (int i = 0; i < TRC_BLOCK; i++)
+    {
+      float g = (v[i] - b) / a;
+
+      g    = _babl_trc_select (g == g, g, 0.0f);
+      v[i] = _babl_trc_select (in[i] - f > c * d, g, (in[i] - e) * rc);
+    }
+}
+
+static void
+_babl_trc_formula_cie_to_linear_block (const BablTRC *trc,
+                                       const float   *in,
+                                       float         *v)
+{
+  const float a = trc->lut[1];
+  const float b = trc->lut[2];
+  const float c = trc->lut[3];
+
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = a * in[i] + b;
+  _babl_trc_pow_block (v, v, trc->gamma);
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = _babl_trc_select (in[i] >= -b / a, v[i], 0.0f) + c;
+}
+
+static void
+_babl_trc_formula_cie_from_linear_block (const BablTRC *trc,
+                                         const float   *in,
+                                         float         *v)
+{
+  const float a = trc->lut[1];
+  const float b = trc->lut[2];
+  const float c = trc->lut[3];
+
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = in[i] - c;
+  _babl_trc_pow_block (v, v, trc->rgamma);
+  for (int i = 0; i < TRC_BLOCK; i++)
+    {
+      float g = (v[i] - b) / a;
+
+      g    = _babl_trc_select (g == g, g, 0.0f);
+      v[i] = _babl_trc_select (in[i] > c, g, 0.0f);
+    }
+}
+
+static void
+_babl_trc_srgb_to_linear_block (const BablTRC *trc,
+                                const float   *in,
+                                float         *v)
+{
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = (in[i] + 0.055f) / 1.055f;
+  _babl_trc_pow_block (v, v, 2.4f);
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = _babl_trc_select (in[i] > 0.04045f, v[i], in[i] / 12.92f);
+}
+
+static void
+_babl_trc_srgb_from_linear_block (const BablTRC *trc,
+                                  const float   *in,
+                                  float         *v)
+{
+  _babl_trc_pow_block (in, v, 1.0f / 2.4f);
+  for (int i = 0; i < TRC_BLOCK; i++)
+    v[i] = _babl_trc_select (in[i] > 0.003130804954f,
+                             1.055f * v[i] - 0.055f, 12.92f * in[i]);
+}
+
+/* linear interpolation in a table of n >= 2 entries covering [0.0, 1.0],
+ * clamping at both ends; shared by both directions of LUT TRCs.
+ */
+static inline void
+_babl_trc_lut_block (const float *lut,
+                     int          n,
+                     const float *in,
+                     float       *v)
+{
+  const float max = n - 1;
+
+  for (int i = 0; i < TRC_BLOCK; i++)
+    {
+      float x = in[i] * max;
+      int   entry;
+      float diff;
+
+      x     = x > 0.0f ? (x < max ? x : max) : 0.0f;
+      entry = x;
+      entry = entry < n - 2 ? entry : n - 2;
+      diff  = x - entry;
+      v[i]  = lut[entry] * (1.0f - diff) + lut[entry + 1] * diff;
+    }
+}
+
+static void
+_babl_trc_lut_to_linear_block (const BablTRC *trc,
+                               const float   *in,
+                               float         *v)
+{
+  _babl_trc_lut_block (trc->lut, trc->lut_size, in, v);
+}
+
+static void
+_babl_trc_lut_from_linear_block (const BablTRC *trc,
+                                 const float   *in,
+                                 float         *v)
+{
+  _babl_trc_lut_block (trc->inv_lut, trc->lut_size, in, v);
+}
+
+/* gathers the components of count pixels into blocks, runs block on each,
+ * and scatters the results; in and out may alias.
+ */
+static inline void
+_babl_trc_buf_blocks (const Babl       *trc_,
+                      BablTRCBlockFunc  block,
+                      const float      *in,
+                      float            *out,
+                      int               in_gap,
+                      int               out_gap,
+                      int               components,
+                      int               count)
+{
+  const BablTRC *trc = (void*)trc_;
+  float          t[TRC_BLOCK];
+  float          v[TRC_BLOCK];
+
+  if (in_gap == components && out_gap == components)
+  {
+    int samples = count * components;
+    int j;
+
+    for (j = 0; j + TRC_BLOCK <= samples; j += TRC_BLOCK)
+    {
+      block (trc, in + j, v);
+      memcpy (out + j, v, sizeof (v));
+    }
+    if (j < samples)
+    {
+      memset (t, 0, sizeof (t));
+      memcpy (t, in + j, sizeof (float) * (samples - j));
+      block (trc, t, v);
+      memcpy (out + j, v, sizeof (float) * (samples - j));
+    }
+  }
+  else if (in_gap == 4 && out_gap == 4 && components == 3)
+  {
+    /* evaluate alpha along with the color components, so that whole
+     * pixels can be moved, and keep the alpha already in out
+     */
+    int samples = count * 4;
+    int j;
+
+    for (j = 0; j + TRC_BLOCK <= samples; j += TRC_BLOCK)
+    {
+      block (trc, in + j, v);
+      for (int k = 0; k < TRC_BLOCK; k++)
+        out[j + k] = _babl_trc_select ((k & 3) != 3, v[k], out[j + k]);
+    }
+    for (; j < samples; j += 4)
+    {
+      memset (t, 0, sizeof (t));
+      memcpy (t, in + j, sizeof (float) * 3);
+      block (trc, t, v);
+      memcpy (out + j, v, sizeof (float) * 3);
+    }
+  }
+  else
+  {
+    int i = 0, c = 0;
+    int o = 0, oc = 0;
+
+    while (i < count)
+    {
+      int n;
+
+      for (n = 0; n < TRC_BLOCK && i < count; n++)
+      {
+        t[n] = in[in_gap * i + c];
+        if (++c == components)
+        {
+          c = 0;
+          i++;
+        }
+      }
+      for (int k = n; k < TRC_BLOCK; k++)
+        t[k] = 0.0f;
+
+      block (trc, t, v);
+
+      for (int k = 0; k < n; k++)
+      {
+        out[out_gap * o + oc] = v[k];
+        if (++oc == components)
+        {
+          oc = 0;
+          o++;
+        }
+      }
+    }
+  }
+}
+
+#define TRC_BUF_FUNCS(name)                                                   \
+static void                                                                   \
+name##_buf (const Babl  *trc_,                                                \
+            const float *in,                                                  \
+            float       *out,                                                 \
+            int          in_gap,                                              \
+            int          out_gap,                                             \
+            int          components,                                          \
+            int          count)                                               \
+{                                                                             \
+  _babl_trc_buf_blocks (trc_, name##_block, in, out,                          \
+                        in_gap, out_gap, components, count);                  \
+}
+
+TRC_BUF_FUNCS (_babl_trc_gamma_to_linear)
+TRC_BUF_FUNCS (_babl_trc_gamma_from_linear)
+TRC_BUF_FUNCS (_babl_trc_formula_srgb_to_linear)
+TRC_BUF_FUNCS (_babl_trc_formula_srgb_from_linear)
+TRC_BUF_FUNCS (_babl_trc_formula_cie_to_linear)
+TRC_BUF_FUNCS (_babl_trc_formula_cie_from_linear)
+TRC_BUF_FUNCS (_babl_trc_srgb_to_linear)
+TRC_BUF_FUNCS (_babl_trc_srgb_from_linear)
+TRC_BUF_FUNCS (_babl_trc_lut_to_linear)
+TRC_BUF_FUNCS (_babl_trc_lut_from_linear)
+
+
 static inline void _babl_trc_linear_buf (const Babl  *trc_,
                                          const float *__restrict__ in, 
                                          float       *__restrict__ out,
@@ -518,22 +815,6 @@ BABL_SIMD_SUFFIX (babl_trc_new) (const char *name,
       trc_db[i].fun_from_linear = _babl_trc_gamma_from_linear;
       trc_db[i].fun_to_linear_buf = _babl_trc_gamma_to_linear_buf;
       trc_db[i].fun_from_linear_buf = _babl_trc_gamma_from_linear_buf;
-
-      trc_db[i].poly_gamma_to_linear_x0 = POLY_GAMMA_X0;
-      trc_db[i].poly_gamma_to_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_to_linear,
-                                         trc_db[i].gamma,
-                                         trc_db[i].poly_gamma_to_linear_x0,
-                                         trc_db[i].poly_gamma_to_linear_x1,
-                                         POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
-
-      trc_db[i].poly_gamma_from_linear_x0 = POLY_GAMMA_X0;
-      trc_db[i].poly_gamma_from_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_from_linear,
-                                         trc_db[i].rgamma,
-                                         trc_db[i].poly_gamma_from_linear_x0,
-                                         trc_db[i].poly_gamma_from_linear_x1,
-                                         POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
       break;
     case BABL_TRC_FORMULA_CIE:
       trc_db[i].lut = babl_calloc (sizeof (float), 4);
@@ -544,22 +825,8 @@ BABL_SIMD_SUFFIX (babl_trc_new) (const char *name,
       }
       trc_db[i].fun_to_linear = _babl_trc_formula_cie_to_linear;
       trc_db[i].fun_from_linear = _babl_trc_formula_cie_from_linear;
-
-      trc_db[i].poly_gamma_to_linear_x0 = lut[4];
-      trc_db[i].poly_gamma_to_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_to_linear,
-                                         trc_db[i].gamma,
-                                         trc_db[i].poly_gamma_to_linear_x0,
-                                         trc_db[i].poly_gamma_to_linear_x1,
-                                         POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
-
-      trc_db[i].poly_gamma_from_linear_x0 = lut[3] * lut[4];
-      trc_db[i].poly_gamma_from_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_from_linear,
-                                         trc_db[i].rgamma,
-                                         trc_db[i].poly_gamma_from_linear_x0,
-                                         trc_db[i].poly_gamma_from_linear_x1,
-                                         POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
+      trc_db[i].fun_to_linear_buf = _babl_trc_formula_cie_to_linear_buf;
+      trc_db[i].fun_from_linear_buf = _babl_trc_formula_cie_from_linear_buf;
       break;
 
     case BABL_TRC_FORMULA_SRGB:
@@ -571,22 +838,8 @@ BABL_SIMD_SUFFIX (babl_trc_new) (const char *name,
       }
       trc_db[i].fun_to_linear = _babl_trc_formula_srgb_to_linear;
       trc_db[i].fun_from_linear = _babl_trc_formula_srgb_from_linear;
-
-      trc_db[i].poly_gamma_to_linear_x0 = lut[4];
-      trc_db[i].poly_gamma_to_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_to_linear,
-                                         trc_db[i].gamma,
-                                         trc_db[i].poly_gamma_to_linear_x0,
-                                         trc_db[i].poly_gamma_to_linear_x1,
-                                         POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
-
-      trc_db[i].poly_gamma_from_linear_x0 = lut[3] * lut[4];
-      trc_db[i].poly_gamma_from_linear_x1 = POLY_GAMMA_X1;
-      babl_polynomial_approximate_gamma (&trc_db[i].poly_gamma_from_linear,
-                                         trc_db[i].rgamma,
-                                         trc_db[i].poly_gamma_from_linear_x0,
-                                         trc_db[i].poly_gamma_from_linear_x1,
-                                         POLY_GAMMA_DEGREE, POLY_GAMMA_SCALE);
+      trc_db[i].fun_to_linear_buf = _babl_trc_formula_srgb_to_linear_buf;
+      trc_db[i].fun_from_linear_buf = _babl_trc_formula_srgb_from_linear_buf;
       break;
     case BABL_TRC_SRGB:
       trc_db[i].fun_to_linear = _babl_trc_srgb_to_linear;
@@ -597,6 +850,11 @@ BABL_SIMD_SUFFIX (babl_trc_new) (const char *name,
     case BABL_TRC_LUT:
       trc_db[i].fun_to_linear = babl_trc_lut_to_linear;
       trc_db[i].fun_from_linear = babl_trc_lut_from_linear;
+      if (trc_db[i].lut_size >= 2)
+      {
+        trc_db[i].fun_to_linear_buf = _babl_trc_lut_to_linear_buf;
+        trc_db[i].fun_from_linear_buf = _babl_trc_lut_from_linear_buf;
+      }
       break;
   }
   return (Babl*)&trc_db[i];
@@ -59,12 +59,6 @@ typedef struct
                                       int out_gap,
                                       int components,
                                       int count);
-  BablPolynomial   poly_gamma_to_linear;
-  float            poly_gamma_to_linear_x0;
-  float            poly_gamma_to_linear_x1;
-  BablPolynomial   poly_gamma_from_linear;
-  float            poly_gamma_from_linear_x0;
-  float            poly_gamma_from_linear_x1;
   float           *lut;
   float           *inv_lut;
   int valid_u8_lut;
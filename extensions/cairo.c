@@ -229,7 +229,7 @@ conv_cairo32_cairo24_le (const Babl    *conversion,
           //  the faster practically correct but not truely reversible variants?
           //
 
-        $ rm ~/.cache/babl/babl-fishes;  ninja && BABL_PATH=extensions BABL_TOLERANCE=0.1 ./tools/babl-verify cairo-ARGB32 cairo-RGB24
+        $ rm ~/.cache/babl/babl-fish-cache;  ninja && BABL_PATH=extensions BABL_TOLERANCE=0.1 ./tools/babl-verify cairo-ARGB32 cairo-RGB24
 [7/7] Linking target extensions/x86-64-v3-cairo.so
 extensions/x86-64-v3-cairo.so 0: cairo-ARGB32 to cairo-RGB24  error:0.002999 cost:219.000000
 
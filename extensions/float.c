@@ -198,9 +198,7 @@ conv_yAF_linear_yAF_nonlinear (const Babl    *conversion,
          {
            *fdst++ = 0.0;
            *fdst++ = 0.0;
-           *fdst++ = 0.0;
-           *fdst++ = 0.0;
-           fsrc+=4;
+           fsrc+=2;
          }
        else
          {
@@ -0,0 +1,189 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "babl.h"
+
+/* fast fishes are singletons per pair of formats and tolerance, kept in
+ * the fish cache next to the fishes of babl_fish ().
+ */
+
+static const char *tiers[] = {"exact", "precise", "fast", "glitch", "0.005"};
+
+#define N_TIERS ((int) (sizeof (tiers) / sizeof (tiers[0])))
+
+static int
+check_singletons (void)
+{
+  const Babl *fishes[N_TIERS];
+  const Babl *fish = babl_fish ("RGBA float", "R'G'B'A u8");
+  int         OK = 1;
+  int         i, j;
+
+  for (i = 0; i < N_TIERS; i++)
+    {
+      fishes[i] = babl_fast_fish ("RGBA float", "R'G'B'A u8", tiers[i]);
+      if (!fishes[i] || fishes[i] == fish)
+        {
+          printf ("%s: no fast fish made\n", tiers[i]);
+          OK = 0;
+        }
+    }
+
+  for (i = 0; i < N_TIERS; i++)
+    {
+      if (babl_fast_fish (babl_format ("RGBA float"),
+                          babl_format ("R'G'B'A u8"), tiers[i]) != fishes[i])
+        {
+          printf ("%s: fast fish made again\n", tiers[i]);
+          OK = 0;
+        }
+      for (j = 0; j < i; j++)
+        if (fishes[i] == fishes[j])
+          {
+            printf ("%s and %s share a fish\n", tiers[i], tiers[j]);
+            OK = 0;
+          }
+    }
+
+  if (babl_fast_fish ("RGBA float", "R'G'B'A u8", NULL) != fish ||
+      babl_fast_fish ("RGBA float", "R'G'B'A u8", "default") != fish)
+    {
+      printf ("default is not the fish of babl_fish ()\n");
+      OK = 0;
+    }
+
+  if (babl_fish ("RGBA float", "R'G'B'A u8") != fish)
+    {
+      printf ("babl_fish () returns a fast fish\n");
+      OK = 0;
+    }
+  return OK;
+}
+
+/* when no path is needed, as between a format and itself, the fish of
+ * babl_fish () is the answer for every tier, and is cached like the fast
+ * fishes are, without going through babl_fish () again
+ */
+static int
+check_fallback (void)
+{
+  const Babl *fish = babl_fish ("RGBA float", "RGBA float");
+  long        hits, misses;
+  long        hits0, misses0;
+  int         OK = 1;
+  int         i;
+
+  for (i = 0; i < N_TIERS; i++)
+    if (babl_fast_fish ("RGBA float", "RGBA float", tiers[i]) != fish)
+      {
+        printf ("%s: not the fish of babl_fish () for RGBA float\n", tiers[i]);
+        OK = 0;
+      }
+
+  babl_fish_get_lookup_stats (&hits0, &misses0);
+  for (i = 0; i < N_TIERS; i++)
+    if (babl_fast_fish ("RGBA float", "RGBA float", tiers[i]) != fish)
+      {
+        printf ("%s: RGBA float fish changed\n", tiers[i]);
+        OK = 0;
+      }
+  babl_fish_get_lookup_stats (&hits, &misses);
+
+  if (hits != hits0 || misses != misses0)
+    {
+      printf ("fallback fish not cached: %ld lookups\n",
+              hits - hits0 + misses - misses0);
+      OK = 0;
+    }
+  return OK;
+}
+
+/* makes the fast fishes in a child process, so that every run starts out
+ * with only what is in the cache
+ */
+static int
+run_child (void)
+{
+  pid_t pid = fork ();
+  int   status;
+
+  if (pid == 0)
+    {
+      int OK;
+
+      babl_init ();
+      OK = check_singletons ();
+      OK = check_fallback () && OK;
+      babl_exit ();
+      fflush (stdout);
+      _exit (!OK);
+    }
+  if (pid < 0 || waitpid (pid, &status, 0) != pid)
+    return 0;
+  return WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+static long
+cache_size (const char *path)
+{
+  struct stat st;
+
+  if (stat (path, &st))
+    return -1;
+  return st.st_size;
+}
+
+int
+main (void)
+{
+  char dir[] = "/tmp/babl-fast-fish-XXXXXX";
+  char path[1024];
+  char babl_dir[512];
+  long size;
+  int  OK = 1;
+
+  if (!mkdtemp (dir))
+    return 1;
+  setenv ("XDG_CACHE_HOME", dir, 1);
+  snprintf (babl_dir, sizeof (babl_dir), "%s/babl", dir);
+  snprintf (path, sizeof (path), "%s/babl-fish-cache", babl_dir);
+
+  if (!run_child ())
+    OK = 0;
+  size = cache_size (path);
+
+  /* the second run finds all the fishes in the cache, and adds nothing */
+  if (OK && (!run_child () || cache_size (path) != size))
+    {
+      printf ("fast fishes not found in the cache\n");
+      OK = 0;
+    }
+
+  remove (path);
+  rmdir (babl_dir);
+  rmdir (dir);
+
+  return !OK;
+}
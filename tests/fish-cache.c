@@ -0,0 +1,248 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include "babl-internal.h"
+
+static const char *pairs[][2] = {
+  {"R'G'B'A u8", "CIE Lab float"},
+  {"Y u8",       "R'G'B' u16"},
+  {"RGBA half",  "R'G'B'A u8"},
+};
+
+#define N_PAIRS ((int) (sizeof (pairs) / sizeof (pairs[0])))
+
+/* the layout of the file, as written by babl/babl-cache.c */
+#define CACHE_HEADER_SIZE (8 + 4 + 4 + 120)
+
+typedef struct
+{
+  uint32_t size;
+  uint32_t checksum;
+  uint32_t hash;
+  uint16_t flags;
+  uint16_t n_conversions;
+  double   cost;
+  double   error;
+  double   tolerance;
+} CacheRecord;
+
+/* cost and error of the babl_fish () of each pair, as recorded */
+static CacheRecord records[N_PAIRS];
+
+/* creates the fishes in a child process, so that every run starts out
+ * with only what is in the cache; with check set, the fishes have to be
+ * the recorded ones instead of measured anew
+ */
+static int
+run_child (int check)
+{
+  pid_t pid = fork ();
+  int   status;
+
+  if (pid == 0)
+    {
+      unsigned char src[4 * 16] = {0,};
+      unsigned char dst[16 * 16];
+      int OK = 1;
+      int i;
+
+      babl_init ();
+      for (i = 0; i < N_PAIRS; i++)
+        {
+          const Babl *fish = babl_fish (pairs[i][0], pairs[i][1]);
+
+          babl_process (fish, src, dst, 1);
+          if (check &&
+              (fish->fish.error != records[i].error ||
+               (fish->class_type == BABL_FISH_PATH &&
+                fish->fish_path.cost != records[i].cost)))
+            {
+              printf ("%s to %s: measured again\n", pairs[i][0], pairs[i][1]);
+              OK = 0;
+            }
+        }
+      babl_exit ();
+      fflush (stdout);
+      _exit (!OK);
+    }
+  if (pid < 0 || waitpid (pid, &status, 0) != pid)
+    return 0;
+  return WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+static long
+cache_size (const char *path)
+{
+  struct stat st;
+
+  if (stat (path, &st))
+    return -1;
+  return st.st_size;
+}
+
+/* returns the number of records in the cache, and fills in records[]
+ * from the last record of each pair, or returns -1 if a pair is missing
+ */
+static int
+read_records (const char *path)
+{
+  FILE *file = fopen (path, "rb");
+  char *data;
+  long  length;
+  long  offset;
+  int   found[N_PAIRS] = {0,};
+  int   count = 0;
+  int   i;
+
+  if (!file)
+    return -1;
+  fseek (file, 0, SEEK_END);
+  length = ftell (file);
+  fseek (file, 0, SEEK_SET);
+  data = malloc (length + 1);
+  if (fread (data, 1, length, file) != (size_t) length)
+    length = 0;
+  data[length] = 0;
+  fclose (file);
+
+  for (offset = CACHE_HEADER_SIZE;
+       offset + (long) sizeof (CacheRecord) <= length;
+       offset += ((CacheRecord *) (data + offset))->size)
+    {
+      CacheRecord record;
+      const char *source = data + offset + sizeof (CacheRecord);
+      const char *destination;
+
+      memcpy (&record, data + offset, sizeof (record));
+      if (record.size < sizeof (CacheRecord) || offset + record.size > length)
+        break;
+      destination = source + strlen (source) + 1;
+      count++;
+
+      for (i = 0; i < N_PAIRS; i++)
+        if (record.tolerance == 0.0 &&
+            !strcmp (source, pairs[i][0]) &&
+            !strcmp (destination, pairs[i][1]))
+          {
+            records[i] = record;
+            found[i] = 1;
+          }
+    }
+  free (data);
+
+  for (i = 0; i < N_PAIRS; i++)
+    if (!found[i])
+      return -1;
+  return count;
+}
+
+static int
+has_magic (const char *path)
+{
+  FILE *file = fopen (path, "rb");
+  char  magic[8];
+  int   ok;
+
+  if (!file)
+    return 0;
+  ok = fread (magic, sizeof (magic), 1, file) == 1 &&
+       !memcmp (magic, "babl-fc\n", sizeof (magic));
+  fclose (file);
+  return ok;
+}
+
+int
+main (void)
+{
+  char  dir[] = "/tmp/babl-fish-cache-XXXXXX";
+  char  path[1024];
+  char  babl_dir[512];
+  FILE *file;
+  long  size;
+  int   count;
+  int   OK = 1;
+
+  if (!mkdtemp (dir))
+    return 1;
+  setenv ("XDG_CACHE_HOME", dir, 1);
+  snprintf (babl_dir, sizeof (babl_dir), "%s/babl", dir);
+  snprintf (path, sizeof (path), "%s/babl-fish-cache", babl_dir);
+
+  /* fishes are written to the cache as they are created */
+  if (!run_child (0) || !has_magic (path) || cache_size (path) <= 0 ||
+      (count = read_records (path)) <= 0)
+    {
+      printf ("cache not created\n");
+      OK = 0;
+    }
+  size = cache_size (path);
+
+  /* loading the cache gives back the recorded fishes, and adds nothing */
+  if (OK && (!run_child (1) || !has_magic (path)))
+    {
+      printf ("cached run failed\n");
+      OK = 0;
+    }
+  if (OK && (cache_size (path) != size || read_records (path) != count))
+    {
+      printf ("cached run changed the cache: %ld bytes, %d records, was "
+              "%ld bytes, %d records\n",
+              cache_size (path), read_records (path), size, count);
+      OK = 0;
+    }
+
+  /* a partially written record at the end gets compacted away */
+  file = fopen (path, "ab");
+  if (file)
+    {
+      fwrite ("\001\002\003\004\005", 5, 1, file);
+      fclose (file);
+    }
+  if (OK && (!run_child (0) || cache_size (path) % 8 || !has_magic (path)))
+    {
+      printf ("truncated cache not repaired\n");
+      OK = 0;
+    }
+
+  /* a file that is not a cache is replaced */
+  file = fopen (path, "wb");
+  if (file)
+    {
+      fprintf (file, "#not a fish cache\n");
+      fclose (file);
+    }
+  if (OK && (!run_child (0) || !has_magic (path)))
+    {
+      printf ("invalid cache not replaced\n");
+      OK = 0;
+    }
+
+  remove (path);
+  rmdir (babl_dir);
+  rmdir (dir);
+
+  return !OK;
+}
@@ -0,0 +1,119 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+
+#include <stdio.h>
+#include <pthread.h>
+
+#include "babl.h"
+
+/* lookups in the format and fish databases do not take locks; hammer them
+ * from several threads while another thread keeps registering formats and
+ * fishes, growing the tables underneath the readers.
+ */
+
+#define N_READERS      6
+#define N_ITERATIONS   200
+
+static const char *types[] = {"u8", "u16", "u32", "half", "float", "double"};
+#define N_TYPES        (sizeof (types) / sizeof (types[0]))
+#define N_COMPONENTS   32
+
+static const char *pairs[][2] = {
+  {"R'G'B'A u8",  "RGBA float"},
+  {"RGBA float",  "R'G'B'A u8"},
+  {"Y'A u8",      "R'G'B'A float"},
+  {"R'G'B' u16",  "Y float"},
+};
+#define N_PAIRS        (sizeof (pairs) / sizeof (pairs[0]))
+
+static const Babl *fishes[N_PAIRS];
+static const Babl *formats[N_PAIRS];
+static volatile int writer_done = 0;
+
+static void *
+writer_func (void *data)
+{
+  int t, n;
+
+  for (n = 1; n <= N_COMPONENTS; n++)
+    for (t = 0; t < (int) N_TYPES; t++)
+      {
+        const Babl *format = babl_format_n (babl_type (types[t]), n);
+
+        babl_fish (format, format);
+      }
+
+  writer_done = 1;
+  return NULL;
+}
+
+static void *
+reader_func (void *data)
+{
+  int *failed = data;
+  int  i, p;
+
+  for (i = 0; i < N_ITERATIONS || !writer_done; i++)
+    for (p = 0; p < (int) N_PAIRS; p++)
+      {
+        if (babl_fish (pairs[p][0], pairs[p][1]) != fishes[p] ||
+            babl_format (pairs[p][0]) != formats[p])
+          *failed = 1;
+      }
+
+  return NULL;
+}
+
+int
+main (void)
+{
+  pthread_t writer;
+  pthread_t readers[N_READERS];
+  int       failed[N_READERS] = {0,};
+  int       OK = 1;
+  int       i;
+
+  babl_init ();
+
+  for (i = 0; i < (int) N_PAIRS; i++)
+    {
+      formats[i] = babl_format (pairs[i][0]);
+      fishes[i]  = babl_fish (pairs[i][0], pairs[i][1]);
+    }
+
+  pthread_create (&writer, NULL, writer_func, NULL);
+  for (i = 0; i < N_READERS; i++)
+    pthread_create (&readers[i], NULL, reader_func, &failed[i]);
+
+  pthread_join (writer, NULL);
+  for (i = 0; i < N_READERS; i++)
+    {
+      pthread_join (readers[i], NULL);
+      if (failed[i])
+        {
+          printf ("reader %i got an inconsistent lookup\n", i);
+          OK = 0;
+        }
+    }
+
+  babl_exit ();
+
+  return !OK;
+}
@@ -0,0 +1,85 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include "babl.h"
+
+#define N_ROUNDS  100
+
+static const char *pairs[][2] = {
+  {"R'G'B'A u8",  "RGBA float"},
+  {"RGBA float",  "R'G'B'A u8"},
+  {"Y'A u8",      "R'G'B'A float"},
+  {"RGBA float",  "RGBA float"},
+};
+#define N_PAIRS   (sizeof (pairs) / sizeof (pairs[0]))
+
+int
+main (void)
+{
+  const Babl *fishes[N_PAIRS];
+  long        hits0, misses0, hits, misses;
+  int         OK = 1;
+  int         i, p;
+
+  babl_init ();
+  babl_fish_get_lookup_stats (&hits0, &misses0);
+
+  for (p = 0; p < (int) N_PAIRS; p++)
+    fishes[p] = babl_fish (pairs[p][0], pairs[p][1]);
+
+  babl_fish_get_lookup_stats (&hits, &misses);
+  hits -= hits0;
+  misses -= misses0;
+  if (hits + misses != N_PAIRS)
+    {
+      printf ("first lookups: %li hits %li misses\n", hits, misses);
+      OK = 0;
+    }
+
+  for (i = 0; i < N_ROUNDS; i++)
+    for (p = 0; p < (int) N_PAIRS; p++)
+      {
+        const Babl *fish = (i & 1) ?
+          babl_fish (pairs[p][0], pairs[p][1]) :
+          babl_fish (babl_format (pairs[p][0]), babl_format (pairs[p][1]));
+
+        if (fish != fishes[p])
+          {
+            printf ("%s to %s: got a different fish\n",
+                    pairs[p][0], pairs[p][1]);
+            OK = 0;
+          }
+      }
+
+  babl_fish_get_lookup_stats (&hits, &misses);
+  hits -= hits0;
+  misses -= misses0;
+  /* all pairs might not fit the cache at the same time, but most of the
+   * lookups are expected to be hits */
+  if (hits < N_ROUNDS * (long) N_PAIRS / 2)
+    {
+      printf ("repeated lookups: %li hits %li misses\n", hits, misses);
+      OK = 0;
+    }
+
+  babl_exit ();
+
+  return !OK;
+}
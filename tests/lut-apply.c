@@ -0,0 +1,187 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "babl-internal.h"
+
+/* LUTs are applied by vectorized kernels on CPUs that have them, they give
+ * the same results as looking up the pixels one by one. The pixel count is
+ * odd, exercising the scalar tails of the kernels as well.
+ */
+
+#define PIXELS    (256 * 256 + 13)
+#define TIMEOUT   (60 * 1000)  /* ms */
+
+static unsigned char src[PIXELS * 4];
+static unsigned char with_lut[PIXELS * 16];
+static unsigned char expected[PIXELS * 16];
+
+static void
+lookup (const uint32_t *lut,
+        int             source_bpp,
+        int             dest_bpp,
+        int             associated,
+        long            n)
+{
+  const uint16_t *lut16 = (const uint16_t *) lut;
+  long            i;
+
+  for (i = 0; i < n; i++)
+    {
+      const uint8_t *s = src + i * source_bpp;
+      uint8_t       *d = expected + i * dest_bpp;
+      uint32_t       index;
+      uint32_t       alpha = 0;
+      uint32_t       ralpha;
+
+      if (source_bpp == 4)
+        {
+          alpha = s[3];
+          if (associated)
+            {
+              if (alpha == 0)
+                {
+                  memset (d, 0, 4);
+                  continue;
+                }
+              ralpha = 255 * 256 / alpha;
+              index = ((s[0] * ralpha) >> 8 & 0xff) |
+                      ((s[1] * ralpha) >> 8 & 0xff) << 8 |
+                      ((s[2] * ralpha) >> 8 & 0xff) << 16;
+            }
+          else
+            {
+              index = s[0] | s[1] << 8 | s[2] << 16;
+            }
+        }
+      else if (source_bpp == 3)
+        index = s[0] << 16 | s[1] << 8 | s[2];
+      else if (source_bpp == 2)
+        index = s[0] | s[1] << 8;
+      else
+        index = s[0];
+
+      if (source_bpp == 4 && dest_bpp == 4)
+        {
+          uint32_t val = lut[index] | alpha << 24;
+          memcpy (d, &val, 4);
+        }
+      else if (source_bpp == 4 && dest_bpp == 8)
+        {
+          uint16_t val[4] = {lut16[index * 4], lut16[index * 4 + 1],
+                             lut16[index * 4 + 2], alpha << 8};
+          memcpy (d, val, 8);
+        }
+      else if (source_bpp == 4 && dest_bpp == 16)
+        {
+          float val = alpha / 255.0f;
+          memcpy (d, lut + index * 4, 12);
+          memcpy (d + 12, &val, 4);
+        }
+      else if (source_bpp == 3 && dest_bpp == 3)
+        {
+          d[0] = lut[index] & 0xff;
+          d[1] = (lut[index] >> 8) & 0xff;
+          d[2] = (lut[index] >> 16) & 0xff;
+        }
+      else if (dest_bpp == 16)
+        memcpy (d, lut + index * 4, 16);
+      else if (dest_bpp == 2)
+        memcpy (d, lut16 + index, 2);
+      else
+        memcpy (d, lut + index, 4);
+    }
+}
+
+static int
+check_lut (const char *source_format,
+           const char *dest_format)
+{
+  const Babl *source = babl_format (source_format);
+  const Babl *dest   = babl_format_with_space (dest_format,
+                                               babl_space ("ProPhoto"));
+  const Babl *fish   = babl_fish (source, dest);
+  int         source_bpp = babl_format_get_bytes_per_pixel (source);
+  int         dest_bpp   = babl_format_get_bytes_per_pixel (dest);
+  int         waited;
+
+  if (fish->class_type != BABL_FISH_PATH)
+    return 1;
+
+  babl_process (fish, src, with_lut, PIXELS);
+  babl_process (fish, src, with_lut, PIXELS);
+
+  for (waited = 0;
+       !fish->fish_path.u8_lut && !fish->fish_path.u8_clut && waited < TIMEOUT;
+       waited += 10)
+    usleep (10 * 1000);
+
+  if (!fish->fish_path.u8_lut)
+    {
+      /* no LUT candidate, or sampled by a CLUT instead */
+      return 1;
+    }
+
+  babl_process (fish, src, with_lut, PIXELS);
+  lookup (fish->fish_path.u8_lut, source_bpp, dest_bpp,
+          (source->format.model->flags & BABL_MODEL_FLAG_ASSOCIATED) != 0,
+          PIXELS);
+
+  if (memcmp (with_lut, expected, (size_t) PIXELS * dest_bpp))
+    {
+      long i;
+
+      for (i = 0; with_lut[i] == expected[i]; i++);
+      printf ("%s to %s: pixel %li differs from the LUT entry\n",
+              source_format, dest_format, i / dest_bpp);
+      return 0;
+    }
+  return 1;
+}
+
+int
+main (void)
+{
+  int OK = 1;
+  int i;
+
+  setenv ("BABL_LUT", "1", 1);
+  babl_init ();
+
+  for (i = 0; i < PIXELS * 4; i++)
+    src[i] = (i * 7) ^ (i >> 8);
+
+  OK &= check_lut ("R'G'B'A u8", "R'G'B'A u8");
+  OK &= check_lut ("R'aG'aB'aA u8", "R'G'B'A u8");
+  OK &= check_lut ("R'G'B'A u8", "R'G'B'A u16");
+  OK &= check_lut ("R'G'B'A u8", "R'G'B'A float");
+  OK &= check_lut ("R'G'B' u8", "R'G'B' u8");
+  OK &= check_lut ("R'G'B' u8", "R'G'B'A u8");
+  OK &= check_lut ("Y' u16", "Y' u16");
+  OK &= check_lut ("Y' u16", "R'G'B'A u8");
+  OK &= check_lut ("Y' u16", "R'G'B'A float");
+  OK &= check_lut ("Y' u8", "R'G'B'A u8");
+
+  babl_exit ();
+
+  return !OK;
+}
@@ -0,0 +1,99 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include "babl-internal.h"
+
+/* LUTs are built in the background, babl_process () keeps converting
+ * through the conversion path until the LUT is ready, with the same results.
+ */
+
+#define PIXELS    (256 * 256)
+#define TIMEOUT   (60 * 1000)  /* ms */
+
+static unsigned char src[PIXELS * 4];
+static unsigned char without_lut[PIXELS * 4];
+static unsigned char with_lut[PIXELS * 4];
+
+static int
+check_lut (const char *format)
+{
+  const Babl *fish;
+  int         bpp = babl_format_get_bytes_per_pixel (babl_format (format));
+  int         waited;
+  int         i;
+
+  fish = babl_fish (babl_format (format),
+                    babl_format_with_space (format, babl_space ("ProPhoto")));
+
+  if (fish->class_type != BABL_FISH_PATH || !fish->fish_path.is_u8_color_conv)
+    {
+      /* nothing to test without a LUT candidate */
+      return 1;
+    }
+
+  /* crosses the threshold, and queues the LUT build */
+  babl_process (fish, src, without_lut, PIXELS);
+  babl_process (fish, src, without_lut, PIXELS);
+
+  for (waited = 0; !fish->fish_path.u8_lut && waited < TIMEOUT; waited += 10)
+    usleep (10 * 1000);
+
+  if (!fish->fish_path.u8_lut)
+    {
+      printf ("%s: LUT was not built\n", format);
+      return 0;
+    }
+
+  babl_process (fish, src, with_lut, PIXELS);
+
+  for (i = 0; i < PIXELS * bpp; i++)
+    if (abs (with_lut[i] - without_lut[i]) > 1)
+      {
+        printf ("%s: pixel %i component %i: %i with LUT, %i without\n",
+                format, i / bpp, i % bpp, with_lut[i], without_lut[i]);
+        return 0;
+      }
+  return 1;
+}
+
+int
+main (void)
+{
+  int OK = 1;
+  int i;
+
+  setenv ("BABL_LUT", "1", 1);
+  /* LUTs are built by the thread pool, exercise it on single core machines */
+  setenv ("BABL_THREADS", "4", 0);
+  babl_init ();
+
+  for (i = 0; i < PIXELS * 4; i++)
+    src[i] = (i * 7) ^ (i >> 8);
+
+  OK &= check_lut ("R'G'B'A u8");
+  OK &= check_lut ("R'G'B' u8");
+
+  babl_exit ();
+
+  return !OK;
+}
@@ -0,0 +1,135 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include <pthread.h>
+#include "babl-internal.h"
+
+/* CLUTs are built on the thread pool, which looks up the fish sampling
+ * the nodes, while other threads look up fishes for new pairs until the
+ * CLUTs are done.
+ */
+
+#define N_THREADS  4
+#define PIXELS     (256 * 256)
+#define TIMEOUT    (60 * 1000)  /* ms */
+
+static const char *spaces[] = {
+  "ProPhoto", "Adobish", "Rec2020", "Apple", "WideGamut", "DisplayP3", "Best"
+};
+
+static const char *encodings[] = {
+  "RGBA float", "R'G'B' u16", "YA half", "CIE Lab float", "Y'A u8",
+  "RGB double", "R'G'B'A half", "Y float"
+};
+
+#define N_SPACES    ((int) (sizeof (spaces) / sizeof (spaces[0])))
+#define N_ENCODINGS ((int) (sizeof (encodings) / sizeof (encodings[0])))
+
+static unsigned char src[PIXELS * 4];
+static unsigned char dst[PIXELS * 4];
+static volatile int  done = 0;
+
+static void *
+fish_thread_func (void *data)
+{
+  int t = *(int *) data;
+  int s, d, e;
+
+  for (s = 0; s < N_SPACES && !done; s++)
+    for (d = 0; d < N_SPACES && !done; d++)
+      for (e = 0; e < N_ENCODINGS && !done; e++)
+        {
+          const Babl *fish;
+
+          fish = babl_fish (
+            babl_format_with_space (encodings[t % N_ENCODINGS],
+                                    babl_space (spaces[s])),
+            babl_format_with_space (encodings[e], babl_space (spaces[d])));
+          babl_get_name (fish);
+        }
+
+  return NULL;
+}
+
+int
+main (void)
+{
+  pthread_t   threads[N_THREADS];
+  int         ids[N_THREADS];
+  const Babl *fishes[N_SPACES];
+  int         OK = 1;
+  int         waited;
+  int         i;
+
+  setenv ("BABL_LUT", "1", 1);
+  setenv ("BABL_TOLERANCE", "0.001", 1);
+  /* CLUTs are built by the thread pool, exercise it on single core
+   * machines */
+  setenv ("BABL_THREADS", "4", 0);
+  babl_init ();
+
+  for (i = 0; i < PIXELS * 4; i++)
+    src[i] = (i * 7) ^ (i >> 8);
+
+  for (i = 0; i < N_THREADS; i++)
+    {
+      ids[i] = i;
+      pthread_create (&threads[i], NULL, fish_thread_func, &ids[i]);
+    }
+
+  /* crosses the threshold of each fish, queueing the builds */
+  for (i = 0; i < N_SPACES; i++)
+    {
+      fishes[i] = babl_fish (babl_format ("R'G'B'A u8"),
+                             babl_format_with_space ("R'G'B'A u8",
+                                                     babl_space (spaces[i])));
+      babl_process (fishes[i], src, dst, PIXELS);
+      babl_process (fishes[i], src, dst, PIXELS);
+    }
+
+  for (i = 0; i < N_SPACES; i++)
+    {
+      const Babl *fish = fishes[i];
+
+      if (fish->class_type != BABL_FISH_PATH ||
+          !fish->fish_path.is_u8_color_conv)
+        continue;
+
+      for (waited = 0; !fish->fish_path.u8_clut && !fish->fish_path.u8_lut &&
+                       waited < TIMEOUT; waited += 10)
+        usleep (10 * 1000);
+
+      if (!fish->fish_path.u8_clut && !fish->fish_path.u8_lut)
+        {
+          printf ("%s: no LUT was built\n", spaces[i]);
+          OK = 0;
+        }
+    }
+
+  done = 1;
+  for (i = 0; i < N_THREADS; i++)
+    pthread_join (threads[i], NULL);
+
+  babl_exit ();
+
+  return !OK;
+}
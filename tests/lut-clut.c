@@ -0,0 +1,140 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include <unistd.h>
+#include "babl-internal.h"
+
+/* with a tolerance that allows for it, u8 color conversions get a compact
+ * tetrahedrally interpolated CLUT instead of a full 24bit LUT, giving
+ * results close to the conversion path.
+ */
+
+#define PIXELS    (256 * 256)
+#define TIMEOUT   (60 * 1000)  /* ms */
+
+/* interpolation errors concentrate near black, where the TRC is steep */
+#define MAX_DIFF      0.02
+#define MAX_AVG_DIFF  0.001
+
+static int
+check_clut (const char *src_fmt,
+            const char *dst_fmt,
+            const char *dst_space)
+{
+  const Babl    *dst_format = babl_format_with_space (dst_fmt,
+                                                      babl_space (dst_space));
+  const Babl    *fish       = babl_fish (babl_format (src_fmt), dst_format);
+  int            src_bpp    = babl_format_get_bytes_per_pixel (babl_format (src_fmt));
+  unsigned char *src        = malloc (PIXELS * src_bpp);
+  float         *without    = malloc (PIXELS * 4 * sizeof (float));
+  float         *with       = malloc (PIXELS * 4 * sizeof (float));
+  void          *dst        = malloc (PIXELS * 4 * sizeof (float));
+  const Babl    *to_float   = babl_fish (dst_format,
+                                         babl_format_with_space (
+                                           /* compared in the model of dst,
+                                            * where a step of u8 is small */
+                                           dst_fmt[1] == '\'' ? "R'G'B'A float" :
+                                                                 "RGBA float",
+                                           babl_space (dst_space)));
+  double         sum        = 0.0;
+  int            OK         = 1;
+  int            waited;
+  int            i;
+
+  if (fish->class_type != BABL_FISH_PATH || !fish->fish_path.is_u8_color_conv)
+    {
+      printf ("%s to %s %s: not a u8 color conversion path\n",
+              src_fmt, dst_fmt, dst_space);
+      OK = 0;
+      goto done;
+    }
+
+  for (i = 0; i < PIXELS * src_bpp; i++)
+    src[i] = (i * 7) ^ (i >> 8);
+
+  /* crosses the threshold, and queues the build */
+  babl_process (fish, src, dst, PIXELS);
+  babl_process (fish, src, dst, PIXELS);
+  babl_process (to_float, dst, without, PIXELS);
+
+  for (waited = 0; !fish->fish_path.u8_clut && !fish->fish_path.u8_lut &&
+                   waited < TIMEOUT; waited += 10)
+    usleep (10 * 1000);
+
+  if (!fish->fish_path.u8_clut)
+    {
+      printf ("%s to %s %s: no CLUT was built\n", src_fmt, dst_fmt, dst_space);
+      OK = 0;
+      goto done;
+    }
+
+  babl_process (fish, src, dst, PIXELS);
+  babl_process (to_float, dst, with, PIXELS);
+
+  for (i = 0; i < PIXELS * 4 && OK; i++)
+    {
+      double diff = fabs (with[i] - without[i]);
+
+      if (diff > MAX_DIFF)
+        {
+          printf ("%s to %s %s: pixel %i component %i: %f with CLUT, %f without\n",
+                  src_fmt, dst_fmt, dst_space, i / 4, i % 4, with[i], without[i]);
+          OK = 0;
+        }
+      sum += diff;
+    }
+
+  if (OK && sum / (PIXELS * 4) > MAX_AVG_DIFF)
+    {
+      printf ("%s to %s %s: average difference %f\n",
+              src_fmt, dst_fmt, dst_space, sum / (PIXELS * 4));
+      OK = 0;
+    }
+
+done:
+  free (src);
+  free (without);
+  free (with);
+  free (dst);
+  return OK;
+}
+
+int
+main (void)
+{
+  int OK = 1;
+
+  setenv ("BABL_LUT", "1", 1);
+  setenv ("BABL_TOLERANCE", "0.001", 1);
+  babl_init ();
+
+  OK &= check_clut ("R'G'B'A u8", "R'G'B'A u8", "ProPhoto");
+  OK &= check_clut ("R'G'B'A u8", "R'G'B'A u16", "ProPhoto");
+  OK &= check_clut ("R'G'B'A u8", "R'G'B'A float", "ProPhoto");
+  OK &= check_clut ("R'G'B' u8", "R'G'B'A u8", "ProPhoto");
+  /* within one space the CLUT nodes are sampled by a multi-step path */
+  OK &= check_clut ("R'G'B' u8", "RGBA u8", "sRGB");
+
+  babl_exit ();
+
+  return !OK;
+}
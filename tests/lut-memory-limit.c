@@ -0,0 +1,144 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <unistd.h>
+#include "babl-internal.h"
+
+/* LUTs share a memory budget, building a LUT that does not fit next to the
+ * existing ones evicts the least recently used. A LUT that does not fit at
+ * all is built once the limit has been raised.
+ */
+
+#define PIXELS    (256 * 256)
+#define TIMEOUT   (60 * 1000)  /* ms */
+
+static unsigned char src[PIXELS * 4];
+static unsigned char dst[PIXELS * 4];
+
+static const Babl *
+lut_fish (const char *space)
+{
+  const Babl *fish = babl_fish (babl_format ("R'G'B'A u8"),
+                                babl_format_with_space ("R'G'B'A u8",
+                                                        babl_space (space)));
+
+  if (fish->class_type != BABL_FISH_PATH || !fish->fish_path.is_u8_color_conv)
+    return NULL;
+  return fish;
+}
+
+static int
+wait_for_build (const Babl *fish)
+{
+  int waited;
+
+  babl_process (fish, src, dst, PIXELS);
+  babl_process (fish, src, dst, PIXELS);
+
+  for (waited = 0; fish->fish_path.lut_pending && waited < TIMEOUT; waited += 10)
+    usleep (10 * 1000);
+  return !fish->fish_path.lut_pending;
+}
+
+static int
+wait_for_lut (const Babl *fish)
+{
+  int waited;
+
+  /* crosses the threshold, and queues the LUT build */
+  babl_process (fish, src, dst, PIXELS);
+  babl_process (fish, src, dst, PIXELS);
+
+  for (waited = 0; !fish->fish_path.u8_lut && waited < TIMEOUT; waited += 10)
+    usleep (10 * 1000);
+  return fish->fish_path.u8_lut != NULL;
+}
+
+int
+main (void)
+{
+  const Babl *a;
+  const Babl *b;
+  const Babl *c;
+  long        lut_size = 256 * 256 * 256 * 4;
+  int         OK = 1;
+
+  setenv ("BABL_LUT", "1", 1);
+  babl_init ();
+
+  a = lut_fish ("ProPhoto");
+  b = lut_fish ("Apple");
+  c = lut_fish ("Adobish");
+  if (!a || !b || !c)
+    {
+      /* nothing to test without LUT candidates */
+      babl_exit ();
+      return 0;
+    }
+
+  babl_set_lut_memory_limit (lut_size + lut_size / 2);
+  if (babl_get_lut_memory_limit () != lut_size + lut_size / 2)
+    {
+      printf ("limit not set\n");
+      OK = 0;
+    }
+
+  if (!wait_for_lut (a) || babl_get_lut_memory_usage () != lut_size)
+    {
+      printf ("first LUT not accounted for: %li bytes\n",
+              babl_get_lut_memory_usage ());
+      OK = 0;
+    }
+
+  if (!wait_for_lut (b) || a->fish_path.u8_lut ||
+      babl_get_lut_memory_usage () != lut_size)
+    {
+      printf ("first LUT not evicted: %li bytes\n",
+              babl_get_lut_memory_usage ());
+      OK = 0;
+    }
+
+  babl_set_lut_memory_limit (1);
+  if (b->fish_path.u8_lut || babl_get_lut_memory_usage () != 0)
+    {
+      printf ("lowering the limit did not evict: %li bytes\n",
+              babl_get_lut_memory_usage ());
+      OK = 0;
+    }
+
+  /* a build failing on the limit is tried again once the fish has been
+   * used enough after the limit was raised */
+  if (!wait_for_build (c) || c->fish_path.u8_lut)
+    {
+      printf ("LUT above the limit not given up on\n");
+      OK = 0;
+    }
+  babl_set_lut_memory_limit (0);
+  if (!wait_for_lut (c))
+    {
+      printf ("no LUT after raising the limit\n");
+      OK = 0;
+    }
+
+  babl_exit ();
+
+  return !OK;
+}
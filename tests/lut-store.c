@@ -0,0 +1,197 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <dirent.h>
+#include <unistd.h>
+#include <utime.h>
+#include <sys/stat.h>
+#include "babl-internal.h"
+
+/* with BABL_LUT_STORE set, built LUTs are written next to the fish cache
+ * and mapped from there, also when the LUT is needed again after having
+ * been evicted. Files left in the store by other builds, and temporary
+ * files left behind by writers, are removed when babl is initialized.
+ */
+
+#define PIXELS    (256 * 256)
+#define TIMEOUT   (60 * 1000)  /* ms */
+
+static unsigned char src[PIXELS * 4];
+static unsigned char without_lut[PIXELS * 4];
+static unsigned char with_lut[PIXELS * 4];
+
+static int
+wait_for_lut (const Babl *fish)
+{
+  int waited;
+
+  /* crosses the threshold, and queues the LUT build */
+  babl_process (fish, src, without_lut, PIXELS);
+  babl_process (fish, src, without_lut, PIXELS);
+
+  for (waited = 0; !fish->fish_path.u8_lut && waited < TIMEOUT; waited += 10)
+    usleep (10 * 1000);
+  return fish->fish_path.u8_lut != NULL;
+}
+
+static int
+count_files (const char *path)
+{
+  DIR           *dir = opendir (path);
+  struct dirent *entry;
+  int            count = 0;
+
+  if (!dir)
+    return 0;
+  while ((entry = readdir (dir)))
+    if (entry->d_name[0] != '.')
+      count++;
+  closedir (dir);
+  return count;
+}
+
+static void
+remove_files (const char *path)
+{
+  DIR           *dir = opendir (path);
+  struct dirent *entry;
+  char           file[1024];
+
+  if (!dir)
+    return;
+  while ((entry = readdir (dir)))
+    if (entry->d_name[0] != '.')
+      {
+        snprintf (file, sizeof (file), "%s/%s", path, entry->d_name);
+        remove (file);
+      }
+  closedir (dir);
+}
+
+static void
+write_file (const char *path,
+            const char *contents,
+            time_t      mtime)
+{
+  FILE          *file = fopen (path, "wb");
+  struct utimbuf times;
+
+  if (!file)
+    return;
+  fputs (contents, file);
+  fclose (file);
+
+  times.actime  = mtime;
+  times.modtime = mtime;
+  utime (path, &times);
+}
+
+static int
+check_lut (const Babl *fish,
+           const char *when)
+{
+  int i;
+
+  if (!wait_for_lut (fish) || !fish->fish_path.lut_mapped)
+    {
+      printf ("%s: LUT not mapped from the store\n", when);
+      return 0;
+    }
+
+  babl_process (fish, src, with_lut, PIXELS);
+  for (i = 0; i < PIXELS * 4; i++)
+    if (abs (with_lut[i] - without_lut[i]) > 1)
+      {
+        printf ("%s: pixel %i component %i: %i with LUT, %i without\n",
+                when, i / 4, i % 4, with_lut[i], without_lut[i]);
+        return 0;
+      }
+  return 1;
+}
+
+int
+main (void)
+{
+  char        dir[] = "/tmp/babl-lut-store-XXXXXX";
+  char        babl_dir[512];
+  char        store_dir[1024];
+  char        path[1100];
+  const Babl *fish;
+  int         OK = 1;
+  int         i;
+
+  if (!mkdtemp (dir))
+    return 1;
+  setenv ("XDG_CACHE_HOME", dir, 1);
+  setenv ("BABL_LUT", "1", 1);
+  setenv ("BABL_LUT_STORE", "1", 1);
+  snprintf (babl_dir, sizeof (babl_dir), "%s/babl", dir);
+  snprintf (store_dir, sizeof (store_dir), "%s/babl-luts", babl_dir);
+
+  mkdir (babl_dir, 0700);
+  mkdir (store_dir, 0700);
+  snprintf (path, sizeof (path), "%s/00000000deadbeef", store_dir);
+  write_file (path, "babl-lt\n from another build", time (NULL));
+  snprintf (path, sizeof (path), "%s/00000000deadbeef~1", store_dir);
+  write_file (path, "left behind", time (NULL) - 2 * 60 * 60);
+
+  babl_init ();
+
+  if (count_files (store_dir) != 0)
+    {
+      printf ("stale files were not removed from the store\n");
+      OK = 0;
+    }
+
+  fish = babl_fish (babl_format ("R'G'B'A u8"),
+                    babl_format_with_space ("R'G'B'A u8",
+                                            babl_space ("ProPhoto")));
+
+  if (fish->class_type == BABL_FISH_PATH && fish->fish_path.is_u8_color_conv)
+    {
+      for (i = 0; i < PIXELS * 4; i++)
+        src[i] = (i * 7) ^ (i >> 8);
+
+      OK &= check_lut (fish, "built");
+      if (count_files (store_dir) != 1)
+        {
+          printf ("expected a single stored LUT, found %i files\n",
+                  count_files (store_dir));
+          OK = 0;
+        }
+
+      /* evict, the LUT gets mapped again rather than rebuilt */
+      babl_set_lut_memory_limit (1);
+      babl_set_lut_memory_limit (0);
+      OK &= check_lut (fish, "reloaded");
+    }
+
+  babl_exit ();
+
+  remove_files (store_dir);
+  rmdir (store_dir);
+  remove_files (babl_dir);
+  rmdir (babl_dir);
+  rmdir (dir);
+
+  return !OK;
+}
@@ -0,0 +1,118 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "babl.h"
+
+/* the LUT timings are measured once per CPU and kept in the fish cache,
+ * later processes find them there instead of measuring again.
+ */
+
+#define TIMINGS_NAME "babl-lut-timings"
+
+/* creates a LUT candidate in a child process, so that every run starts
+ * out with only what is in the cache
+ */
+static int
+run_child (void)
+{
+  pid_t pid = fork ();
+  int   status;
+
+  if (pid == 0)
+    {
+      unsigned char src[4] = {0,};
+      unsigned char dst[4];
+
+      babl_init ();
+      babl_process (babl_fish (babl_format ("R'G'B'A u8"),
+                               babl_format_with_space ("R'G'B'A u8",
+                                                       babl_space ("ProPhoto"))),
+                    src, dst, 1);
+      babl_exit ();
+      _exit (0);
+    }
+  if (pid < 0 || waitpid (pid, &status, 0) != pid)
+    return 0;
+  return WIFEXITED (status) && WEXITSTATUS (status) == 0;
+}
+
+static int
+count_timings (const char *path)
+{
+  FILE *file = fopen (path, "rb");
+  char *data;
+  long  length;
+  long  i;
+  int   count = 0;
+
+  if (!file)
+    return -1;
+  fseek (file, 0, SEEK_END);
+  length = ftell (file);
+  fseek (file, 0, SEEK_SET);
+  data = malloc (length + 1);
+  if (fread (data, 1, length, file) != (size_t) length)
+    length = 0;
+  fclose (file);
+
+  for (i = 0; i + (long) sizeof (TIMINGS_NAME) <= length; i++)
+    if (!memcmp (data + i, TIMINGS_NAME, sizeof (TIMINGS_NAME)))
+      count++;
+  free (data);
+  return count;
+}
+
+int
+main (void)
+{
+  char dir[] = "/tmp/babl-lut-timings-XXXXXX";
+  char path[1024];
+  char babl_dir[512];
+  int  OK = 1;
+
+  if (!mkdtemp (dir))
+    return 1;
+  setenv ("XDG_CACHE_HOME", dir, 1);
+  setenv ("BABL_LUT", "1", 1);
+  snprintf (babl_dir, sizeof (babl_dir), "%s/babl", dir);
+  snprintf (path, sizeof (path), "%s/babl-fish-cache", babl_dir);
+
+  if (!run_child () || count_timings (path) != 1)
+    {
+      printf ("timings not added to the cache\n");
+      OK = 0;
+    }
+
+  if (OK && (!run_child () || count_timings (path) != 1))
+    {
+      printf ("timings measured again\n");
+      OK = 0;
+    }
+
+  remove (path);
+  rmdir (babl_dir);
+  rmdir (dir);
+
+  return !OK;
+}
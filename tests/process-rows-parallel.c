@@ -0,0 +1,121 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include "babl.h"
+
+#define WIDTH   1031
+#define HEIGHT  257
+
+static int executor_calls = 0;
+
+/* runs the tasks backwards on the calling thread, to verify that the
+ * tasks do not depend on their execution order
+ */
+static void
+reverse_executor (BablParallelTask  task,
+                  int               n_tasks,
+                  void             *task_data,
+                  void             *user_data)
+{
+  int *calls = user_data;
+  int  i;
+
+  (*calls)++;
+  for (i = n_tasks - 1; i >= 0; i--)
+    task (i, n_tasks, task_data);
+}
+
+static int
+check_rows (const char *src_fmt,
+            const char *dst_fmt,
+            long        n,
+            int         rows)
+{
+  const Babl    *fish      = babl_fish (src_fmt, dst_fmt);
+  int            src_bpp   = babl_format_get_bytes_per_pixel (babl_format (src_fmt));
+  int            dst_bpp   = babl_format_get_bytes_per_pixel (babl_format (dst_fmt));
+  int            src_stride = n * src_bpp + 12;
+  int            dst_stride = n * dst_bpp + 20;
+  unsigned char *src       = malloc (src_stride * rows);
+  unsigned char *serial    = calloc (dst_stride, rows);
+  unsigned char *parallel  = calloc (dst_stride, rows);
+  int            OK        = 1;
+  int            row;
+
+  for (long i = 0; i < (long) src_stride * rows; i++)
+    src[i] = (i * 7) ^ (i >> 9);
+
+  babl_process_rows (fish, src, src_stride, serial, dst_stride, n, rows);
+
+  if (babl_process_rows_parallel (fish, src, src_stride,
+                                  parallel, dst_stride, n, rows) != n * rows)
+    {
+      printf ("%s to %s: wrong pixel count\n", src_fmt, dst_fmt);
+      OK = 0;
+    }
+
+  for (row = 0; row < rows && OK; row++)
+    if (memcmp (serial + row * dst_stride, parallel + row * dst_stride,
+                n * dst_bpp))
+      {
+        printf ("%s to %s: %li x %i row %i differs\n",
+                src_fmt, dst_fmt, n, rows, row);
+        OK = 0;
+      }
+
+  free (src);
+  free (serial);
+  free (parallel);
+  return OK;
+}
+
+int
+main (void)
+{
+  int OK = 1;
+
+  /* exercise the thread pool even on single core machines */
+  setenv ("BABL_THREADS", "4", 0);
+
+  babl_init ();
+
+  OK &= check_rows ("R'G'B'A u8", "RGBA float", WIDTH, HEIGHT);
+  OK &= check_rows ("R'G'B' u8", "Y'A u16", WIDTH, HEIGHT);
+  /* a single wide row, split into spans */
+  OK &= check_rows ("RGBA float", "R'G'B'A u8", 512 * 1024, 1);
+  /* too small to be worth splitting */
+  OK &= check_rows ("RGBA float", "R'G'B'A u8", 17, 3);
+
+  babl_set_executor (reverse_executor, &executor_calls);
+  OK &= check_rows ("R'G'B'A u8", "RGBA float", WIDTH, HEIGHT);
+  babl_set_executor (NULL, NULL);
+
+  if (executor_calls != 1)
+    {
+      printf ("custom executor was called %i times\n", executor_calls);
+      OK = 0;
+    }
+
+  babl_exit ();
+
+  return !OK;
+}
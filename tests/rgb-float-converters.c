@@ -0,0 +1,157 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include "babl-internal.h"
+
+/* the float RGBA conversions between two RGB spaces, checked against the
+ * same conversions done in double precision, for buffers that are not
+ * aligned and for every length up to a few vectors.
+ */
+
+#define PIXELS 100003
+
+static const Babl *source_format;
+static const Babl *destination_format;
+
+static int
+find_conversion (Babl *babl,
+                 void *data)
+{
+  if (babl->conversion.source == source_format &&
+      babl->conversion.destination == destination_format)
+    {
+      *(Babl **) data = babl;
+      return 1;
+    }
+  return 0;
+}
+
+static int
+check_pair (const char *source_name,
+            const char *destination_name)
+{
+  const Babl *source_space      = babl_space ("ProPhoto");
+  const Babl *destination_space = babl_space ("Apple");
+  int         source_nonlinear      = source_name[1] == '\'';
+  int         destination_nonlinear = destination_name[1] == '\'';
+  Babl       *conversion = NULL;
+  float      *source;
+  float      *destination;
+  long        i, n;
+  int         c;
+  int         OK = 1;
+
+  source_format      = babl_format_with_space (source_name, source_space);
+  destination_format = babl_format_with_space (destination_name, destination_space);
+
+  /* makes the conversions between the spaces exist */
+  babl_fish (source_format, destination_format);
+  babl_conversion_class_for_each (find_conversion, &conversion);
+  if (!conversion)
+    {
+      printf ("no conversion from %s to %s\n",
+              babl_get_name (source_format), babl_get_name (destination_format));
+      return 0;
+    }
+
+  /* one float past a vector aligned allocation */
+  source      = malloc ((PIXELS + 2) * 4 * sizeof (float));
+  destination = malloc ((PIXELS + 2) * 4 * sizeof (float));
+  for (i = 0; i < PIXELS * 4; i++)
+    source[i + 1] = ((i * 7919) % 1201) / 1000.0f - 0.05f;
+
+  for (n = 1; n <= 40 && OK; n++)
+    {
+      destination[n * 4 + 1] = 1234.0f;
+      conversion->conversion.function.linear (conversion,
+                                              (void *) (source + 1),
+                                              (void *) (destination + 1),
+                                              n, conversion->conversion.data);
+      if (destination[n * 4 + 1] != 1234.0f)
+        {
+          printf ("%s to %s: %li pixels written past the end\n",
+                  source_name, destination_name, n);
+          OK = 0;
+        }
+    }
+
+  conversion->conversion.function.linear (conversion,
+                                          (void *) (source + 1),
+                                          (void *) (destination + 1),
+                                          PIXELS, conversion->conversion.data);
+
+  for (i = 0; i < PIXELS && OK; i++)
+    {
+      const float *in  = source + 1 + i * 4;
+      const float *out = destination + 1 + i * 4;
+      double       rgb[3];
+      double       xyz[3];
+
+      for (c = 0; c < 3; c++)
+        rgb[c] = source_nonlinear ?
+                 babl_trc_to_linear (source_space->space.trc[c], in[c]) : in[c];
+      babl_space_to_xyz (source_space, rgb, xyz);
+      babl_space_from_xyz (destination_space, xyz, rgb);
+
+      for (c = 0; c < 3; c++)
+        {
+          double expected = destination_nonlinear ?
+                             babl_trc_from_linear (destination_space->space.trc[c], rgb[c]) :
+                             rgb[c];
+
+          if (fabs (expected - out[c]) > 0.0001)
+            {
+              printf ("%s to %s: pixel %li component %i: %f instead of %f\n",
+                      source_name, destination_name, i, c, out[c], expected);
+              OK = 0;
+            }
+        }
+      if (out[3] != in[3])
+        {
+          printf ("%s to %s: pixel %li alpha changed\n",
+                  source_name, destination_name, i);
+          OK = 0;
+        }
+    }
+
+  free (source);
+  free (destination);
+  return OK;
+}
+
+int
+main (void)
+{
+  int OK = 1;
+
+  babl_init ();
+
+  OK &= check_pair ("RGBA float", "RGBA float");
+  OK &= check_pair ("R'G'B'A float", "R'G'B'A float");
+  OK &= check_pair ("R'G'B'A float", "RGBA float");
+  OK &= check_pair ("RGBA float", "R'G'B'A float");
+
+  babl_exit ();
+
+  return !OK;
+}
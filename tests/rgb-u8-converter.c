@@ -0,0 +1,116 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include "babl-internal.h"
+
+/* the R'G'B' u8 conversion between two RGB spaces, checked against the
+ * same conversion done in double precision; out of gamut colors clip, and
+ * long runs are converted without growing the stack.
+ */
+
+#define PIXELS (1 << 21)
+
+static const Babl *source_format;
+static const Babl *destination_format;
+
+static int
+find_conversion (Babl *babl,
+                 void *data)
+{
+  if (babl->conversion.source == source_format &&
+      babl->conversion.destination == destination_format)
+    {
+      *(Babl **) data = babl;
+      return 1;
+    }
+  return 0;
+}
+
+int
+main (void)
+{
+  const Babl *source_space;
+  const Babl *destination_space;
+  Babl       *conversion = NULL;
+  uint8_t    *source;
+  uint8_t    *destination;
+  long        i;
+  int         OK = 1;
+
+  babl_init ();
+
+  source_space       = babl_space ("ProPhoto");
+  destination_space  = babl_space ("sRGB");
+  source_format      = babl_format_with_space ("R'G'B' u8", source_space);
+  destination_format = babl_format_with_space ("R'G'B' u8", destination_space);
+
+  /* makes the conversions between the spaces exist */
+  babl_fish (source_format, destination_format);
+  babl_conversion_class_for_each (find_conversion, &conversion);
+  if (!conversion)
+    {
+      printf ("no conversion from %s to %s\n",
+              babl_get_name (source_format), babl_get_name (destination_format));
+      return 1;
+    }
+
+  source      = malloc (PIXELS * 3);
+  destination = malloc (PIXELS * 3);
+  for (i = 0; i < PIXELS * 3; i++)
+    source[i] = (i * 7919 + i / 3) & 255;
+
+  conversion->conversion.function.linear (conversion, (void *) source,
+                                          (void *) destination, PIXELS,
+                                          conversion->conversion.data);
+
+  for (i = 0; i < PIXELS && OK; i++)
+    {
+      double rgb[3];
+      double xyz[3];
+      int    c;
+
+      for (c = 0; c < 3; c++)
+        rgb[c] = babl_trc_to_linear (source_space->space.trc[c],
+                                     source[i * 3 + c] / 255.0);
+      babl_space_to_xyz (source_space, rgb, xyz);
+      babl_space_from_xyz (destination_space, xyz, rgb);
+
+      for (c = 0; c < 3; c++)
+        {
+          double value = babl_trc_from_linear (destination_space->space.trc[c],
+                                               rgb[c]) * 255.0 + 0.5;
+          int    expected = value < 0.0 ? 0 : value > 255.0 ? 255 : (int) value;
+
+          if (abs (expected - destination[i * 3 + c]) > 1)
+            {
+              printf ("pixel %li component %i: %i instead of %i\n",
+                      i, c, destination[i * 3 + c], expected);
+              OK = 0;
+            }
+        }
+    }
+
+  free (source);
+  free (destination);
+  babl_exit ();
+
+  return !OK;
+}
@@ -0,0 +1,142 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdio.h>
+#include <math.h>
+#include "babl-internal.h"
+
+/* conversions between two RGB spaces are only added once a fish converts
+ * between them, every other space is reached through sRGB
+ */
+
+#define N_SPACES 6
+#define PIXELS   16
+
+typedef struct
+{
+  const Babl *space_a;
+  const Babl *space_b;
+  int         count;
+} AdapterCount;
+
+static int
+count_adapter (Babl *babl,
+               void *data)
+{
+  AdapterCount *count = data;
+  const Babl   *source = babl->conversion.source;
+  const Babl   *destination = babl->conversion.destination;
+
+  if (source->class_type == BABL_FORMAT &&
+      destination->class_type == BABL_FORMAT &&
+      ((source->format.space == count->space_a &&
+        destination->format.space == count->space_b) ||
+       (source->format.space == count->space_b &&
+        destination->format.space == count->space_a)))
+    count->count++;
+  return 0;
+}
+
+static int
+adapters (const Babl *space_a,
+          const Babl *space_b)
+{
+  AdapterCount count = {space_a, space_b, 0};
+
+  babl_conversion_class_for_each (count_adapter, &count);
+  return count.count;
+}
+
+int
+main (void)
+{
+  const Babl *spaces[N_SPACES];
+  float       source[PIXELS * 4];
+  float       direct[PIXELS * 4];
+  float       via_srgb[PIXELS * 4];
+  float       linear[PIXELS * 4];
+  int         OK = 1;
+  int         i, j;
+
+  babl_init ();
+
+  for (i = 0; i < N_SPACES; i++)
+    {
+      char name[32];
+
+      snprintf (name, sizeof (name), "adapter-test-%i", i);
+      spaces[i] = babl_space_from_chromaticities (name,
+                                                  0.3127, 0.3290,
+                                                  0.64 - i * 0.01, 0.33,
+                                                  0.30, 0.60 + i * 0.01,
+                                                  0.15, 0.06,
+                                                  babl_trc ("sRGB"), NULL, NULL,
+                                                  1);
+      babl_fish (babl_format_with_space ("R'G'B'A float", spaces[i]),
+                 babl_format ("R'G'B'A u8"));
+    }
+
+  for (i = 0; i < N_SPACES; i++)
+    {
+      if (!adapters (spaces[i], babl_space ("sRGB")))
+        {
+          printf ("no adapters between %i and sRGB\n", i);
+          OK = 0;
+        }
+      for (j = 0; j < i; j++)
+        if (adapters (spaces[i], spaces[j]))
+          {
+            printf ("adapters between %i and %i made up front\n", i, j);
+            OK = 0;
+          }
+    }
+
+  for (i = 0; i < PIXELS * 4; i++)
+    source[i] = (i * 37 % 101) / 100.0f;
+
+  babl_process (babl_fish (babl_format_with_space ("R'G'B'A float", spaces[1]),
+                           babl_format_with_space ("R'G'B'A float", spaces[2])),
+                source, direct, PIXELS);
+  babl_process (babl_fish (babl_format_with_space ("R'G'B'A float", spaces[1]),
+                           babl_format ("RGBA float")),
+                source, linear, PIXELS);
+  babl_process (babl_fish (babl_format ("RGBA float"),
+                           babl_format_with_space ("R'G'B'A float", spaces[2])),
+                linear, via_srgb, PIXELS);
+
+  if (!adapters (spaces[1], spaces[2]) ||
+      adapters (spaces[1], spaces[3]) ||
+      adapters (spaces[0], spaces[2]))
+    {
+      printf ("adapters not made for just the converted pair\n");
+      OK = 0;
+    }
+
+  for (i = 0; i < PIXELS * 4; i++)
+    if (fabsf (direct[i] - via_srgb[i]) > 0.0001f)
+      {
+        printf ("%i: %f instead of %f\n", i, direct[i], via_srgb[i]);
+        OK = 0;
+        break;
+      }
+
+  babl_exit ();
+
+  return !OK;
+}
@@ -0,0 +1,215 @@
+/* babl - dynamically extendable universal pixel conversion library.
+ * Copyright (C) 2026 babl contributors.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 3 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General
+ * Public License along with this library; if not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+
+#include "config.h"
+#include <stdlib.h>
+#include <stdio.h>
+#include <math.h>
+#include "babl-internal.h"
+
+/* the span evaluation of each kind of TRC, checked against the curves
+ * evaluated in double precision, for interleaved, planar and strided
+ * buffers of lengths that are not a multiple of the evaluation blocks.
+ * Single samples evaluate to the same values as spans.
+ */
+
+#define SAMPLES 20011
+
+typedef double (*CurveFunc) (const float *params,
+                             double       x,
+                             int          to_linear);
+
+static double
+gamma_curve (const float *params,
+             double       x,
+             int          to_linear)
+{
+  if (x <= 0.0)
+    return 0.0;
+  return pow (x, to_linear ? params[0] : 1.0 / params[0]);
+}
+
+static double
+srgb_curve (const float *params,
+            double       x,
+            int          to_linear)
+{
+  if (to_linear)
+    return x > 0.04045 ? pow ((x + 0.055) / 1.055, 2.4) : x / 12.92;
+  return x > 0.003130804954 ? 1.055 * pow (x, 1.0 / 2.4) - 0.055 : 12.92 * x;
+}
+
+static double
+formula_srgb_curve (const float *params,
+                    double       x,
+                    int          to_linear)
+{
+  double g = params[0], a = params[1], b = params[2], c = params[3];
+  double d = params[4], e = params[5], f = params[6];
+
+  if (to_linear)
+    return x >= d ? pow (a * x + b, g) + e : c * x + f;
+  if (x - f > c * d)
+    return (pow (x - f, 1.0 / g) - b) / a;
+  return (x - e) / c;
+}
+
+static double
+formula_cie_curve (const float *params,
+                   double       x,
+                   int          to_linear)
+{
+  double g = params[0], a = params[1], b = params[2], c = params[3];
+
+  if (to_linear)
+    return x >= -b / a ? pow (a * x + b, g) + c : c;
+  if (x > c)
+    return (pow (x - c, 1.0 / g) - b) / a;
+  return 0.0;
+}
+
+static int
+check_layout (const Babl  *trc,
+              CurveFunc    curve,
+              const float *params,
+              int          to_linear,
+              float        max,
+              int          gap,
+              int          components)
+{
+  float *in  = malloc ((SAMPLES + 1) * gap * sizeof (float));
+  float *out = malloc ((SAMPLES + 1) * gap * sizeof (float));
+  int    count = SAMPLES / components;
+  int    OK = 1;
+  int    i, c;
+
+  for (i = 0; i < (SAMPLES + 1) * gap; i++)
+    {
+      in[i]  = max * ((i * 7919) % 10007) / 10007.0f - 0.25f;
+      out[i] = -1234.0f;
+    }
+
+  if (to_linear)
+    babl_trc_to_linear_buf (trc, in, out, gap, gap, components, count);
+  else
+    babl_trc_from_linear_buf (trc, in, out, gap, gap, components, count);
+
+  for (i = 0; i < count * gap && OK; i++)
+    {
+      c = i % gap;
+      if (c >= components)
+        {
+          if (out[i] != -1234.0f)
+            {
+              printf ("%s: gap %i components %i: sample %i overwritten\n",
+                      babl_get_name (trc), gap, components, i);
+              OK = 0;
+            }
+        }
+      else
+        {
+          float  single   = to_linear ? babl_trc_to_linear (trc, in[i]) :
+                                        babl_trc_from_linear (trc, in[i]);
+          double expected = curve ? curve (params, in[i], to_linear) : single;
+
+          if (fabs (expected - out[i]) > 1e-5 * fmax (fabs (expected), 1e-4))
+            {
+              printf ("%s: %s (%f) is %f instead of %f\n", babl_get_name (trc),
+                      to_linear ? "to linear" : "from linear",
+                      in[i], out[i], expected);
+              OK = 0;
+            }
+          else if (single != out[i])
+            {
+              printf ("%s: %s (%f) is %f for a single sample, %f in a span\n",
+                      babl_get_name (trc),
+                      to_linear ? "to linear" : "from linear",
+                      in[i], single, out[i]);
+              OK = 0;
+            }
+        }
+    }
+  if (out[count * gap] != -1234.0f)
+    {
+      printf ("%s: gap %i components %i: written past the end\n",
+              babl_get_name (trc), gap, components);
+      OK = 0;
+    }
+
+  /* in place, as the converters do */
+  if (to_linear)
+    babl_trc_to_linear_buf (trc, out, out, gap, gap, components, count);
+  else
+    babl_trc_from_linear_buf (trc, out, out, gap, gap, components, count);
+
+  free (in);
+  free (out);
+  return OK;
+}
+
+static int
+check_trc (const Babl  *trc,
+           CurveFunc    curve,
+           const float *params,
+           float        max)
+{
+  int OK = 1;
+  int to_linear;
+
+  for (to_linear = 0; to_linear <= 1; to_linear++)
+    {
+      OK = check_layout (trc, curve, params, to_linear, max, 4, 3) && OK;
+      OK = check_layout (trc, curve, params, to_linear, max, 1, 1) && OK;
+      OK = check_layout (trc, curve, params, to_linear, max, 2, 1) && OK;
+      OK = check_layout (trc, curve, params, to_linear, max, 3, 3) && OK;
+    }
+  return OK;
+}
+
+int
+main (int    argc,
+      char **argv)
+{
+  float gamma[1]   = {2.2f};
+  float rec709[7]  = {1 / 0.45f, 1 / 1.099f, 0.099f / 1.099f, 1 / 4.5f,
+                      0.081f, 0.0f, 0.0f};
+  float cie[5]     = {2.6f, 0.95f, 0.05f, 0.001f, 0.01f};
+  float lut[1000];
+  int   OK = 1;
+  int   i;
+
+  babl_init ();
+
+  for (i = 0; i < 1000; i++)
+    lut[i] = pow (i / 999.0, 1.8);
+
+  OK = check_trc (babl_trc_gamma (gamma[0]), gamma_curve, gamma, 1.5f) && OK;
+  OK = check_trc (babl_trc_gamma (gamma[0]), gamma_curve, gamma, 64.0f) && OK;
+  OK = check_trc (babl_trc ("sRGB"), srgb_curve, NULL, 1.5f) && OK;
+  OK = check_trc (babl_trc_new (NULL, BABL_TRC_FORMULA_SRGB, rec709[0], 0, rec709),
+                  formula_srgb_curve, rec709, 1.5f) && OK;
+  OK = check_trc (babl_trc_new (NULL, BABL_TRC_FORMULA_CIE, cie[0], 0, cie),
+                  formula_cie_curve, cie, 1.5f) && OK;
+  /* LUT TRCs are defined by their interpolation */
+  OK = check_trc (babl_trc_new (NULL, BABL_TRC_LUT, 0, 1000, lut),
+                  NULL, NULL, 1.5f) && OK;
+
+  babl_exit ();
+
+  return !OK;
+}
@@ -19,6 +19,7 @@
 #include "config.h"
 #include <math.h>
 #include "babl-internal.h"
+#include "babl-cpuaccel.h"
 
 #ifndef HAVE_SRANDOM
 #define srandom srand
@@ -30,6 +31,8 @@
  * arg is ignored (i.e. same as always 1).
  */
 #define setenv(name,value,overwrite) _putenv_s(name, value)
+#define popen  _popen
+#define pclose _pclose
 #endif
 
 int ITERATIONS = 4;
@@ -414,12 +417,228 @@ test (int set_no)
   return 0;
 }
 
+/* babl --simd compares the x86-64-v4 (AVX-512) code babl picks on CPUs that
+ * have it against the x86-64-v3 code it would otherwise use. Each level runs
+ * in its own process, since the code paths are chosen at babl_init. Each
+ * workflow is kept busy for a while, long enough for a lowered AVX-512
+ * clock to kick in, and a scalar canary loop timed right after every burst,
+ * against the same loop once the core had time to clock back up, shows how
+ * much the code surrounding babl is slowed down by it.
+ */
+
+#define SIMD_MIN_TIME   250000  /* microseconds per workflow */
+#define SIMD_SETTLE     20000   /* microseconds of scalar code between them */
+#define SIMD_CANARY_OPS 2000000
+
+static const char *simd_workflows[][4]={
+  {"RGBA float",    "sRGB",     "R'G'B'A float", "sRGB"},
+  {"R'G'B'A float", "sRGB",     "RGBA float",    "sRGB"},
+  {"R'G'B'A u8",    "sRGB",     "RGBA float",    "sRGB"},
+  {"RGBA float",    "sRGB",     "R'G'B'A u8",    "sRGB"},
+  {"RGBA u16",      "sRGB",     "RaGaBaA float", "sRGB"},
+  {"RGB float",     "sRGB",     "Y' float",      "sRGB"},
+  {"RGBA float",    "ProPhoto", "RGBA float",    "Rec2020"},
+  {"R'G'B'A float", "ProPhoto", "R'G'B'A u16",   "Rec2020"},
+  {"R'G'B' u8",     "sRGB",     "R'G'B'A half",  "Rec2020"},
+  {"CMYKA float",   "sRGB",     "RGBA float",    "sRGB"},
+};
+#define SIMD_N_WORKFLOWS (sizeof (simd_workflows) / sizeof (simd_workflows[0]))
+
+/* dependent scalar integer work, that no compiler can vectorize */
+static double
+simd_canary (void)
+{
+  static volatile uint64_t sink;
+  uint64_t x = sink | 1;
+  long     start, end;
+  int      i;
+
+  start = bench_ticks ();
+  for (i = 0; i < SIMD_CANARY_OPS; i++)
+    x = x * 6364136223846793005ULL + 1442695040888963407ULL;
+  end = bench_ticks ();
+  sink = x;
+  return (end - start) * 1000.0 / SIMD_CANARY_OPS; /* nanoseconds per op */
+}
+
+/* the best canary timing once only scalar code ran for SIMD_SETTLE */
+static double
+simd_canary_settled (void)
+{
+  long   start = bench_ticks ();
+  double best  = simd_canary ();
+  int    i;
+
+  while (bench_ticks () - start < SIMD_SETTLE)
+    simd_canary ();
+
+  for (i = 0; i < 3; i++)
+    {
+      double canary = simd_canary ();
+      if (canary < best)
+        best = canary;
+    }
+  return best;
+}
+
+static int
+simd_child (void)
+{
+  BablCpuAccelFlags accel;
+  char   *src_data;
+  char   *dst_data;
+  int     i;
+
+  babl_init ();
+  accel = babl_cpu_accel_get_support ();
+  fprintf (stdout, "level %d\n",
+           (accel & BABL_CPU_ACCEL_X86_64_V4) == BABL_CPU_ACCEL_X86_64_V4 ? 4 :
+           (accel & BABL_CPU_ACCEL_X86_64_V3) == BABL_CPU_ACCEL_X86_64_V3 ? 3 : 0);
+
+  src_data = babl_malloc (N_BYTES);
+  dst_data = babl_malloc (N_BYTES);
+  /* floats in the 0.0-1.0 range, random bytes would make many of them
+   * denormals and NaNs, that are slow for other reasons */
+  for (i = 0; i < N_BYTES / 4; i++)
+    ((float *) src_data)[i] = (random () % 10000) / 10000.0f;
+
+  for (i = 0; i < (int) SIMD_N_WORKFLOWS; i++)
+    {
+      const Babl *fish = babl_fish (
+        babl_format_with_space (simd_workflows[i][0],
+                                babl_space (simd_workflows[i][1])),
+        babl_format_with_space (simd_workflows[i][2],
+                                babl_space (simd_workflows[i][3])));
+      long start, end;
+      long pixels = 0;
+
+      babl_process (fish, src_data, dst_data, N_PIXELS/4);
+      start = bench_ticks ();
+      do
+        {
+          babl_process (fish, src_data, dst_data, N_PIXELS/4);
+          pixels += N_PIXELS/4;
+          end = bench_ticks ();
+        }
+      while (end - start < SIMD_MIN_TIME);
+
+      {
+        double canary = simd_canary ();
+
+        fprintf (stdout, "workflow %d %f %f\n", i,
+                 pixels / (double) (end - start),
+                 canary / simd_canary_settled ());
+      }
+    }
+
+  babl_free (src_data);
+  babl_free (dst_data);
+  babl_exit ();
+  return 0;
+}
+
+static int
+simd_run_child (const char *self,
+                int         inhibit_avx512,
+                double     *mpps,
+                double     *canary)
+{
+  char  command[4096];
+  char  line[256];
+  FILE *child;
+  int   level = -1;
+  int   n = 0;
+
+  setenv ("BABL_INHIBIT_AVX512", inhibit_avx512 ? "1" : "0", 1);
+  snprintf (command, sizeof (command), "\"%s\" --simd-child", self);
+  child = popen (command, "r");
+  if (!child)
+    return -1;
+
+  while (fgets (line, sizeof (line), child))
+    {
+      int    no;
+      double value, ratio;
+
+      if (sscanf (line, "level %d", &no) == 1)
+        level = no;
+      else if (sscanf (line, "workflow %d %lf %lf", &no, &value, &ratio) == 3 &&
+               no >= 0 && no < (int) SIMD_N_WORKFLOWS)
+        {
+          mpps[no]   = value;
+          canary[no] = ratio;
+          n++;
+        }
+    }
+  pclose (child);
+
+  return n == (int) SIMD_N_WORKFLOWS ? level : -1;
+}
+
+static int
+simd_compare (const char *self)
+{
+  double v3[SIMD_N_WORKFLOWS],  v4[SIMD_N_WORKFLOWS];
+  double v3_canary[SIMD_N_WORKFLOWS], v4_canary[SIMD_N_WORKFLOWS];
+  double log_speedup = 0.0, log_v3_canary = 0.0, log_v4_canary = 0.0;
+  double speedup, slowdown;
+  int    i;
+
+  if ((babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_64_V4) !=
+      BABL_CPU_ACCEL_X86_64_V4)
+    {
+      fprintf (stdout, "this CPU does not support x86-64-v4 (AVX-512), "
+                       "babl uses the %s code\n",
+               (babl_cpu_accel_get_support () & BABL_CPU_ACCEL_X86_64_V3) ==
+               BABL_CPU_ACCEL_X86_64_V3 ? "x86-64-v3" : "generic or x86-64-v2");
+      return 0;
+    }
+
+  if (simd_run_child (self, 1, v3, v3_canary) != 3 ||
+      simd_run_child (self, 0, v4, v4_canary) != 4)
+    {
+      fprintf (stderr, "running %s --simd-child failed\n", self);
+      return -1;
+    }
+
+  fprintf (stdout, "%10s %10s %8s %8s  workflow\n",
+           "v3 mp/s", "v4 mp/s", "v4/v3", "canary");
+  for (i = 0; i < (int) SIMD_N_WORKFLOWS; i++)
+    {
+      fprintf (stdout, "%10.2f %10.2f %7.2fx %7.2fx  %s %s to %s %s\n",
+               v3[i], v4[i], v4[i] / v3[i], v4_canary[i] / v3_canary[i],
+               simd_workflows[i][0], simd_workflows[i][1],
+               simd_workflows[i][2], simd_workflows[i][3]);
+      log_speedup   += log (v4[i] / v3[i]);
+      log_v3_canary += log (v3_canary[i]);
+      log_v4_canary += log (v4_canary[i]);
+    }
+  speedup  = exp (log_speedup / SIMD_N_WORKFLOWS);
+  slowdown = exp ((log_v4_canary - log_v3_canary) / SIMD_N_WORKFLOWS);
+
+  fprintf (stdout, "\ngeometric mean: conversions %.2fx as fast with AVX-512, "
+                   "scalar code after them %.2fx as slow\n", speedup, slowdown);
+
+  /* what babl gains has to outweigh what the rest of the program loses
+   * to a lowered clock */
+  if (speedup >= slowdown)
+    fprintf (stdout, "AVX-512 wins on this CPU, keep the x86-64-v4 code\n");
+  else
+    fprintf (stdout, "AVX-512 loses on this CPU, "
+                     "set BABL_INHIBIT_AVX512=1 to use the x86-64-v3 code\n");
+  return 0;
+}
+
 int
 main (int    argc,
       char **argv)
 {
   //if (argv[1]) ITERATIONS = atoi (argv[1]);
   setenv ("BABL_INHIBIT_CACHE", "1", 1);
+  if (argv[1] && !strcmp (argv[1], "--simd"))
+    return simd_compare (argv[0]);
+  if (argv[1] && !strcmp (argv[1], "--simd-child"))
+    return simd_child ();
   babl_init ();
   if (argv[1] && argv[2]) show_details = 1;
   if (argv[1])